@@ -26,19 +26,32 @@
 #include <linux/of_irq.h>
 #include <linux/interrupt.h>
 #include <linux/time.h>
+#include <linux/kthread.h>
 
 #include "avionics.h"
 #include "avionics-device.h"
+#include "avionics-spi.h"
 
 MODULE_DESCRIPTION("HOLT Hi-3593 ARINC-429 Driver");
 MODULE_LICENSE("GPL v2");
 MODULE_AUTHOR("Charles Eidsness <charles@ccxtechnologies.com>");
 MODULE_VERSION("1.2.0");
 
+static bool rx_coalesce = true;
+module_param(rx_coalesce, bool, 0644);
+MODULE_PARM_DESC(rx_coalesce, "Wait for the receive FIFO to half fill"
+		 " before reading it (default true)");
+
 #define HI3593_FIFO_DEPTH	32
 #define HI3593_SAMPLE_SIZE	(sizeof(avionics_data))
 #define HI3593_MTU		(HI3593_FIFO_DEPTH * HI3593_SAMPLE_SIZE * 8)
 
+/* packets waiting for the transmit FIFO before the queue is stopped, and
+ * how long to wait for the FIFO to drain, a full FIFO takes about 90 ms
+ * to send at the low speed rate */
+#define HI3593_TX_QUEUE_DEPTH		8
+#define HI3593_TX_TIMEOUT_MSECS		250
+
 #define HI3593_OPCODE_RESET		0x04
 #define HI3593_OPCODE_RD_TX_STATUS	0x80
 #define HI3593_OPCODE_RD_ALCK		0xd4
@@ -96,12 +109,18 @@ MODULE_VERSION("1.2.0");
 
 #define HI3593_RX_DELAY_MULTIPLIER_MAX	 ((HI3593_FIFO_DEPTH/2+4)*sizeof(__u32)*1000000)
 #define HI3593_RX_DELAY_MULTIPLIER_MIN	 ((HI3593_FIFO_DEPTH/2)*sizeof(__u32)*1000000)
-#define HI3593_RX_HALF_FILL_MULTIPLIER	 ((HI3593_FIFO_DEPTH/2+2)*sizeof(__u32)*HZ)
+#define HI3593_RX_HALF_FILL_MULTIPLIER	 ((HI3593_FIFO_DEPTH/2+2)*sizeof(__u32)*USEC_PER_SEC)
+
+/* a word is 32 bits followed by at least a 4 bit gap */
+#define HI3593_WORD_BITS	36
+
+/* a FIFO read is the opcode followed by the 4 byte word */
+#define HI3593_WORD_XFER	5
+#define HI3593_STATUS_XFER	2
 
 struct hi3593 {
 	struct net_device *rx[HI3593_NUM_RX];
 	struct net_device *tx[HI3593_NUM_TX];
-	struct workqueue_struct *wq;
 	int reset_gpio;
 	int irq[2];
 	__u32 aclk;
@@ -116,16 +135,24 @@ struct hi3593_priv {
 	int tx_index;
 	int rx_index;
 	struct mutex *lock;
-	struct workqueue_struct *wq;
-	struct delayed_work worker;
+	struct kthread_work worker;
 	int irq;
 	__u8 even_parity;
 	__u8 check_parity;
 	atomic_t *rx_enabled;
+	struct avionics_spi_burst *rx_burst[2];
+	__u8 rx_rd_cmd[HI3593_WORD_XFER];
+	__u8 rx_status_cmd[HI3593_STATUS_XFER];
+	struct mutex rx_lock;
+	bool rx_polled;
+	struct avionics_spi_burst *tx_burst;
+	struct avionics_tx_schedule *tx_schedule;
 	int rate;
 	unsigned long rx_udelay_min;
 	unsigned long rx_udelay_max;
-	unsigned long rx_wrk_delay;
+	unsigned long rx_coalesce_usecs;
+	unsigned long rx_word_nsecs;
+	ktime_t rx_irq_time;
 };
 
 static ssize_t hi3593_get_cntrl(struct hi3593_priv *priv)
@@ -225,7 +252,8 @@ static int hi3593_set_rate(struct avionics_rate *rate,
 	priv->rate = rate->rate_hz;
 	priv->rx_udelay_min = HI3593_RX_DELAY_MULTIPLIER_MIN/priv->rate;
 	priv->rx_udelay_max = HI3593_RX_DELAY_MULTIPLIER_MAX/priv->rate;
-	priv->rx_wrk_delay = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
+	priv->rx_coalesce_usecs = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
+	priv->rx_word_nsecs = (NSEC_PER_SEC/priv->rate)*HI3593_WORD_BITS;
 
 	return 0;
 }
@@ -254,7 +282,8 @@ static void hi3593_get_rate(struct avionics_rate *rate,
 	priv->rate = rate->rate_hz;
 	priv->rx_udelay_min = HI3593_RX_DELAY_MULTIPLIER_MIN/priv->rate;
 	priv->rx_udelay_max = HI3593_RX_DELAY_MULTIPLIER_MAX/priv->rate;
-	priv->rx_wrk_delay = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
+	priv->rx_coalesce_usecs = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
+	priv->rx_word_nsecs = (NSEC_PER_SEC/priv->rate)*HI3593_WORD_BITS;
 }
 
 static void hi3593_get_arinc429rx(struct avionics_arinc429rx *config,
@@ -409,16 +438,22 @@ static int hi3593_set_arinc429tx(struct avionics_arinc429tx *config,
 	return 0;
 }
 
+static int hi3593_rx_poll(struct net_device *dev);
+static void hi3593_rx_irq_enable(struct net_device *dev, bool enable);
+
 static struct avionics_ops hi3593_arinc429rx_ops = {
 	.name = "arinc429rx%d",
 	.set_rate = hi3593_set_rate,
 	.get_rate = hi3593_get_rate,
 	.get_arinc429rx = hi3593_get_arinc429rx,
 	.set_arinc429rx = hi3593_set_arinc429rx,
+	.rx_poll = hi3593_rx_poll,
+	.rx_irq = hi3593_rx_irq_enable,
 };
 
 static struct avionics_ops hi3593_arinc429tx_ops = {
 	.name = "arinc429tx%d",
+	.flags = AVIONICS_OPS_WORKER,
 	.set_rate = hi3593_set_rate,
 	.get_rate = hi3593_get_rate,
 	.get_arinc429tx = hi3593_get_arinc429tx,
@@ -454,7 +489,7 @@ static int hi3593_tx_open(struct net_device *dev)
 		return err;
 	}
 
-	netif_wake_queue(dev);
+	avionics_device_tx_wake(dev);
 
 	return 0;
 }
@@ -501,8 +536,12 @@ static int hi3593_rx_open(struct net_device *dev)
 		return 0;
 	}
 
+	mutex_lock(&priv->rx_lock);
 	atomic_set(priv->rx_enabled, 1);
-	enable_irq(priv->irq);
+	if (!priv->rx_polled) {
+		enable_irq(priv->irq);
+	}
+	mutex_unlock(&priv->rx_lock);
 
 	return 0;
 }
@@ -521,48 +560,90 @@ static int hi3593_rx_stop(struct net_device *dev)
 		return -EINVAL;
 	}
 
+	mutex_lock(&priv->rx_lock);
 	atomic_set(priv->rx_enabled, 0);
-	disable_irq(priv->irq);
+	if (!priv->rx_polled) {
+		disable_irq_nosync(priv->irq);
+	}
+	mutex_unlock(&priv->rx_lock);
+
+	/* wait for the interrupt thread outside of the lock it takes */
+	synchronize_irq(priv->irq);
 
 	return 0;
 }
 
-static void hi3593_rx_worker(struct work_struct *work)
+/* The status tells us at least how many words are waiting. */
+static int hi3593_rx_num_reads(ssize_t status)
+{
+	if (status & HI3593_FIFO_FULL) {
+		return HI3593_FIFO_DEPTH;
+	} else if (status & HI3593_FIFO_HALF) {
+		return HI3593_FIFO_DEPTH/2;
+	}
+
+	return 1;
+}
+
+/* Starts reading num_reads words from the receive FIFO followed by the
+ * receive status, all in one SPI message. Once it's waited on the
+ * status is the last transfer in the burst. */
+static int hi3593_rxfifo_start(struct hi3593_priv *priv,
+			       struct avionics_spi_burst *burst, int num_reads)
+{
+	int i;
+
+	avionics_spi_burst_reset(burst);
+
+	for (i = 0; i < num_reads; i++) {
+		avionics_spi_burst_add(burst, priv->rx_rd_cmd,
+				       sizeof(priv->rx_rd_cmd));
+	}
+
+	avionics_spi_burst_add(burst, priv->rx_status_cmd,
+			       sizeof(priv->rx_status_cmd));
+
+	return avionics_spi_burst_submit(burst);
+}
+
+/* Empties the receive FIFO, and the priority label registers, into
+ * the network stack. When linger is set a short wait is made for more
+ * words once the FIFO empties. Returns the number of words read.
+ *
+ * Words are timestamped from their position in the FIFO rather than
+ * reading the clock for each one. A word can't have arrived later
+ * than a word time before the next one in the FIFO, and the status
+ * that said it was there was read, or sooner than a word time after
+ * the one ahead of it, counting forward from irq_time when the
+ * interrupt marked the first word's arrival. */
+static int hi3593_rx_read(struct hi3593_priv *priv, bool linger,
+			  ktime_t irq_time)
 {
 	struct net_device *dev;
 	struct net_device_stats *stats;
-	struct hi3593_priv *priv;
-	struct sk_buff *skb;
-	struct timespec64 tv;
+	struct sk_buff *skb = NULL;
 	avionics_data *data;
 	__u32 vbuffer;
-	__u8 status_cmd, rd_cmd, buffer[4];
+	__u8 status_cmd, buffer[4], *word;
 	__u8 pl_cmd[3], pl_rd, pl[3];
 	const __u8 pl_bits[3] = {HI3593_PRIORITY_LABEL1,
 		HI3593_PRIORITY_LABEL2, HI3593_PRIORITY_LABEL3};
+	struct avionics_spi_burst *burst;
+	ktime_t begin, start, now, ref, time, first;
 	ssize_t status;
-	int err, i, cnt;
+	int err, i, cnt, max, num_reads, next, cur, pos = 0, words = 0;
 
-	priv = container_of((struct delayed_work*)work,
-			    struct hi3593_priv, worker);
 	dev = priv->dev;
 	stats = &dev->stats;
-
-	priv = avionics_device_priv(dev);
-	if (!priv) {
-		pr_err("avionics-hi3593: Failed to get private data\n");
-		return;
-	}
+	begin = ktime_get_real();
 
 	if (priv->rx_index == 0) {
-		rd_cmd = HI3593_OPCODE_RD_RX1_FIFO;
 		status_cmd = HI3593_OPCODE_RD_RX1_STATUS;
 		pl_cmd[0] = HI3593_OPCODE_RD_RX1_PL1;
 		pl_cmd[1] = HI3593_OPCODE_RD_RX1_PL2;
 		pl_cmd[2] = HI3593_OPCODE_RD_RX1_PL3;
 		pl_rd = HI3593_OPCODE_RD_RX1_PRIORITY;
 	} else if (priv->rx_index == 1) {
-		rd_cmd = HI3593_OPCODE_RD_RX2_FIFO;
 		status_cmd = HI3593_OPCODE_RD_RX2_STATUS;
 		pl_cmd[0] = HI3593_OPCODE_RD_RX2_PL1;
 		pl_cmd[1] = HI3593_OPCODE_RD_RX2_PL2;
@@ -570,13 +651,7 @@ static void hi3593_rx_worker(struct work_struct *work)
 		pl_rd = HI3593_OPCODE_RD_RX2_PRIORITY;
 	} else {
 		pr_err("avionics-hi3593: No valid port index\n");
-		return;
-	}
-
-	data = kmalloc(HI3593_MTU, GFP_KERNEL);
-	if (data == NULL) {
-		pr_err("avionics-hi3593: Failed to allocate data buffer\n");
-		return;
+		return 0;
 	}
 
 	status = spi_w8r8(priv->spi, status_cmd);
@@ -584,10 +659,12 @@ static void hi3593_rx_worker(struct work_struct *work)
 		pr_err("avionics-hi3593: Failed to read status\n");
 		goto done;
 	}
+	ref = ktime_get_real();
 
 	if (status & HI3593_FIFO_FULL) {
 		stats->rx_errors++;
 		stats->rx_fifo_errors++;
+		avionics_device_event(dev, AVIONICS_EVENT_RX_OVERFLOW);
 	}
 
 	if (status & (pl_bits[0] | pl_bits[1] | pl_bits[2])) {
@@ -621,224 +698,453 @@ static void hi3593_rx_worker(struct work_struct *work)
 
 				skb = avionics_device_alloc_skb(dev, HI3593_SAMPLE_SIZE);
 				if (unlikely(!skb)) {
-					pr_err("avionics-lb: Failed to"
+					pr_err("avionics-hi3593: Failed to"
 					       " allocate RX buffer\n");
 					goto done;
 				}
 
-				ktime_get_real_ts64(&tv);
-				data[0].time_msecs = (tv.tv_sec*MSEC_PER_SEC) +
-					(tv.tv_nsec/NSEC_PER_MSEC);
+				data = (avionics_data *)skb->data;
+
+				time = irq_time ? irq_time : ref;
+				avionics_device_rx_tstamp(skb, time);
+				data[0].time_nsecs = ktime_to_ns(time);
+				data[0].flags = AVIONICS_RECORD_PRIORITY;
 				vbuffer = buffer[0] + (buffer[1]<<8) +
 					  (buffer[2]<<16) + (buffer[3]<<24);
 				data[0].value = be32_to_cpu(vbuffer);
 
-				skb_copy_to_linear_data(skb, data, HI3593_SAMPLE_SIZE);
-
-				stats->rx_packets++;
-				stats->rx_bytes += skb->len;
+				avionics_device_rx_stats(dev, skb->len);
+				avionics_device_latency(dev,
+						AVIONICS_LATENCY_THREAD_RX,
+						begin, ktime_get_real());
 				netif_rx_ni(skb);
+				skb = NULL;
+				words++;
 			} else {
 				stats->rx_errors++;
 				stats->rx_crc_errors++;
+				avionics_device_event(dev,
+						      AVIONICS_EVENT_PARITY);
 			}
 		}
 	}
 
 	cnt = 0;
+	max = HI3593_MTU / HI3593_SAMPLE_SIZE;
 	if (!(status & HI3593_FIFO_EMPTY)) {
-		for (i = 0; i < HI3593_MTU; i += HI3593_SAMPLE_SIZE) {
 
-			err = spi_write_then_read(priv->spi, &rd_cmd,
-						  sizeof(rd_cmd),
-						  buffer,
-						  sizeof(buffer));
-			if (unlikely(err)) {
+		/* decode straight into the skb and trim it once we know
+		 * how many words we actually got */
+		skb = avionics_device_alloc_skb(dev, HI3593_MTU);
+		if (unlikely(!skb)) {
+			pr_err("avionics-hi3593: Failed to"
+			       " allocate RX buffer\n");
+			goto done;
+		}
+		data = (avionics_data *)skb->data;
+
+		/* two bursts are used so the next one is on the bus while
+		 * the last one is decoded, and nothing goes to done with
+		 * a burst still running */
+		cur = 0;
+		next = min(hi3593_rx_num_reads(status), max);
+		start = ktime_get_real();
+		err = hi3593_rxfifo_start(priv, priv->rx_burst[cur], next);
+		if (unlikely(err)) {
+			pr_err("avionics-hi3593: Failed to"
+			       " read from fifo\n");
+			goto done;
+		}
+
+		while (next) {
+			burst = priv->rx_burst[cur];
+			num_reads = next;
+			next = 0;
+
+			err = avionics_spi_burst_wait(burst);
+			if (unlikely(err < 0)) {
 				pr_err("avionics-hi3593: Failed to"
 				       " read from fifo\n");
 				goto done;
 			}
+			now = ktime_get_real();
+			avionics_device_latency(dev, AVIONICS_LATENCY_SPI_BURST,
+						start, now);
+
+			/* the status read is the last transfer, if it's
+			 * there so are the word reads */
+			word = avionics_spi_burst_rx(burst, num_reads);
+			if (unlikely(!word)) {
+				pr_err("avionics-hi3593: Short fifo burst\n");
+				goto done;
+			}
+			status = word[1];
+
+			/* parity errors only make the count smaller so
+			 * this never overfills the packet */
+			if (!(status & HI3593_FIFO_EMPTY)
+			    && ((cnt + num_reads) < max)) {
+				next = min(hi3593_rx_num_reads(status),
+					   max - cnt - num_reads);
+				start = ktime_get_real();
+				err = hi3593_rxfifo_start(priv,
+						priv->rx_burst[!cur], next);
+				if (unlikely(err)) {
+					pr_err("avionics-hi3593: Failed to"
+					       " read from fifo\n");
+					next = 0;
+					linger = false;
+				}
+			}
+
+			for (i = 0; i < num_reads; i++) {
+				word = avionics_spi_burst_rx(burst, i) + 1;
+
+				time = ktime_sub_ns(ref, (num_reads - 1 - i)
+						    * priv->rx_word_nsecs);
+				if (irq_time) {
+					first = ktime_add_ns(irq_time, pos
+							* priv->rx_word_nsecs);
+					if (ktime_before(first, time)) {
+						time = first;
+					}
+				}
+				pos++;
+
+				if(priv->check_parity &&
+				   !(priv->even_parity && (0x80&word[0])) &&
+				   ((0x80&word[0]) != 0x00)) {
+					stats->rx_errors++;
+					stats->rx_crc_errors++;
+					avionics_device_event(dev,
+						AVIONICS_EVENT_PARITY);
+					continue;
+				}
 
-			if(!priv->check_parity ||
-			   (priv->even_parity && (0x80&buffer[0])) ||
-			   ((0x80&buffer[0]) == 0x00)) {
 				if (priv->check_parity && priv->even_parity) {
-					buffer[0] &= 0x7f;
+					word[0] &= 0x7f;
 				}
 
-				ktime_get_real_ts64(&tv);
-				data[cnt].time_msecs = (tv.tv_sec*MSEC_PER_SEC) +
-					(tv.tv_nsec/NSEC_PER_MSEC);
-				vbuffer = buffer[0] + (buffer[1]<<8) +
-					  (buffer[2]<<16) + (buffer[3]<<24);
+				if (!cnt) {
+					avionics_device_rx_tstamp(skb, time);
+				}
+
+				data[cnt].time_nsecs = ktime_to_ns(time);
+				data[cnt].flags = 0;
+				vbuffer = word[0] + (word[1]<<8) +
+					  (word[2]<<16) + (word[3]<<24);
 				data[cnt].value = be32_to_cpu(vbuffer);
 
 				cnt++;
+			}
 
-			} else {
-				stats->rx_errors++;
-				stats->rx_crc_errors++;
+			/* the status was read at the end of the burst */
+			ref = now;
+
+			if (next) {
+				cur = !cur;
+				continue;
 			}
 
+			if (!(status & HI3593_FIFO_EMPTY) || !linger
+			    || (cnt >= max)) {
+				break;
+			}
+
+			usleep_range(priv->rx_udelay_min, priv->rx_udelay_max);
 			status = spi_w8r8(priv->spi, status_cmd);
 			if (unlikely(status < 0)) {
 				pr_err("avionics-hi3593: Failed to"
 				       " read status\n");
 				goto done;
 			}
+			ref = ktime_get_real();
 
-			if(status & HI3593_FIFO_EMPTY) {
-				usleep_range(priv->rx_udelay_min,
-					     priv->rx_udelay_max);
-				status = spi_w8r8(priv->spi, status_cmd);
-				if (unlikely(status < 0)) {
-					pr_err("avionics-hi3593: Failed to"
-					       " read status\n");
-					goto done;
-				}
-				if(status & HI3593_FIFO_EMPTY) {
-					break;
-				}
+			/* words that arrive after the FIFO empties
+			 * aren't timed from the interrupt */
+			irq_time = 0;
+			if (status & HI3593_FIFO_EMPTY) {
+				break;
 			}
-		}
 
-		if (cnt) {
-			skb = avionics_device_alloc_skb(dev, cnt*HI3593_SAMPLE_SIZE);
-			if (unlikely(!skb)) {
-				pr_err("avionics-lb: Failed to"
-				       " allocate RX buffer\n");
-				goto done;
+			next = min(hi3593_rx_num_reads(status), max - cnt);
+			start = ktime_get_real();
+			err = hi3593_rxfifo_start(priv, priv->rx_burst[cur],
+						  next);
+			if (unlikely(err)) {
+				pr_err("avionics-hi3593: Failed to"
+				       " read from fifo\n");
+				break;
 			}
+		}
 
-			skb_copy_to_linear_data(skb, data, cnt*HI3593_SAMPLE_SIZE);
+		if (cnt) {
+			skb_trim(skb, cnt*HI3593_SAMPLE_SIZE);
 
-			stats->rx_packets++;
-			stats->rx_bytes += skb->len;
+			avionics_device_rx_stats(dev, skb->len);
+			avionics_device_latency(dev, AVIONICS_LATENCY_THREAD_RX,
+						begin, ktime_get_real());
 			netif_rx_ni(skb);
+			skb = NULL;
+			words += cnt;
 		}
 	}
 
 done:
-	kfree(data);
-	enable_irq(priv->irq);
+	kfree_skb(skb);
 
+	return words;
 }
 
-static irqreturn_t hi3593_rx_irq(int irq, void *data)
+static irqreturn_t hi3593_rx_irq(int irq, void *irq_data)
 {
-	struct hi3593_priv *priv = data;
+	struct hi3593_priv *priv = irq_data;
+	ktime_t irq_time;
 
 	if (unlikely(irq != priv->irq)) {
 		pr_err("avionics-hi3593: Unexpected irq %d\n", irq);
 		return IRQ_HANDLED;
 	}
 
-	disable_irq_nosync(priv->irq);
+	if (!atomic_read(priv->rx_enabled)) {
+		return IRQ_HANDLED;
+	}
+
+	avionics_device_thread_update(priv->dev);
 
-	if (atomic_read(priv->rx_enabled)) {
-		queue_delayed_work(priv->wq, &priv->worker, priv->rx_wrk_delay);
+	irq_time = READ_ONCE(priv->rx_irq_time);
+	avionics_device_latency(priv->dev, AVIONICS_LATENCY_IRQ_THREAD,
+				irq_time, ktime_get_real());
+
+	/* give the FIFO a chance to fill so it's read in bursts */
+	if (rx_coalesce && priv->rx_coalesce_usecs) {
+		usleep_range(priv->rx_coalesce_usecs,
+			     priv->rx_coalesce_usecs + 100);
 	}
 
+	mutex_lock(&priv->rx_lock);
+	hi3593_rx_read(priv, true, irq_time);
+	mutex_unlock(&priv->rx_lock);
+
 	return IRQ_HANDLED;
 }
 
-static void hi3593_tx_worker(struct work_struct *work)
+/* The receive interrupt fires as the first word lands in an empty
+ * FIFO, take the time here so how long the thread takes to run
+ * doesn't matter. */
+static irqreturn_t hi3593_rx_irq_time(int irq, void *irq_data)
 {
-	struct net_device *dev;
-	struct net_device_stats *stats;
-	struct hi3593_priv *priv;
-	struct sk_buff *skb;
-	avionics_data *data;
-	__u8 rd_cmd, wr_cmd[5];
-	__u32 vbuffer;
-	__u64 time_msecs, offset_msecs;
-	ssize_t status;
-	struct timespec64 tv;
-	int err, i;
+	struct hi3593_priv *priv = irq_data;
 
-	priv = container_of((struct delayed_work*)work,
-			    struct hi3593_priv, worker);
-	dev = priv->dev;
-	stats = &dev->stats;
+	WRITE_ONCE(priv->rx_irq_time, ktime_get_real());
+
+	return IRQ_WAKE_THREAD;
+}
+
+/* The receive FIFO is polled instead of waiting for interrupts while
+ * the core's poller has the interrupt switched off. */
+static int hi3593_rx_poll(struct net_device *dev)
+{
+	struct hi3593_priv *priv;
+	int words;
 
 	priv = avionics_device_priv(dev);
 	if (!priv) {
 		pr_err("avionics-hi3593: Failed to get private data\n");
-		return;
+		return -EINVAL;
 	}
 
-	if (priv->tx_index == 0) {
-		rd_cmd = HI3593_OPCODE_RD_TX_STATUS;
-	} else {
-		pr_err("avionics-hi3593: No valid port index\n");
+	if (!atomic_read(priv->rx_enabled)) {
+		return 0;
+	}
+
+	mutex_lock(&priv->rx_lock);
+	words = hi3593_rx_read(priv, false, 0);
+	mutex_unlock(&priv->rx_lock);
+
+	return words;
+}
+
+static void hi3593_rx_irq_enable(struct net_device *dev, bool enable)
+{
+	struct hi3593_priv *priv;
+
+	priv = avionics_device_priv(dev);
+	if (!priv) {
+		pr_err("avionics-hi3593: Failed to get private data\n");
 		return;
 	}
 
-	skb = skb_dequeue(&priv->skbq);
-	if (!skb) {
+	mutex_lock(&priv->rx_lock);
+
+	if (priv->rx_polled == !enable) {
+		mutex_unlock(&priv->rx_lock);
 		return;
 	}
 
-	wr_cmd[0] = HI3593_OPCODE_WR_TX_FIFO;
-	data = (avionics_data *)skb->data;
-	for (i = 0; i < skb->len/sizeof(data[0]); i++) {
-		status = spi_w8r8(priv->spi, rd_cmd);
-		if (status < 0) {
-			pr_err("avionics-hi3593: Failed to read status\n");
-			return;
+	/* the interrupt is only enabled while the receiver is open */
+	if (atomic_read(priv->rx_enabled)) {
+		if (enable) {
+			enable_irq(priv->irq);
+		} else {
+			disable_irq_nosync(priv->irq);
 		}
+	}
 
-		if (status & HI3593_FIFO_FULL) {
-			usleep_range(priv->rx_udelay_min, priv->rx_udelay_max);
+	priv->rx_polled = !enable;
+
+	mutex_unlock(&priv->rx_lock);
+}
+
+/* Free space in the transmit FIFO, as near as the status bits let us
+ * tell. */
+static int hi3593_tx_space(ssize_t status)
+{
+	if (status & HI3593_FIFO_EMPTY) {
+		return HI3593_FIFO_DEPTH;
+	} else if (!(status & HI3593_FIFO_HALF)) {
+		return HI3593_FIFO_DEPTH/2;
+	} else if (!(status & HI3593_FIFO_FULL)) {
+		return 1;
+	}
 
-			status = spi_w8r8(priv->spi, rd_cmd);
+	return 0;
+}
+
+static int hi3593_tx_skb(struct hi3593_priv *priv, struct sk_buff *skb)
+{
+	struct net_device_stats *stats = &priv->dev->stats;
+	avionics_data *data;
+	__u32 vbuffer;
+	__u8 word[HI3593_WORD_XFER];
+	unsigned long timeout;
+	ssize_t status;
+	int err, i, count, space, num_samples;
+
+	data = (avionics_data *)skb->data;
+	num_samples = skb->len/sizeof(data[0]);
+
+	for (i = 0; i < num_samples; ) {
+		/* the queue is stopped while we wait, so the backlog
+		 * builds up in the sending sockets, it's only dropped if
+		 * the FIFO stops draining altogether */
+		timeout = jiffies + msecs_to_jiffies(HI3593_TX_TIMEOUT_MSECS);
+		for (;;) {
+			status = spi_w8r8(priv->spi,
+					  HI3593_OPCODE_RD_TX_STATUS);
 			if (status < 0) {
-				pr_err("avionics-hi3593: Failed to read status\n");
-				return;
+				pr_err("avionics-hi3593: Failed to read"
+				       " status\n");
+				return status;
+			}
+
+			space = hi3593_tx_space(status);
+			if (space) {
+				break;
 			}
 
-			if (status & HI3593_FIFO_FULL) {
+			if (time_after(jiffies, timeout)
+			    || !netif_running(priv->dev)) {
 				pr_err("avionics-hi3593: TX fifo overflow\n");
 				stats->tx_dropped++;
-				consume_skb(skb);
-				return;
+				avionics_device_event(priv->dev,
+						      AVIONICS_EVENT_DROPPED);
+				return -ENOBUFS;
 			}
+
+			usleep_range(priv->rx_udelay_min,
+				     priv->rx_udelay_max);
 		}
 
-		vbuffer = cpu_to_be32(data[i].value);
-		wr_cmd[1] = (vbuffer&0x000000ff);
-		wr_cmd[2] = (vbuffer&0x0000ff00) >> 8;
-		wr_cmd[3] = (vbuffer&0x00ff0000) >> 16;
-		wr_cmd[4] = (vbuffer&0xff000000) >> 24;
-
-		if (data[i].time_msecs) {
-			ktime_get_real_ts64(&tv);
-			time_msecs = (tv.tv_sec*MSEC_PER_SEC) +
-				(tv.tv_nsec/NSEC_PER_MSEC);
-			if (time_msecs < data[i].time_msecs) {
-				offset_msecs = data[i].time_msecs - time_msecs;
-				if (offset_msecs > 360000) {
-					pr_err("avionics-hi3593-tx: Offset %llu"
-					       " too large, ignoring\n",
-					       offset_msecs) ;
-				} else if (offset_msecs > 2) {
-					usleep_range((offset_msecs*1000 - 500),
-						     (offset_msecs*1000 + 500));
-				}
-			}
+		/* words only get here once they're due, so batch up as
+		 * many as will fit */
+		avionics_spi_burst_reset(priv->tx_burst);
+		for (count = 0; (count < space) && (i < num_samples); count++) {
+			vbuffer = cpu_to_be32(data[i].value);
+			word[0] = HI3593_OPCODE_WR_TX_FIFO;
+			word[1] = (vbuffer&0x000000ff);
+			word[2] = (vbuffer&0x0000ff00) >> 8;
+			word[3] = (vbuffer&0x00ff0000) >> 16;
+			word[4] = (vbuffer&0xff000000) >> 24;
+			avionics_spi_burst_add(priv->tx_burst, word,
+					       sizeof(word));
+			i++;
 		}
 
-		err = spi_write(priv->spi, &wr_cmd, sizeof(wr_cmd));
+		err = avionics_spi_burst_sync(priv->tx_burst);
 		if (err < 0) {
 			pr_err("avionics-hi3593: Failed to load fifo\n");
-			return;
+			return err;
 		}
 	}
 
-	stats->tx_packets++;
-	stats->tx_bytes += skb->len;
+	avionics_device_tx_tstamp(skb, ktime_get_real());
+	avionics_device_tx_stats(priv->dev, 1, skb->len);
 
-	consume_skb(skb);
+	return 0;
+}
+
+static void hi3593_tx_worker(struct kthread_work *work)
+{
+	struct net_device *dev;
+	struct hi3593_priv *priv;
+	struct sk_buff *skb;
+	int err;
+
+	priv = container_of(work, struct hi3593_priv, worker);
+	dev = priv->dev;
+
+	priv = avionics_device_priv(dev);
+	if (!priv) {
+		pr_err("avionics-hi3593: Failed to get private data\n");
+		return;
+	}
+
+	if (priv->tx_index != 0) {
+		pr_err("avionics-hi3593: No valid port index\n");
+		return;
+	}
+
+	/* the work may already have been pending when more packets
+	 * were queued, so send everything that's waiting */
+	while ((skb = skb_dequeue(&priv->skbq))) {
+		err = hi3593_tx_skb(priv, skb);
+		if (err) {
+			if (err != -ENOBUFS) {
+				dev->stats.tx_errors++;
+			}
+			kfree_skb(skb);
+		} else {
+			consume_skb(skb);
+		}
+
+		if (netif_queue_stopped(dev) && netif_running(dev)
+		    && (skb_queue_len(&priv->skbq)
+			<= HI3593_TX_QUEUE_DEPTH/2)) {
+			avionics_device_tx_wake(dev);
+		}
+	}
+}
+
+/* Called by the transmit schedule once a packet's words are due. */
+static void hi3593_tx_release(struct sk_buff *skb, struct net_device *dev)
+{
+	struct hi3593_priv *priv;
+
+	priv = avionics_device_priv(dev);
+	if (!priv) {
+		pr_err("avionics-hi3593: Failed to get private data\n");
+		kfree_skb(skb);
+		dev->stats.tx_dropped++;
+		return;
+	}
+
+	skb_queue_tail(&priv->skbq, skb);
+	if (skb_queue_len(&priv->skbq) >= HI3593_TX_QUEUE_DEPTH) {
+		netif_stop_queue(dev);
+	}
+
+	kthread_queue_work(avionics_device_worker(dev), &priv->worker);
 }
 
 static netdev_tx_t hi3593_tx_start_xmit(struct sk_buff *skb,
@@ -873,8 +1179,7 @@ static netdev_tx_t hi3593_tx_start_xmit(struct sk_buff *skb,
 		return NETDEV_TX_OK;
 	}
 
-	skb_queue_tail(&priv->skbq, skb);
-	queue_delayed_work(priv->wq, &priv->worker, 0);
+	avionics_device_tx_schedule(priv->tx_schedule, skb);
 
 	return NETDEV_TX_OK;
 }
@@ -884,12 +1189,14 @@ static const struct net_device_ops hi3593_tx_netdev_ops = {
 	.ndo_open = hi3593_tx_open,
 	.ndo_stop = hi3593_tx_stop,
 	.ndo_start_xmit = hi3593_tx_start_xmit,
+	.ndo_get_stats64 = avionics_device_get_stats64,
 };
 
 static const struct net_device_ops hi3593_rx_netdev_ops = {
 	.ndo_change_mtu = hi3593_change_mtu,
 	.ndo_open = hi3593_rx_open,
 	.ndo_stop = hi3593_rx_stop,
+	.ndo_get_stats64 = avionics_device_get_stats64,
 };
 
 static const struct of_device_id hi3593_of_device_id[] = {
@@ -1057,13 +1364,7 @@ static int hi3593_create_netdevs(struct spi_device *spi)
 {
 	struct hi3593 *hi3593 = spi_get_drvdata(spi);
 	struct hi3593_priv *priv;
-	int i, err;
-
-	hi3593->wq = alloc_workqueue("hi3593", WQ_HIGHPRI, 0);
-	if (!hi3593->wq) {
-		pr_err("avionics-hi3593: Failed to allocate work-queue\n");
-		return -ENOMEM;
-	}
+	int i, j, err;
 
 	for (i = 0; i < HI3593_NUM_TX; i++) {
 		hi3593->tx[i] = avionics_device_alloc(sizeof(*priv),
@@ -1088,14 +1389,32 @@ static int hi3593_create_netdevs(struct spi_device *spi)
 		priv->lock = &hi3593->lock;
 		priv->tx_index = i;
 		priv->rx_index = -1;
+
+		priv->tx_burst = avionics_spi_burst_alloc(spi,
+				HI3593_FIFO_DEPTH,
+				HI3593_FIFO_DEPTH*HI3593_WORD_XFER);
+		if (!priv->tx_burst) {
+			pr_err("avionics-hi3593: Failed to allocate TX %d"
+			       " burst\n", i);
+			return -ENOMEM;
+		}
+
 		skb_queue_head_init(&priv->skbq);
-		priv->wq = hi3593->wq;
 		priv->rate = 12500;
 		priv->rx_udelay_min = HI3593_RX_DELAY_MULTIPLIER_MIN/priv->rate;
 		priv->rx_udelay_max = HI3593_RX_DELAY_MULTIPLIER_MAX/priv->rate;
-		priv->rx_wrk_delay = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
+		priv->rx_coalesce_usecs = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
+		priv->rx_word_nsecs = (NSEC_PER_SEC/priv->rate)*HI3593_WORD_BITS;
+
+		kthread_init_work(&priv->worker, hi3593_tx_worker);
 
-		INIT_DELAYED_WORK(&priv->worker, hi3593_tx_worker);
+		priv->tx_schedule = avionics_device_tx_schedule_alloc(
+				hi3593->tx[i], hi3593_tx_release);
+		if (!priv->tx_schedule) {
+			pr_err("avionics-hi3593: Failed to allocate TX %d"
+			       " schedule\n", i);
+			return -ENOMEM;
+		}
 
 		err = hi3593_set_arinc429tx(&avionics_arinc429tx_default,
 					    hi3593->tx[i]);
@@ -1138,18 +1457,38 @@ static int hi3593_create_netdevs(struct spi_device *spi)
 		priv->tx_index = -1;
 		priv->rx_index = i;
 		priv->rx_enabled = &hi3593->rx_enabled[i];
+		mutex_init(&priv->rx_lock);
+		if (i == 0) {
+			priv->rx_rd_cmd[0] = HI3593_OPCODE_RD_RX1_FIFO;
+			priv->rx_status_cmd[0] = HI3593_OPCODE_RD_RX1_STATUS;
+		} else {
+			priv->rx_rd_cmd[0] = HI3593_OPCODE_RD_RX2_FIFO;
+			priv->rx_status_cmd[0] = HI3593_OPCODE_RD_RX2_STATUS;
+		}
+
+		for (j = 0; j < ARRAY_SIZE(priv->rx_burst); j++) {
+			priv->rx_burst[j] = avionics_spi_burst_alloc(spi,
+					HI3593_FIFO_DEPTH + 1,
+					HI3593_FIFO_DEPTH*HI3593_WORD_XFER
+					+ HI3593_STATUS_XFER);
+			if (!priv->rx_burst[j]) {
+				pr_err("avionics-hi3593: Failed to allocate"
+				       " RX %d burst\n", i);
+				return -ENOMEM;
+			}
+		}
+
 		skb_queue_head_init(&priv->skbq);
-		priv->wq = hi3593->wq;
 		priv->rate = 12500;
 		priv->rx_udelay_min = HI3593_RX_DELAY_MULTIPLIER_MIN/priv->rate;
 		priv->rx_udelay_max = HI3593_RX_DELAY_MULTIPLIER_MAX/priv->rate;
-		priv->rx_wrk_delay = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
-
-		INIT_DELAYED_WORK(&priv->worker, hi3593_rx_worker);
+		priv->rx_coalesce_usecs = HI3593_RX_HALF_FILL_MULTIPLIER/priv->rate;
+		priv->rx_word_nsecs = (NSEC_PER_SEC/priv->rate)*HI3593_WORD_BITS;
 
-		err = request_irq(hi3593->irq[i], hi3593_rx_irq,
-				  IRQF_TRIGGER_RISING | IRQF_ONESHOT,
-				  hi3593->rx[i]->name, priv);
+		err = request_threaded_irq(hi3593->irq[i], hi3593_rx_irq_time,
+					   hi3593_rx_irq,
+					   IRQF_TRIGGER_RISING | IRQF_ONESHOT,
+					   hi3593->rx[i]->name, priv);
 		if (err) {
 			pr_err("avionics-hi3593: Failed to register"
 			       " RX %d irq %d\n", i, hi3593->irq[i]);
@@ -1157,6 +1496,7 @@ static int hi3593_create_netdevs(struct spi_device *spi)
 		}
 		priv->irq = hi3593->irq[i];
 		disable_irq_nosync(priv->irq);
+		avionics_device_set_irq(hi3593->rx[i], priv->irq);
 
 		err = hi3593_set_arinc429rx(&avionics_arinc429rx_default,
 					    hi3593->rx[i]);
@@ -1182,18 +1522,20 @@ static int hi3593_remove(struct spi_device *spi)
 {
 	struct hi3593 *hi3593 = spi_get_drvdata(spi);
 	struct hi3593_priv *priv;
-	int i;
+	int i, j;
 
 	pr_info("avionics-hi3593: Removing Device\n");
 
 	for (i = 0; i < HI3593_NUM_TX; i++) {
 		if (hi3593->tx[i]) {
+			avionics_device_unregister(hi3593->tx[i]);
 			priv = avionics_device_priv(hi3593->tx[i]);
 			if (priv) {
+				avionics_device_tx_schedule_free(priv->tx_schedule);
+				kthread_cancel_work_sync(&priv->worker);
 				skb_queue_purge(&priv->skbq);
-				cancel_delayed_work_sync(&priv->worker);
+				avionics_spi_burst_free(priv->tx_burst);
 			}
-			avionics_device_unregister(hi3593->tx[i]);
 			avionics_device_free(hi3593->tx[i]);
 			hi3593->tx[i] = NULL;
 		}
@@ -1206,11 +1548,15 @@ static int hi3593_remove(struct spi_device *spi)
 			if (priv) {
 				skb_queue_purge(&priv->skbq);
 				if (priv->irq) {
+					avionics_device_set_irq(hi3593->rx[i], 0);
 					free_irq(priv->irq, priv);
 				}
-				cancel_delayed_work_sync(&priv->worker);
 			}
 			avionics_device_unregister(hi3593->rx[i]);
+			for (j = 0; priv && (j < ARRAY_SIZE(priv->rx_burst));
+			     j++) {
+				avionics_spi_burst_free(priv->rx_burst[j]);
+			}
 			avionics_device_free(hi3593->rx[i]);
 			hi3593->rx[i] = 0;
 		}
@@ -1222,12 +1568,6 @@ static int hi3593_remove(struct spi_device *spi)
 		hi3593->reset_gpio = 0;
 	}
 
-	if (hi3593->wq) {
-		flush_scheduled_work();
-		flush_workqueue(hi3593->wq);
-		destroy_workqueue(hi3593->wq);
-	}
-
 	return 0;
 }
 
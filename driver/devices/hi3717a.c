@@ -26,9 +26,14 @@
 #include <linux/of_irq.h>
 #include <linux/atomic.h>
 #include <linux/interrupt.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/kref.h>
+#include <linux/kthread.h>
 
 #include "avionics.h"
 #include "avionics-device.h"
+#include "avionics-spi.h"
 
 MODULE_DESCRIPTION("HOLT Hi-3717A ARINC-717 Driver");
 MODULE_LICENSE("GPL v2");
@@ -39,6 +44,17 @@ MODULE_VERSION("1.1.0");
 #define HI3717A_SAMPLE_SIZE	(sizeof(avionics_data))
 #define HI3717A_MTU		(HI3717A_FIFO_DEPTH * HI3717A_SAMPLE_SIZE * 8)
 
+/* receive bursts leave enough room in the FIFO for the words that
+ * arrive in the time it can take the thread to wake up, the default
+ * latency gives the old 16 word bursts at the slowest rate */
+#define HI3717A_RX_WAKEUP_USECS		1000
+#define HI3717A_RX_LATENCY_USECS	250000
+
+/* at the fastest rate, 98304 bps, a subframe is 8192 words and there
+ * are always four subframes in a superframe */
+#define HI3717A_SUBFRAME_WORDS		8192
+#define HI3717A_SUPERFRAME_SUBFRAMES	4
+
 #define HI3717A_OPCODE_RD_CTRL0		0xe4
 #define HI3717A_OPCODE_WR_CTRL0		0x64
 
@@ -65,6 +81,7 @@ MODULE_VERSION("1.1.0");
 #define HI3717A_RXFIFO_OVF	0x02
 
 #define HI3717A_TXFIFO_EMPTY	0x20
+#define HI3717A_TXFIFO_HALF	0x40
 #define HI3717A_TXFIFO_FULL	0x80
 
 #define HI3717A_NUM_TX	1
@@ -73,7 +90,6 @@ MODULE_VERSION("1.1.0");
 struct hi3717a {
 	struct net_device *rx[HI3717A_NUM_RX];
 	struct net_device *tx[HI3717A_NUM_TX];
-	struct workqueue_struct *wq;
 	int reset_gpio;
 	int irq;
 	struct mutex lock;
@@ -82,20 +98,36 @@ struct hi3717a {
 	int period_usec;
 };
 
+/* Received words waiting for the rest of their subframe, or superframe,
+ * when the receiver is sending whole frames. */
+struct hi3717a_frame {
+	int superframe;
+	int synced;
+	unsigned int size;
+	unsigned int count;
+	__u32 last;
+	avionics_data words[2*HI3717A_FIFO_DEPTH];
+	avionics_data data[];
+};
+
 struct hi3717a_priv {
 	struct net_device *dev;
 	struct spi_device *spi;
 	struct mutex *lock;
-	struct workqueue_struct *wq;
-	struct delayed_work worker;
+	struct kthread_work worker;
 	int irq;
 	int reset_gpio;
-	__u16 *tx_buffer;
-	int tx_buffer_size;
+	struct hi3717a_tx_frame *tx_frame;
 	atomic_t *tx_enabled;
 	atomic_t *rx_enabled;
 	int *period_usec;
-	struct spi_transfer opcodes[HI3717A_FIFO_DEPTH];
+	ktime_t rx_irq_time;
+	struct hi3717a_frame *rx_frame;
+	struct avionics_tx_schedule *tx_schedule;
+	unsigned int rx_latency_usecs;
+	unsigned int rx_words;
+	bool rx_insync;
+	struct avionics_spi_burst *spi_burst;
 };
 
 static ssize_t hi3717a_get_cntrl(struct hi3717a_priv *priv, __u8 opcode)
@@ -329,12 +361,45 @@ static void hi3717a_get_arinc717rx(struct avionics_arinc717rx *config,
 
 	config->flags = (ctrl0&0x01)|(ctrl1&0x06);
 
+	mutex_lock(priv->lock);
+	if (priv->rx_frame) {
+		config->flags |= priv->rx_frame->superframe ?
+			AVIONICS_ARINC717RX_SUPERFRAME :
+			AVIONICS_ARINC717RX_SUBFRAME;
+	}
+	mutex_unlock(priv->lock);
+}
+
+static struct hi3717a_frame *hi3717a_rx_frame_alloc(__u8 flags)
+{
+	struct hi3717a_frame *frame;
+	unsigned int size;
+
+	if (flags & AVIONICS_ARINC717RX_SUPERFRAME) {
+		size = HI3717A_SUBFRAME_WORDS * HI3717A_SUPERFRAME_SUBFRAMES;
+	} else if (flags & AVIONICS_ARINC717RX_SUBFRAME) {
+		size = HI3717A_SUBFRAME_WORDS;
+	} else {
+		return NULL;
+	}
+
+	frame = vzalloc(sizeof(*frame) + size * sizeof(frame->data[0]));
+	if (!frame) {
+		pr_err("avionics-hi3717a: Failed to allocate frame buffer\n");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	frame->superframe = !!(flags & AVIONICS_ARINC717RX_SUPERFRAME);
+	frame->size = size;
+
+	return frame;
 }
 
 static int hi3717a_set_arinc717rx(struct avionics_arinc717rx *config,
 				 const struct net_device *dev)
 {
 	struct hi3717a_priv *priv;
+	struct hi3717a_frame *frame, *old;
 	int err;
 
 	priv = avionics_device_priv(dev);
@@ -343,6 +408,20 @@ static int hi3717a_set_arinc717rx(struct avionics_arinc717rx *config,
 		return -ENODEV;
 	}
 
+	/* frames are assembled by the receive thread under the lock, a new
+	 * mode always starts over at the next frame boundary */
+	frame = hi3717a_rx_frame_alloc(config->flags);
+	if (IS_ERR(frame)) {
+		return PTR_ERR(frame);
+	}
+
+	mutex_lock(priv->lock);
+	old = priv->rx_frame;
+	priv->rx_frame = frame;
+	mutex_unlock(priv->lock);
+
+	vfree(old);
+
 	err = hi3717a_set_cntrl(priv, config->flags, 0x01,
 			      HI3717A_OPCODE_WR_CTRL0, HI3717A_OPCODE_RD_CTRL0);
 	if (err < 0) {
@@ -415,20 +494,86 @@ static int hi3717a_set_arinc717tx(struct avionics_arinc717tx *config,
 	return 0;
 }
 
+static unsigned int hi3717a_rx_burst(struct hi3717a_priv *priv)
+{
+	unsigned int period_usec = *priv->period_usec;
+	unsigned int words, headroom;
+
+	headroom = DIV_ROUND_UP(HI3717A_RX_WAKEUP_USECS, period_usec);
+	if (headroom > (HI3717A_FIFO_DEPTH - 2)) {
+		headroom = HI3717A_FIFO_DEPTH - 2;
+	}
+
+	words = READ_ONCE(priv->rx_words);
+	if (!words) {
+		words = READ_ONCE(priv->rx_latency_usecs) / period_usec;
+	}
+
+	return clamp_t(unsigned int, words, 1,
+		       HI3717A_FIFO_DEPTH - 1 - headroom);
+}
+
+static void hi3717a_get_rx_burst(struct avionics_rx_burst *config,
+				 const struct net_device *dev)
+{
+	struct hi3717a_priv *priv;
+
+	priv = avionics_device_priv(dev);
+	if (!priv) {
+		pr_err("avionics-hi3717a: Failed to get private data\n");
+		return;
+	}
+
+	config->latency_usecs = READ_ONCE(priv->rx_latency_usecs);
+	config->words = READ_ONCE(priv->rx_words);
+	config->burst = hi3717a_rx_burst(priv);
+}
+
+static int hi3717a_set_rx_burst(struct avionics_rx_burst *config,
+				const struct net_device *dev)
+{
+	struct hi3717a_priv *priv;
+
+	priv = avionics_device_priv(dev);
+	if (!priv) {
+		pr_err("avionics-hi3717a: Failed to get private data\n");
+		return -ENODEV;
+	}
+
+	if (config->words > HI3717A_FIFO_DEPTH) {
+		pr_err("avionics-hi3717a: Burst must be no more than %d"
+		       " words\n", HI3717A_FIFO_DEPTH);
+		return -EINVAL;
+	}
+
+	/* picked up by the receive thread on its next interrupt */
+	WRITE_ONCE(priv->rx_latency_usecs, config->latency_usecs ?
+		   config->latency_usecs : HI3717A_RX_LATENCY_USECS);
+	WRITE_ONCE(priv->rx_words, config->words);
+
+	return 0;
+}
+
+static int hi3717a_tx_mmap(struct net_device *dev, struct vm_area_struct *vma);
+
 static struct avionics_ops hi3717a_arinc717rx_ops = {
 	.name = "arinc717rx%d",
 	.set_rate = hi3717a_set_rate,
 	.get_rate = hi3717a_get_rate,
 	.get_arinc717rx = hi3717a_get_arinc717rx,
 	.set_arinc717rx = hi3717a_set_arinc717rx,
+	.get_rx_burst = hi3717a_get_rx_burst,
+	.set_rx_burst = hi3717a_set_rx_burst,
 };
 
 static struct avionics_ops hi3717a_arinc717tx_ops = {
 	.name = "arinc717tx%d",
+	.flags = AVIONICS_OPS_WORKER,
 	.set_rate = hi3717a_set_rate,
 	.get_rate = hi3717a_get_rate,
 	.get_arinc717tx = hi3717a_get_arinc717tx,
 	.set_arinc717tx = hi3717a_set_arinc717tx,
+	.tx_mmap = hi3717a_tx_mmap,
 };
 
 static int hi3717a_change_mtu(struct net_device *dev, int mtu)
@@ -441,18 +586,171 @@ static int hi3717a_change_mtu(struct net_device *dev, int mtu)
 	return 0;
 }
 
-static void hi3717a_tx_worker(struct work_struct *work)
+static const __u16 hi3717a_sync[HI3717A_SUPERFRAME_SUBFRAMES] = {
+	01107, 02670, 05107, 06670
+};
+
+/* The transmit frame buffer is shared with user space through mmap, it
+ * lives until the transmitter is stopped and the last mapping is gone. */
+struct hi3717a_tx_frame {
+	struct kref ref;
+	struct avionics_tx_frame_header *header;
+	__u16 *buffers[2];
+	size_t size;
+	int words;
+	int active;
+};
+
+static void hi3717a_tx_frame_release(struct kref *ref)
+{
+	struct hi3717a_tx_frame *frame;
+
+	frame = container_of(ref, struct hi3717a_tx_frame, ref);
+
+	vfree(frame->header);
+	kfree(frame);
+}
+
+static void hi3717a_tx_frame_put(struct hi3717a_tx_frame *frame)
+{
+	if (!frame) {
+		return;
+	}
+
+	kref_put(&frame->ref, hi3717a_tx_frame_release);
+}
+
+static struct hi3717a_tx_frame *hi3717a_tx_frame_alloc(int words)
+{
+	struct hi3717a_tx_frame *frame;
+	size_t offset;
+	int i;
+
+	frame = kzalloc(sizeof(*frame), GFP_KERNEL);
+	if (!frame) {
+		pr_err("avionics-hi3717a: Failed to allocate tx frame\n");
+		return NULL;
+	}
+
+	offset = PAGE_ALIGN(sizeof(*frame->header));
+	frame->size = offset + PAGE_ALIGN(2 * words * sizeof(__u16));
+
+	frame->header = vmalloc_user(frame->size);
+	if (!frame->header) {
+		pr_err("avionics-hi3717a: Failed to allocate tx buffer\n");
+		kfree(frame);
+		return NULL;
+	}
+
+	kref_init(&frame->ref);
+	frame->words = words;
+	frame->buffers[0] = (void *)frame->header + offset;
+	frame->buffers[1] = frame->buffers[0] + words;
+
+	frame->header->words = words;
+	frame->header->offset = offset;
+
+	/* Set frame markers, the worker sends these whatever is in the
+	 * buffers so user space can't break the sync */
+	for (i = 0; i < HI3717A_SUPERFRAME_SUBFRAMES; i++) {
+		frame->buffers[0][i * words / HI3717A_SUPERFRAME_SUBFRAMES] =
+			hi3717a_sync[i];
+		frame->buffers[1][i * words / HI3717A_SUPERFRAME_SUBFRAMES] =
+			hi3717a_sync[i];
+	}
+
+	return frame;
+}
+
+/* User space asks for the other buffer by setting pending, it's only
+ * switched to at the start of a subframe. */
+static int hi3717a_tx_frame_flip(struct hi3717a_tx_frame *frame)
+{
+	__u32 pending;
+
+	pending = smp_load_acquire(&frame->header->pending);
+	if ((pending > 1) || (pending == frame->active)) {
+		return frame->active;
+	}
+
+	WRITE_ONCE(frame->active, pending);
+	WRITE_ONCE(frame->header->flips, frame->header->flips + 1);
+	smp_store_release(&frame->header->active, pending);
+
+	return pending;
+}
+
+static void hi3717a_tx_frame_vm_open(struct vm_area_struct *vma)
+{
+	struct hi3717a_tx_frame *frame = vma->vm_private_data;
+
+	kref_get(&frame->ref);
+}
+
+static void hi3717a_tx_frame_vm_close(struct vm_area_struct *vma)
+{
+	hi3717a_tx_frame_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct hi3717a_tx_frame_vm_ops = {
+	.open = hi3717a_tx_frame_vm_open,
+	.close = hi3717a_tx_frame_vm_close,
+};
+
+static int hi3717a_tx_mmap(struct net_device *dev, struct vm_area_struct *vma)
+{
+	struct hi3717a_priv *priv;
+	struct hi3717a_tx_frame *frame;
+	int err;
+
+	priv = avionics_device_priv(dev);
+	if (!priv) {
+		pr_err("avionics-hi3717a: Failed to get private data\n");
+		return -EINVAL;
+	}
+
+	mutex_lock(priv->lock);
+
+	frame = priv->tx_frame;
+	if (!frame) {
+		pr_err("avionics-hi3717a: Transmitter isn't running\n");
+		mutex_unlock(priv->lock);
+		return -ENODEV;
+	}
+
+	if ((vma->vm_end - vma->vm_start) != frame->size) {
+		pr_err("avionics-hi3717a: Mapping must be %zu bytes not %lu\n",
+		       frame->size, vma->vm_end - vma->vm_start);
+		mutex_unlock(priv->lock);
+		return -EINVAL;
+	}
+
+	err = remap_vmalloc_range(vma, frame->header, 0);
+	if (!err) {
+		kref_get(&frame->ref);
+		vma->vm_private_data = frame;
+		vma->vm_ops = &hi3717a_tx_frame_vm_ops;
+	}
+
+	mutex_unlock(priv->lock);
+
+	return err;
+}
+
+static void hi3717a_tx_worker(struct kthread_work *work)
 {
 	struct net_device *dev;
 	struct net_device_stats *stats;
 	struct hi3717a_priv *priv;
+	struct hi3717a_tx_frame *frame;
 	__u8 wr_cmd[3];
 	ssize_t status;
-	int err, i, delay, frame_size;
-	__u16 *tx_buffer, vbuffer;
+	int err, i, n, burst, delay, subframe_words, active;
+	__u16 word, vbuffer;
+	unsigned int tx_packets = 0, tx_bytes = 0;
+	bool started = false;
 
-	priv = container_of((struct delayed_work*)work,
-			    struct hi3717a_priv, worker);
+	priv = container_of(work, struct hi3717a_priv, worker);
 	dev = priv->dev;
 	stats = &dev->stats;
 
@@ -462,49 +760,77 @@ static void hi3717a_tx_worker(struct work_struct *work)
 		return;
 	}
 
-	tx_buffer = priv->tx_buffer;
+	frame = priv->tx_frame;
+	subframe_words = frame->words / HI3717A_SUPERFRAME_SUBFRAMES;
+	active = frame->active;
 
-	frame_size = priv->tx_buffer_size/4;
-	delay = (*priv->period_usec)*8;
-	wr_cmd[0] = HI3717A_OPCODE_WR_TXFIFO;
+	/* wake up about when half of the FIFO has gone out */
+	delay = (*priv->period_usec)*(HI3717A_FIFO_DEPTH/2);
 	i = 0;
 
-	/* Set frame markers */
-	tx_buffer[frame_size*0] = 01107;
-	tx_buffer[frame_size*1] = 02670;
-	tx_buffer[frame_size*2] = 05107;
-	tx_buffer[frame_size*3] = 06670;
-
 	while (atomic_read(priv->tx_enabled)) {
 
+		/* one status read tells us how much room there is, which
+		 * is then filled with a single chained message */
 		while(1) {
 			mutex_lock(priv->lock);
+
 			status = hi3717a_get_cntrl(priv,
 						   HI3717A_OPCODE_RD_TXFSTAT);
-			mutex_unlock(priv->lock);
-
 			if (status < 0) {
+				mutex_unlock(priv->lock);
 				pr_err("avionics-hi3717a:"
 				       " Failed to read status\n");
 				goto done;
 			}
 
 			if (status & HI3717A_TXFIFO_EMPTY) {
-				pr_warn("avionics-hi3717a: TX FIFO Empty\n");
-				stats->tx_errors++;
-				stats->tx_fifo_errors++;
+				if (started) {
+					pr_warn("avionics-hi3717a:"
+						" TX FIFO Empty\n");
+					stats->tx_errors++;
+					stats->tx_fifo_errors++;
+					avionics_device_event(dev,
+						AVIONICS_EVENT_TX_UNDERRUN);
+				}
+				burst = HI3717A_FIFO_DEPTH;
+			} else if (!(status & (HI3717A_TXFIFO_HALF
+					       | HI3717A_TXFIFO_FULL))) {
+				burst = HI3717A_FIFO_DEPTH/2;
+			} else {
+				mutex_unlock(priv->lock);
+				break;
 			}
 
-			if (status & HI3717A_TXFIFO_FULL) {
-				break;
+			avionics_spi_burst_reset(priv->spi_burst);
+
+			for (n = 0; n < burst; n++) {
+				/* subframes always start with their sync
+				 * word, and are the only place the buffers
+				 * can be switched */
+				if (!(i % subframe_words)) {
+					active = hi3717a_tx_frame_flip(frame);
+					word = hi3717a_sync[i / subframe_words];
+				} else {
+					word = READ_ONCE(
+						frame->buffers[active][i]);
+				}
+
+				vbuffer = cpu_to_be16(word & 0x0fff);
+				wr_cmd[0] = HI3717A_OPCODE_WR_TXFIFO;
+				wr_cmd[1] = (vbuffer&0x00ff);
+				wr_cmd[2] = (vbuffer&0xff00)>>8;
+				avionics_spi_burst_add(priv->spi_burst, wr_cmd,
+						       sizeof(wr_cmd));
+
+				if (++i == frame->words) {
+					i = 0;
+					tx_packets++;
+				}
 			}
 
-			vbuffer = cpu_to_be16(tx_buffer[i]);
-			wr_cmd[1] = (vbuffer&0x00ff);
-			wr_cmd[2] = (vbuffer&0xff00)>>8;
+			err = avionics_spi_burst_sync(priv->spi_burst);
 
-			mutex_lock(priv->lock);
-			err = spi_write(priv->spi, &wr_cmd, sizeof(wr_cmd));
 			mutex_unlock(priv->lock);
 
 			if (err < 0) {
@@ -513,27 +839,72 @@ static void hi3717a_tx_worker(struct work_struct *work)
 				goto done;
 			}
 
-			stats->tx_bytes += 2;
-			if (i < (priv->tx_buffer_size-1)) {
-				i++;
-			} else {
-				i = 0;
-				stats->tx_packets++;
-			}
+			started = true;
+			tx_bytes += burst*sizeof(__u16);
 		}
 
+		avionics_device_tx_stats(dev, tx_packets, tx_bytes);
+		tx_packets = 0;
+		tx_bytes = 0;
+
 		usleep_range(delay, delay+100);
 	}
 
 done:
-	kfree(tx_buffer);
+	avionics_device_tx_stats(dev, tx_packets, tx_bytes);
+}
+
+/* Called by the transmit schedule once a packet's words are due, the
+ * words are written into both frame buffers so they aren't undone the
+ * next time user space switches buffers. */
+static void hi3717a_tx_release(struct sk_buff *skb, struct net_device *dev)
+{
+	struct hi3717a_priv *priv;
+	struct hi3717a_tx_frame *frame;
+	avionics_data data;
+	__u16 subframe, word_count, word;
+	int offset, i;
+
+	priv = avionics_device_priv(dev);
+	if (!priv || !priv->tx_frame) {
+		kfree_skb(skb);
+		dev->stats.tx_dropped++;
+		return;
+	}
+
+	frame = priv->tx_frame;
+
+	/* word format:
+	 * 0000yyyy yyyyyyyy xxxxxxxx xxxxx0zz
+	 * where y is the word to write (12 bits)
+	 * where x is the word count starting at 1
+	 * and z if the frame starting at 0*/
+
+	for (i = 0; i < skb->len; i = i + sizeof(data)) {
+		memcpy(&data, &skb->data[i], sizeof(data));
+
+		word = (data.value&0x0fff0000)>>16;
+		word_count = (data.value&0x0000fff8)>>3;
+		subframe = data.value&0x00000003;
 
+		offset = (subframe * frame->words/4) + (word_count-1);
+
+		if ((word_count > 1) && (offset < frame->words)) {
+			WRITE_ONCE(frame->buffers[0][offset], word);
+			WRITE_ONCE(frame->buffers[1][offset], word);
+		}
+	}
+
+	/* the words are sent from the buffer from now on */
+	avionics_device_tx_tstamp(skb, ktime_get_real());
+	consume_skb(skb);
 }
 
 static int hi3717a_tx_open(struct net_device *dev)
 {
 	struct hi3717a_priv *priv;
-	struct avionics_rate rate;
+	struct hi3717a_tx_frame *frame;
+	struct avionics_rate rate = {0};
 
 	priv = avionics_device_priv(dev);
 	if (!priv) {
@@ -547,21 +918,34 @@ static int hi3717a_tx_open(struct net_device *dev)
 	}
 
 	hi3717a_get_rate(&rate, dev);
-	priv->tx_buffer_size = (rate.rate_hz/12)*4;
+	if (rate.rate_hz < 12) {
+		pr_err("avionics-hi3717a: Failed to get rate\n");
+		return -EINVAL;
+	}
 
-	priv->tx_buffer = kzalloc(priv->tx_buffer_size*sizeof(__u16),
-				     GFP_KERNEL);
-	if (!priv->tx_buffer) {
-		pr_err("avionics-hi3717a: Failed to allocate tx buffer\n");
+	frame = hi3717a_tx_frame_alloc((rate.rate_hz/12)*4);
+	if (!frame) {
 		return -ENOMEM;
 	}
 
+	priv->tx_schedule = avionics_device_tx_schedule_alloc(dev,
+							hi3717a_tx_release);
+	if (!priv->tx_schedule) {
+		pr_err("avionics-hi3717a: Failed to allocate tx schedule\n");
+		hi3717a_tx_frame_put(frame);
+		return -ENOMEM;
+	}
+
+	mutex_lock(priv->lock);
+	priv->tx_frame = frame;
+	mutex_unlock(priv->lock);
+
 	atomic_set(priv->tx_enabled, 1);
 
 	pr_warn("avionics-hi3717a: Enabling Driver\n");
-	netif_wake_queue(dev);
+	avionics_device_tx_wake(dev);
 
-	queue_delayed_work(priv->wq, &priv->worker, 0);
+	kthread_queue_work(avionics_device_worker(dev), &priv->worker);
 
 	return 0;
 }
@@ -569,6 +953,7 @@ static int hi3717a_tx_open(struct net_device *dev)
 static int hi3717a_tx_stop(struct net_device *dev)
 {
 	struct hi3717a_priv *priv;
+	struct hi3717a_tx_frame *frame;
 
 	pr_warn("avionics-hi3717a: Disabling Driver\n");
 
@@ -580,9 +965,21 @@ static int hi3717a_tx_stop(struct net_device *dev)
 		return -EINVAL;
 	}
 
+	/* nothing can be released into the frame buffer once the
+	 * schedule is gone */
+	avionics_device_tx_schedule_free(priv->tx_schedule);
+	priv->tx_schedule = NULL;
+
 	atomic_set(priv->tx_enabled, 0);
-	priv->tx_buffer_size = 0;
-	priv->tx_buffer = NULL;
+	kthread_cancel_work_sync(&priv->worker);
+
+	/* the buffer itself stays around for as long as it's mapped */
+	mutex_lock(priv->lock);
+	frame = priv->tx_frame;
+	priv->tx_frame = NULL;
+	mutex_unlock(priv->lock);
+
+	hi3717a_tx_frame_put(frame);
 
 	return 0;
 }
@@ -602,6 +999,7 @@ static int hi3717a_rx_open(struct net_device *dev)
 		return 0;
 	}
 
+	priv->rx_insync = false;
 	atomic_set(priv->rx_enabled, 1);
 	enable_irq(priv->irq);
 
@@ -649,6 +1047,14 @@ static int hi3717a_rxfifo_is_empty(struct hi3717a_priv *priv)
 		stats->rx_fifo_errors++;
 	}
 
+	/* only report the edges, the status is read on every interrupt */
+	if (!(status & HI3717A_RXFIFO_INSYNC) != !priv->rx_insync) {
+		priv->rx_insync = !!(status & HI3717A_RXFIFO_INSYNC);
+		avionics_device_event(dev, priv->rx_insync ?
+				      AVIONICS_EVENT_SYNC_ACQUIRED :
+				      AVIONICS_EVENT_SYNC_LOST);
+	}
+
 	if (status & HI3717A_RXFIFO_EMPTY) {
 		return HI3717A_RXFIFO_EMPTY;
 	}
@@ -657,6 +1063,7 @@ static int hi3717a_rxfifo_is_empty(struct hi3717a_priv *priv)
 		pr_err("avionics-hi3717a: RX FIFO Overflow\n");
 		stats->rx_errors++;
 		stats->rx_fifo_errors++;
+		avionics_device_event(dev, AVIONICS_EVENT_RX_OVERFLOW);
 		return HI3717A_RXFIFO_OVF;
 	}
 
@@ -664,157 +1071,272 @@ static int hi3717a_rxfifo_is_empty(struct hi3717a_priv *priv)
 }
 
 
+/* ARINC-717 is a continuous bit stream so each word arrives exactly a
+ * word time after the one before it, words are timed forward from the
+ * arrival of the first one. None of them can have arrived after the
+ * clock is read at the end of the read though. */
+static void hi3717a_rx_stamp(struct hi3717a_priv *priv, avionics_data *data,
+			     unsigned count, ktime_t first, ktime_t last)
+{
+	s64 word_nsecs = (*priv->period_usec)*NSEC_PER_USEC;
+	ktime_t time;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		time = ktime_add_ns(first, i*word_nsecs);
+		if (ktime_after(time, last)) {
+			time = last;
+		}
+		data[i].time_nsecs = ktime_to_ns(time);
+		data[i].flags = 0;
+	}
+}
+
 static int hi3717a_rxfifo_read(struct hi3717a_priv *priv,
-		avionics_data *values, unsigned num_reads)
+		avionics_data *values, unsigned num_reads, ktime_t first)
 {
 	int i, status;
-	struct spi_message message;
-	struct spi_transfer *opcodes = priv->opcodes;
-	__u8 rd_cmd[5], buffer[HI3717A_FIFO_DEPTH*5];
+	const __u8 rd_cmd[5] = {HI3717A_OPCODE_RD_RXFIFO};
+	__u8 *buffer;
 	__u32 vbuffer;
-	__u64 time_msecs;
-	struct timespec64 tv;
 
-	spi_message_init(&message);
-	memset(opcodes, 0, sizeof(*opcodes));
-
-	rd_cmd[0] = HI3717A_OPCODE_RD_RXFIFO;
+	avionics_spi_burst_reset(priv->spi_burst);
 
 	for(i = 0; i < num_reads; i++) {
-		opcodes[i].len = 5;
-		opcodes[i].tx_buf = rd_cmd;
-		opcodes[i].rx_buf = &buffer[i*5];
-		if(i < (num_reads-1)) {
-			opcodes[i].cs_change = 1;
-		}
-		spi_message_add_tail(&opcodes[i], &message);
+		avionics_spi_burst_add(priv->spi_burst, rd_cmd, sizeof(rd_cmd));
 	}
 
-	ktime_get_real_ts64(&tv);
-	time_msecs = (tv.tv_sec*MSEC_PER_SEC) + (tv.tv_nsec/NSEC_PER_MSEC);
-	status = spi_sync(priv->spi, &message);
+	status = avionics_spi_burst_sync(priv->spi_burst);
+	if (status < 0) {
+		return status;
+	}
+
+	/* transfers are added in order, if the last one's there so are
+	 * the others */
+	if (num_reads && !avionics_spi_burst_rx(priv->spi_burst,
+						num_reads - 1)) {
+		return -ENOSPC;
+	}
 
 	for(i = 0; i < num_reads; i++) {
-		vbuffer = buffer[i*5+1] + (buffer[i*5+2]<<8) +
-			(buffer[i*5+3]<<16) + (buffer[i*5+4]<<24);
+		buffer = avionics_spi_burst_rx(priv->spi_burst, i);
+		vbuffer = buffer[1] + (buffer[2]<<8) +
+			(buffer[3]<<16) + (buffer[4]<<24);
 		values[i].value = be32_to_cpu(vbuffer);
-		values[i].time_msecs = time_msecs;
 	}
 
-	if(status < 0) {
-		return status;
-	} else {
-		return num_reads;
-	}
+	hi3717a_rx_stamp(priv, values, num_reads, first, ktime_get_real());
+
+	return num_reads;
 }
 
+/* The chip doesn't report how many words are in its FIFO so each read
+ * is paired with a status read that says whether the word is valid.
+ * The caller estimates how many words are waiting from the time since
+ * the first one arrived, which normally empties the FIFO in a single
+ * message, anything that arrives while it's being read is picked up
+ * with another one. */
 static int hi3717a_rxfifo_read_all(struct hi3717a_priv *priv,
-				   avionics_data *data)
+				   avionics_data *data, int expected,
+				   ktime_t first)
 {
-	int count = 0, status;
-	struct spi_message message;
-	struct spi_transfer opcodes[3];
-	__u8 rd_cmd[5], rd_buffer[5], stats_cmd[2], stats_buffer[2][2];
+	int count = 0, status, i, num_reads;
+	const __u8 rd_cmd[5] = {HI3717A_OPCODE_RD_RXFIFO};
+	const __u8 stats_cmd[2] = {HI3717A_OPCODE_RD_RXFSTAT};
+	__u8 *rd_buffer;
 	__u32 vbuffer;
-	__u64 time_msecs;
-	struct timespec64 tv;
-
-	spi_message_init(&message);
-	memset(opcodes, 0, sizeof(opcodes));
-
-	stats_cmd[0] = HI3717A_OPCODE_RD_RXFSTAT;
-	rd_cmd[0] = HI3717A_OPCODE_RD_RXFIFO;
-
-	opcodes[0].len = 2;
-	opcodes[0].tx_buf = stats_cmd;
-	opcodes[0].rx_buf = stats_buffer[0];
-	opcodes[0].cs_change = 1;
-	spi_message_add_tail(&opcodes[0], &message);
-
-	opcodes[1].len = 5;
-	opcodes[1].tx_buf = rd_cmd;
-	opcodes[1].rx_buf = rd_buffer;
-	opcodes[1].cs_change = 1;
-	spi_message_add_tail(&opcodes[1], &message);
-
-	opcodes[2].len = 2;
-	opcodes[2].tx_buf = stats_cmd;
-	opcodes[2].rx_buf = stats_buffer[1];
-	spi_message_add_tail(&opcodes[2], &message);
-
-	ktime_get_real_ts64(&tv);
-	time_msecs = (tv.tv_sec*MSEC_PER_SEC) + (tv.tv_nsec/NSEC_PER_MSEC);
+
 	while(count < HI3717A_FIFO_DEPTH) {
 
-		status = spi_sync(priv->spi, &message);
+		num_reads = clamp_t(int, expected, 1,
+				    HI3717A_FIFO_DEPTH - count);
+
+		avionics_spi_burst_reset(priv->spi_burst);
+
+		for (i = 0; i < num_reads; i++) {
+			avionics_spi_burst_add(priv->spi_burst, stats_cmd,
+					       sizeof(stats_cmd));
+			avionics_spi_burst_add(priv->spi_burst, rd_cmd,
+					       sizeof(rd_cmd));
+		}
+
+		avionics_spi_burst_add(priv->spi_burst, stats_cmd,
+				       sizeof(stats_cmd));
+
+		status = avionics_spi_burst_sync(priv->spi_burst);
 		if(status < 0) {
 			return status;
 		}
 
-		if(!(stats_buffer[0][1] & HI3717A_RXFIFO_EMPTY)) {
+		/* the final status read is the last transfer, if it's there
+		 * so are the others */
+		if (!avionics_spi_burst_rx(priv->spi_burst, 2*num_reads)) {
+			return -ENOSPC;
+		}
+
+		for (i = 0; i < num_reads; i++) {
+			if(avionics_spi_burst_rx(priv->spi_burst, 2*i)[1]
+			   & HI3717A_RXFIFO_EMPTY) {
+				continue;
+			}
+
+			rd_buffer = avionics_spi_burst_rx(priv->spi_burst,
+							  2*i + 1);
 			vbuffer = rd_buffer[1] + (rd_buffer[2]<<8) +
 				(rd_buffer[3]<<16) + (rd_buffer[4]<<24);
 			data[count].value = be32_to_cpu(vbuffer);
-			data[count].time_msecs = time_msecs;
 			count++;
 		}
 
-		if(stats_buffer[1][1] & HI3717A_RXFIFO_EMPTY) {
+		if(avionics_spi_burst_rx(priv->spi_burst, 2*num_reads)[1]
+		   & HI3717A_RXFIFO_EMPTY) {
 			break;
 		}
 
+		expected = 1;
 	}
 
+	hi3717a_rx_stamp(priv, data, count, first, ktime_get_real());
+
 	return count;
 }
 
-static int hi3717a_rx_send_upstream(struct hi3717a_priv *priv,
-				    avionics_data *data, int count)
+static void hi3717a_rx_send_upstream(struct hi3717a_priv *priv,
+				     struct sk_buff *skb, int count,
+				     ktime_t begin)
 {
-	struct sk_buff *skb;
 	struct net_device *dev;
-	struct net_device_stats *stats;
 
 	dev = priv->dev;
-	stats = &dev->stats;
 
-	skb = avionics_device_alloc_skb(dev, count*sizeof(data[0]));
-	if (unlikely(!skb)) {
-		pr_err("avionics-hi3717a: Failed to allocate RX buffer\n");
-		return -ENOMEM;
+	skb_trim(skb, count*sizeof(avionics_data));
+
+	avionics_device_rx_stats(dev, skb->len);
+	avionics_device_latency(dev, AVIONICS_LATENCY_THREAD_RX,
+				begin, ktime_get_real());
+
+	netif_rx_ni(skb);
+}
+
+static void hi3717a_rx_frame_reset(struct hi3717a_priv *priv,
+				   struct hi3717a_frame *frame)
+{
+	struct net_device_stats *stats = &priv->dev->stats;
+
+	if (frame->synced) {
+		stats->rx_errors++;
+		stats->rx_frame_errors++;
 	}
 
-	skb_copy_to_linear_data(skb, (void*)data, count*sizeof(data[0]));
+	frame->synced = 0;
+	frame->count = 0;
+}
 
-	stats->rx_packets++;
-	stats->rx_bytes += skb->len;
+static void hi3717a_rx_frame_send(struct hi3717a_priv *priv,
+				  struct hi3717a_frame *frame, ktime_t begin)
+{
+	struct net_device *dev = priv->dev;
+	struct sk_buff *skb;
 
-	netif_rx_ni(skb);
+	skb = avionics_device_alloc_skb(dev,
+					frame->count * sizeof(avionics_data));
+	if (unlikely(!skb)) {
+		pr_err("avionics-hi3717a: Failed to allocate frame buffer\n");
+		dev->stats.rx_dropped++;
+		avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+		return;
+	}
 
-	return 0;
+	memcpy(skb->data, frame->data, frame->count * sizeof(avionics_data));
+
+	avionics_device_rx_tstamp(skb, ns_to_ktime(frame->data[0].time_nsecs));
+	hi3717a_rx_send_upstream(priv, skb, frame->count, begin);
 }
 
-#define HI3717A_RX_WORDS_PER 16
+/* Every word carries the number of the subframe it belongs to and its
+ * position in that subframe, so a new subframe starts whenever the
+ * subframe number changes and a gap in the positions means words were
+ * lost. Only complete frames are sent, words before the first frame
+ * boundary, or in a frame that lost words, are dropped. A frame is
+ * known to be complete once the first word of the next one arrives. */
+static void hi3717a_rx_assemble(struct hi3717a_priv *priv,
+				struct hi3717a_frame *frame,
+				const avionics_data *words, int count,
+				ktime_t begin)
+{
+	__u32 value, last;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		value = words[i].value;
+		last = frame->last;
+		frame->last = value;
+
+		if (ARINC717_FRAME(value) != ARINC717_FRAME(last)) {
+			if (!frame->superframe || !ARINC717_FRAME(value)) {
+				if (frame->synced && frame->count) {
+					hi3717a_rx_frame_send(priv, frame,
+							      begin);
+				}
+				frame->count = 0;
+				frame->synced = 1;
+			} else if (ARINC717_FRAME(value)
+				   != ((ARINC717_FRAME(last) + 1) & 0x3)) {
+				hi3717a_rx_frame_reset(priv, frame);
+			}
+		} else if (ARINC717_WORD_COUNT(value)
+			   != (ARINC717_WORD_COUNT(last) + 1)) {
+			hi3717a_rx_frame_reset(priv, frame);
+		}
+
+		if (!frame->synced) {
+			continue;
+		}
+
+		if (unlikely(frame->count >= frame->size)) {
+			hi3717a_rx_frame_reset(priv, frame);
+			continue;
+		}
+
+		frame->data[frame->count++] = words[i];
+	}
+}
 
-static void hi3717a_rx_worker(struct work_struct *work)
+static irqreturn_t hi3717a_rx_irq(int irq, void *irq_data)
 {
 	struct hi3717a_priv *priv;
 	struct net_device *dev;
+	struct sk_buff *skb;
 	avionics_data *data;
+	ktime_t first, begin, start;
 	ssize_t status;
-	int count;
+	s64 expected;
+	int count, delay, burst, word_nsecs;
 	bool fifo_error = false;
 
-	priv = container_of((struct delayed_work*)work,
-			    struct hi3717a_priv, worker);
+	priv = irq_data;
 	dev = priv->dev;
 
-	priv = avionics_device_priv(dev);
-	if (!priv) {
-		pr_err("avionics-hi3717a: Failed to get private data\n");
-		goto done_irq;
+	if (unlikely(irq != priv->irq)) {
+		pr_err("avionics-hi3717a: Unexpected irq %d\n", irq);
+		return IRQ_HANDLED;
+	}
+
+	if (!atomic_read(priv->rx_enabled)) {
+		return IRQ_HANDLED;
 	}
 
+	avionics_device_thread_update(dev);
+
+	first = READ_ONCE(priv->rx_irq_time);
+	begin = ktime_get_real();
+	avionics_device_latency(dev, AVIONICS_LATENCY_IRQ_THREAD, first, begin);
+
+	/* wait for the block of words we're about to read to arrive */
+	burst = hi3717a_rx_burst(priv);
+	delay = (*priv->period_usec)*(burst + 1);
+	usleep_range(delay, delay + 100);
+
 	mutex_lock(priv->lock);
 	status = hi3717a_rxfifo_is_empty(priv);
 	if (unlikely(status < 0)) {
@@ -826,21 +1348,42 @@ static void hi3717a_rx_worker(struct work_struct *work)
 		fifo_error = 1;
 	}
 
-	data = kmalloc(HI3717A_MTU, GFP_KERNEL);
-	if (data == NULL) {
-		pr_err("avionics-hi3593: Failed to allocate data buffer\n");
-		return;
+	/* decode straight into the skb, it's trimmed before it's sent,
+	 * unless the words are being collected into whole frames */
+	if (priv->rx_frame) {
+		skb = NULL;
+		data = priv->rx_frame->words;
+	} else {
+		skb = avionics_device_alloc_skb(dev, HI3717A_MTU);
+		if (unlikely(!skb)) {
+			pr_err("avionics-hi3717a: Failed to allocate RX"
+			       " buffer\n");
+			goto done_mutex;
+		}
+		data = (avionics_data *)skb->data;
 	}
 
-	status = hi3717a_rxfifo_read(priv, data, HI3717A_RX_WORDS_PER);
+	start = ktime_get_real();
+	status = hi3717a_rxfifo_read(priv, data, burst, first);
 	if (unlikely(status < 0)) {
 		pr_err("avionics-hi3717a: Failed to read fifo block\n");
 		goto done;
 	}
+	avionics_device_latency(dev, AVIONICS_LATENCY_SPI_BURST, start,
+				ktime_get_real());
 
 	count = status;
 
-	status = hi3717a_rxfifo_read_all(priv, &data[count]);
+	/* words keep arriving at the bus rate, so the time since the
+	 * first one tells us about how many are still in the FIFO */
+	word_nsecs = (*priv->period_usec)*NSEC_PER_USEC;
+	expected = div_s64(ktime_to_ns(ktime_sub(ktime_get_real(), first)),
+			   word_nsecs) + 1 - count;
+
+	expected = clamp_t(s64, expected, 1, HI3717A_FIFO_DEPTH);
+
+	status = hi3717a_rxfifo_read_all(priv, &data[count], expected,
+			ktime_add_ns(first, count*word_nsecs));
 	if (unlikely(status < 0)) {
 		pr_err("avionics-hi3717a: Failed to empty fifo\n");
 		goto done;
@@ -848,43 +1391,36 @@ static void hi3717a_rx_worker(struct work_struct *work)
 
 	count += status;
 
-	if (!fifo_error) {
-		status = hi3717a_rx_send_upstream(priv, data, count);
-		if (unlikely(status < 0)) {
-			pr_err("avionics-hi3717a: Failed to send packet\n");
-			goto done;
+	if (priv->rx_frame) {
+		if (fifo_error) {
+			hi3717a_rx_frame_reset(priv, priv->rx_frame);
+		} else {
+			hi3717a_rx_assemble(priv, priv->rx_frame, data, count,
+					    begin);
 		}
+	} else if (!fifo_error && count) {
+		avionics_device_rx_tstamp(skb, first);
+		hi3717a_rx_send_upstream(priv, skb, count, begin);
+		skb = NULL;
 	}
 
 done:
-	kfree(data);
+	kfree_skb(skb);
 done_mutex:
 	mutex_unlock(priv->lock);
-done_irq:
-	enable_irq(priv->irq);
+
+	return IRQ_HANDLED;
 }
 
-static irqreturn_t hi3717a_rx_irq(int irq, void *data)
+/* The receive interrupt fires as the first word of a block arrives,
+ * take the time here so it isn't delayed by the thread. */
+static irqreturn_t hi3717a_rx_irq_time(int irq, void *irq_data)
 {
-	struct hi3717a_priv *priv = data;
-	int delay;
-
-	if (unlikely(irq != priv->irq)) {
-		pr_err("avionics-hi3717a: Unexpected irq %d\n", irq);
-		return IRQ_HANDLED;
-	}
-
-	disable_irq_nosync(priv->irq);
+	struct hi3717a_priv *priv = irq_data;
 
+	WRITE_ONCE(priv->rx_irq_time, ktime_get_real());
 
-	if (atomic_read(priv->rx_enabled)) {
-		delay = (*priv->period_usec)*(HI3717A_RX_WORDS_PER) +
-			(*priv->period_usec);
-		queue_delayed_work(priv->wq, &priv->worker,
-				   (delay*HZ)/1000000);
-	}
-
-	return IRQ_HANDLED;
+	return IRQ_WAKE_THREAD;
 }
 
 static netdev_tx_t hi3717a_tx_start_xmit(struct sk_buff *skb,
@@ -892,9 +1428,6 @@ static netdev_tx_t hi3717a_tx_start_xmit(struct sk_buff *skb,
 {
 	struct net_device_stats *stats = &dev->stats;
 	struct hi3717a_priv *priv;
-	avionics_data data;
-	__u16 frame, word_count, word;
-	int offset, i;
 
 	if (skb->protocol != htons(ETH_P_AVIONICS)) {
 		kfree_skb(skb);
@@ -908,7 +1441,7 @@ static netdev_tx_t hi3717a_tx_start_xmit(struct sk_buff *skb,
 		return NETDEV_TX_OK;
 	}
 
-	if (unlikely(skb->len % 4)) {
+	if (unlikely(skb->len % sizeof(avionics_data))) {
 		kfree_skb(skb);
 		stats->tx_dropped++;
 		return NETDEV_TX_OK;
@@ -922,29 +1455,7 @@ static netdev_tx_t hi3717a_tx_start_xmit(struct sk_buff *skb,
 		return NETDEV_TX_OK;
 	}
 
-	/* word format:
-	 * 0000yyyy yyyyyyyy xxxxxxxx xxxxx0zz
-	 * where y is the word to write (12 bits)
-	 * where x is the word count starting at 1
-	 * and z if the frame starting at 0*/
-
-	for (i = 0; i < skb->len; i = i + sizeof(data)) {
-		/* ARINC-717 doesn't use the transmit timestamp for anything */
-
-		memcpy(&data, &skb->data[i], sizeof(data));
-
-		word = (data.value&0x0fff0000)>>16;
-		word_count = (data.value&0x0000fff8)>>3;
-		frame = data.value&0x00000003;
-
-		offset = (frame * priv->tx_buffer_size/4) + (word_count-1);
-
-		if ((word_count > 1) && (offset < priv->tx_buffer_size)) {
-			priv->tx_buffer[offset] = word;
-		}
-	}
-
-	consume_skb(skb);
+	avionics_device_tx_schedule(priv->tx_schedule, skb);
 
 	return NETDEV_TX_OK;
 }
@@ -954,12 +1465,14 @@ static const struct net_device_ops hi3717a_tx_netdev_ops = {
 	.ndo_open = hi3717a_tx_open,
 	.ndo_stop = hi3717a_tx_stop,
 	.ndo_start_xmit = hi3717a_tx_start_xmit,
+	.ndo_get_stats64 = avionics_device_get_stats64,
 };
 
 static const struct net_device_ops hi3717a_rx_netdev_ops = {
 	.ndo_change_mtu = hi3717a_change_mtu,
 	.ndo_open = hi3717a_rx_open,
 	.ndo_stop = hi3717a_rx_stop,
+	.ndo_get_stats64 = avionics_device_get_stats64,
 };
 
 static const struct of_device_id hi3717a_of_device_id[] = {
@@ -1044,11 +1557,6 @@ static int hi3717a_create_netdevs(struct spi_device *spi)
 	int i, err;
 
 	hi3717a->period_usec = 1000000/64; /* default rate is 64 words/sec */
-	hi3717a->wq = alloc_workqueue("hi3717a", WQ_HIGHPRI, 0);
-	if (!hi3717a->wq) {
-		pr_err("avionics-hi3717a: Failed to allocate work-queue\n");
-		return -ENOMEM;
-	}
 
 	for (i = 0; i < HI3717A_NUM_TX; i++) {
 		hi3717a->tx[i] = avionics_device_alloc(sizeof(*priv),
@@ -1073,12 +1581,18 @@ static int hi3717a_create_netdevs(struct spi_device *spi)
 		priv->spi = spi;
 		priv->lock = &hi3717a->lock;
 		priv->reset_gpio = hi3717a->reset_gpio;
-		priv->tx_buffer = NULL;
 		priv->tx_enabled = &hi3717a->tx_enabled;
-		priv->wq = hi3717a->wq;
 		priv->period_usec = &hi3717a->period_usec;
 
-		INIT_DELAYED_WORK(&priv->worker, hi3717a_tx_worker);
+		priv->spi_burst = avionics_spi_burst_alloc(spi,
+				HI3717A_FIFO_DEPTH, HI3717A_FIFO_DEPTH*3);
+		if (!priv->spi_burst) {
+			pr_err("avionics-hi3717a: Failed to allocate TX %d"
+			       " burst\n", i);
+			return -ENOMEM;
+		}
+
+		kthread_init_work(&priv->worker, hi3717a_tx_worker);
 
 		err = hi3717a_set_arinc717tx(&avionics_arinc717tx_default,
 					    hi3717a->tx[i]);
@@ -1120,16 +1634,24 @@ static int hi3717a_create_netdevs(struct spi_device *spi)
 		priv->lock = &hi3717a->lock;
 		priv->reset_gpio = hi3717a->reset_gpio;
 		priv->tx_enabled = &hi3717a->tx_enabled;
-		priv->tx_buffer = NULL;
 		priv->rx_enabled = &hi3717a->rx_enabled;
-		priv->wq = hi3717a->wq;
+		priv->rx_latency_usecs = HI3717A_RX_LATENCY_USECS;
 		priv->period_usec = &hi3717a->period_usec;
 
-		INIT_DELAYED_WORK(&priv->worker, hi3717a_rx_worker);
+		/* a status read goes with every word read */
+		priv->spi_burst = avionics_spi_burst_alloc(spi,
+				2*HI3717A_FIFO_DEPTH + 1,
+				HI3717A_FIFO_DEPTH*(5 + 2) + 2);
+		if (!priv->spi_burst) {
+			pr_err("avionics-hi3717a: Failed to allocate RX %d"
+			       " burst\n", i);
+			return -ENOMEM;
+		}
 
-		err = request_irq(hi3717a->irq, hi3717a_rx_irq,
-				  IRQF_TRIGGER_LOW,
-				  hi3717a->rx[i]->name, priv);
+		err = request_threaded_irq(hi3717a->irq, hi3717a_rx_irq_time,
+					   hi3717a_rx_irq,
+					   IRQF_TRIGGER_LOW | IRQF_ONESHOT,
+					   hi3717a->rx[i]->name, priv);
 		if (err) {
 			pr_err("avionics-hi3717a: Failed to register"
 			       " RX %d irq %d\n", i, hi3717a->irq);
@@ -1137,6 +1659,7 @@ static int hi3717a_create_netdevs(struct spi_device *spi)
 		}
 		priv->irq = hi3717a->irq;
 		disable_irq_nosync(priv->irq);
+		avionics_device_set_irq(hi3717a->rx[i], priv->irq);
 
 		err = hi3717a_set_arinc717rx(&avionics_arinc717rx_default,
 					    hi3717a->rx[i]);
@@ -1174,6 +1697,9 @@ static int hi3717a_remove(struct spi_device *spi)
 		if (hi3717a->tx[i]) {
 			priv = avionics_device_priv(hi3717a->tx[i]);
 			avionics_device_unregister(hi3717a->tx[i]);
+			if (priv) {
+				avionics_spi_burst_free(priv->spi_burst);
+			}
 			avionics_device_free(hi3717a->tx[i]);
 			hi3717a->tx[i] = NULL;
 		}
@@ -1184,11 +1710,17 @@ static int hi3717a_remove(struct spi_device *spi)
 			priv = avionics_device_priv(hi3717a->rx[i]);
 			if (priv) {
 				if (priv->irq) {
+					avionics_device_set_irq(hi3717a->rx[i],
+								0);
 					free_irq(priv->irq, priv);
 				}
-				cancel_delayed_work_sync(&priv->worker);
+				vfree(priv->rx_frame);
+				priv->rx_frame = NULL;
 			}
 			avionics_device_unregister(hi3717a->rx[i]);
+			if (priv) {
+				avionics_spi_burst_free(priv->spi_burst);
+			}
 			avionics_device_free(hi3717a->rx[i]);
 			hi3717a->rx[i] = 0;
 		}
@@ -1200,12 +1732,6 @@ static int hi3717a_remove(struct spi_device *spi)
 		hi3717a->reset_gpio = 0;
 	}
 
-	if (hi3717a->wq) {
-		flush_scheduled_work();
-		flush_workqueue(hi3717a->wq);
-		destroy_workqueue(hi3717a->wq);
-	}
-
 	return 0;
 }
 
@@ -28,6 +28,7 @@
 
 #include "avionics.h"
 #include "avionics-device.h"
+#include "avionics-spi.h"
 
 MODULE_DESCRIPTION("HOLT Hi-6138 MIL-1553 Driver");
 MODULE_LICENSE("GPL v2");
@@ -109,10 +110,28 @@ MODULE_VERSION("1.0.0");
 #define HI6138_DATA_STACK_IRQ		0x18ff
 #define HI6138_DATA_STACK_END		0x1fff
 
+/* each monitored message has an 8 word entry in the command stack */
+#define HI6138_CMD_BLOCK_WORDS		8
+#define HI6138_CMD_BLOCK_STATUS		0
+#define HI6138_CMD_BLOCK_TIME_TAG	1
+#define HI6138_CMD_BLOCK_LENGTH		5
+#define HI6138_CMD_BLOCK_DATA_ADDR	6
+#define HI6138_CMD_BLOCK_COMMAND	7
+
+#define HI6138_CMD_STACK_BLOCKS		((HI6138_CMD_STACK_END + 1 \
+					  - HI6138_CMD_STACK_START) \
+					 / HI6138_CMD_BLOCK_WORDS)
+
+/* the command word and status words share the message's byte count
+ * with the data words */
+#define HI6138_MAX_DATA_WORDS		35
+
+/* messages read from the command stack in one burst, and sent up in
+ * one packet */
+#define HI6138_BM_BATCH			32
+
 struct hi6138 {
 	struct net_device *bm;
-	struct workqueue_struct *wq;
-	struct work_struct worker;
 	int reset_gpio;
 	int ackirq_gpio;
 	int irq;
@@ -129,6 +148,15 @@ struct hi6138_priv {
 	struct mutex *lock;
 	atomic_t *bm_enabled;
 	__u16 smt_last_addr;
+	struct avionics_spi_burst *cmd_burst;
+	struct avionics_spi_burst *data_burst;
+};
+
+/* Sent while reading with an auto-incrementing memory pointer, the
+ * words come back as the rest of the transfer is clocked out. */
+static const __u8 hi6138_read_memptr[1 + HI6138_BM_BATCH
+				     * HI6138_CMD_BLOCK_WORDS * 2] = {
+	HI6138_OPCODE_READ_MEMPTR,
 };
 
 static int hi6138_get_fastaccess(struct spi_device *spi, __u8 address, __u16 *value)
@@ -274,6 +302,7 @@ static int hi6138_set_mil1553bm(struct avionics_mil1553bm *config,
 
 static struct avionics_ops hi6138_mil553bm_ops = {
 	.name = "mil1553bm%d",
+	.flags = AVIONICS_OPS_PACKETS,
 	.get_mil1553bm = hi6138_get_mil1553bm,
 	.set_mil1553bm = hi6138_set_mil1553bm,
 };
@@ -386,16 +415,146 @@ static int hi6138_bm_stop(struct net_device *dev)
 	return 0;
 }
 
-static int hi6138_irq_bm(struct net_device *dev)
+/* Adds a read of num_words words of memory starting at address to a
+ * burst, pointing memory pointer A at the address first. Returns where
+ * the words will be read into. */
+static __u8 *hi6138_burst_add_read(struct avionics_spi_burst *burst,
+				   __u16 address, int num_words)
 {
-	struct hi6138_priv *priv;
-	struct net_device_stats *stats;
-	__u16 smtirq_status, cmd_addr, data_addr, length;
-	int err, wrapped = 0;
+	__u8 cmd[3];
+	__u8 *rx;
+
+	cmd[0] = 0x80 | (HI6138_REG_MEMPTRA&0x3f);
+	cmd[1] = (address&0xff00) >> 8;
+	cmd[2] = (address&0x00ff);
+
+	if (!avionics_spi_burst_add(burst, cmd, sizeof(cmd))) {
+		return NULL;
+	}
+
+	rx = avionics_spi_burst_add(burst, hi6138_read_memptr,
+				    1 + num_words*sizeof(__u16));
+	if (!rx) {
+		return NULL;
+	}
+
+	return rx + 1;
+}
+
+static __u16 hi6138_burst_word(const __u8 *words, int i)
+{
+	return (words[2*i] << 8) | words[2*i + 1];
+}
+
+/* Reads num_blocks command stack entries starting at the next unread
+ * one, then all of their data blocks, and sends them up as a single
+ * packet of struct avionics_mil1553bm_record. */
+static int hi6138_bm_read_blocks(struct hi6138_priv *priv, int num_blocks)
+{
+	struct net_device *dev = priv->dev;
+	struct avionics_mil1553bm_record *record;
 	struct sk_buff *skb;
-	__u16 buffer[36];
+	__u8 *blocks, *block, *data[HI6138_BM_BATCH];
+	int err, i, j, size, length[HI6138_BM_BATCH];
+	ktime_t now;
+
+	avionics_spi_burst_reset(priv->cmd_burst);
+	blocks = hi6138_burst_add_read(priv->cmd_burst, priv->smt_last_addr,
+				       num_blocks*HI6138_CMD_BLOCK_WORDS);
+	if (!blocks) {
+		return -ENOBUFS;
+	}
+
+	err = avionics_spi_burst_sync(priv->cmd_burst);
+	if (err < 0) {
+		pr_err("avionics-hi6138-bm: Failed read command stack\n");
+		return err;
+	}
+
+	/* then gather every data block in one more message */
+	avionics_spi_burst_reset(priv->data_burst);
+	size = 0;
+
+	for (i = 0; i < num_blocks; i++) {
+		block = &blocks[i*HI6138_CMD_BLOCK_WORDS*sizeof(__u16)];
+
+		length[i] = hi6138_burst_word(block, HI6138_CMD_BLOCK_LENGTH);
+		if (length[i] > 2) {
+			length[i] = min_t(int, (length[i] - 2)/sizeof(__u16),
+					  HI6138_MAX_DATA_WORDS);
+		} else {
+			length[i] = 0;
+		}
 
-	stats = &dev->stats;
+		data[i] = NULL;
+		if (length[i]) {
+			data[i] = hi6138_burst_add_read(priv->data_burst,
+					hi6138_burst_word(block,
+						HI6138_CMD_BLOCK_DATA_ADDR),
+					length[i]);
+			if (!data[i]) {
+				return -ENOBUFS;
+			}
+		}
+
+		size += AVIONICS_MIL1553BM_RECORD_SIZE(length[i]);
+	}
+
+	err = avionics_spi_burst_sync(priv->data_burst);
+	if (err < 0) {
+		pr_err("avionics-hi6138-bm: Failed read data blocks\n");
+		return err;
+	}
+	now = ktime_get_real();
+
+	skb = avionics_device_alloc_skb(dev, size);
+	if (!skb) {
+		/* the messages are gone either way, don't read them
+		 * again */
+		pr_err("avionics-hi6138-bm: Failed to allocate RX buffer\n");
+		dev->stats.rx_dropped += num_blocks;
+		avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+		return 0;
+	}
+
+	avionics_device_rx_tstamp(skb, now);
+	memset(skb->data, 0, size);
+	record = (struct avionics_mil1553bm_record *)skb->data;
+
+	for (i = 0; i < num_blocks; i++) {
+		block = &blocks[i*HI6138_CMD_BLOCK_WORDS*sizeof(__u16)];
+
+		/* the batch read time, the time tag is per message */
+		record->time_msecs = ktime_to_ms(now);
+		for (j = 0; j < ARRAY_SIZE(record->time_tag); j++) {
+			record->time_tag[j] = hi6138_burst_word(block,
+					HI6138_CMD_BLOCK_TIME_TAG + j);
+		}
+		record->block_status = hi6138_burst_word(block,
+						HI6138_CMD_BLOCK_STATUS);
+		record->command = hi6138_burst_word(block,
+						    HI6138_CMD_BLOCK_COMMAND);
+		record->length = length[i];
+
+		for (j = 0; j < length[i]; j++) {
+			record->data[j] = hi6138_burst_word(data[i], j);
+		}
+
+		record = (void *)record
+			 + AVIONICS_MIL1553BM_RECORD_SIZE(length[i]);
+	}
+
+	avionics_device_rx_stats(dev, skb->len);
+	netif_rx_ni(skb);
+
+	return 0;
+}
+
+static int hi6138_irq_bm(struct net_device *dev)
+{
+	struct hi6138_priv *priv;
+	__u16 smtirq_status, cmd_addr, next_addr;
+	int err, count, num_blocks;
 
 	priv = avionics_device_priv(dev);
 	if (!priv) {
@@ -411,86 +570,63 @@ static int hi6138_irq_bm(struct net_device *dev)
 		return err;
 	}
 
-	if (smtirq_status & HI6138_REG_SMTIRQ_SMTEON) {
-		err = hi6138_get_reg(priv->spi, HI6138_REG_SMTLAST, &cmd_addr);
-		if (err < 0) {
-			pr_err("avionics-hi6138-bm: Failed read"
-			       " last address register\n");
-			return err;
-		}
-
-		if (cmd_addr < HI6138_CMD_STACK_START) {
-			return 0;
-		}
-
-		if (priv->smt_last_addr == 0) {
-			/* first message after restart */
-			priv->smt_last_addr = cmd_addr;
-		}
-
-		if(priv->smt_last_addr > cmd_addr) {
-			wrapped = 1;
-		}
-
-		for(; ((priv->smt_last_addr <=cmd_addr) || wrapped) ;
-		    priv->smt_last_addr += 8) {
-			if(priv->smt_last_addr >= HI6138_CMD_STACK_END) {
-				priv->smt_last_addr = HI6138_CMD_STACK_START;
-				wrapped = 0;
-			}
-
-			err = hi6138_get_reg(priv->spi, priv->smt_last_addr + 6,
-					     &data_addr);
-			if (err < 0) {
-				pr_err("avionics-hi6138-bm: Failed read"
-				       " data address\n");
-				return err;
-			}
+	if (!(smtirq_status & HI6138_REG_SMTIRQ_SMTEON)) {
+		return 0;
+	}
 
-			err = hi6138_get_reg(priv->spi, priv->smt_last_addr + 5,
-					     &length);
-			if (err < 0) {
-				pr_err("avionics-hi6138-bm: Failed read"
-				       " data length\n");
-				return err;
-			}
+	err = hi6138_get_reg(priv->spi, HI6138_REG_SMTLAST, &cmd_addr);
+	if (err < 0) {
+		pr_err("avionics-hi6138-bm: Failed read"
+		       " last address register\n");
+		return err;
+	}
 
-			skb = avionics_device_alloc_skb(dev, length);
+	if ((cmd_addr < HI6138_CMD_STACK_START)
+	    || (cmd_addr > HI6138_CMD_STACK_END)) {
+		return 0;
+	}
 
-			err = hi6138_get_reg(priv->spi, priv->smt_last_addr + 7,
-					     &buffer[0]);
-			if (err < 0) {
-				pr_err("avionics-hi6138-bm: Failed read"
-				       " command word\n");
-				return err;
-			}
+	if (priv->smt_last_addr == 0) {
+		/* first message after restart */
+		priv->smt_last_addr = cmd_addr;
+	}
 
-			if (length > 2) {
-				err = hi6138_get_mem(priv->spi, data_addr,
-						     &buffer[1], (length-2)/sizeof(buffer[1]));
-				if (err < 0) {
-					pr_err("avionics-hi6138-bm: Failed read"
-					       " command word\n");
-					return err;
-				}
-			}
+	/* everything up to and including the last entry written is new,
+	 * allowing for the stack wrapping around */
+	next_addr = cmd_addr + HI6138_CMD_BLOCK_WORDS;
+	if (next_addr > HI6138_CMD_STACK_END) {
+		next_addr = HI6138_CMD_STACK_START;
+	}
 
-			/* TODO: Convert to a format similar to A717, with an
-			 * offset counter to packatize the data */
+	count = (next_addr - priv->smt_last_addr) / HI6138_CMD_BLOCK_WORDS;
+	if (count < 0) {
+		count += HI6138_CMD_STACK_BLOCKS;
+	}
 
-			skb_copy_to_linear_data(skb, buffer, length);
+	while (count > 0) {
+		/* a burst can't run past the end of the stack */
+		num_blocks = min(count, HI6138_BM_BATCH);
+		num_blocks = min_t(int, num_blocks,
+				   (HI6138_CMD_STACK_END + 1
+				    - priv->smt_last_addr)
+				   / HI6138_CMD_BLOCK_WORDS);
 
-			stats->rx_packets++;
-			stats->rx_bytes += skb->len;
-			netif_rx_ni(skb);
+		err = hi6138_bm_read_blocks(priv, num_blocks);
+		if (err < 0) {
+			return err;
 		}
 
+		priv->smt_last_addr += num_blocks*HI6138_CMD_BLOCK_WORDS;
+		if (priv->smt_last_addr > HI6138_CMD_STACK_END) {
+			priv->smt_last_addr = HI6138_CMD_STACK_START;
+		}
+		count -= num_blocks;
 	}
 
 	return 0;
 }
 
-static void hi6138_irq_worker(struct work_struct *work)
+static irqreturn_t hi6138_irq(int irq, void *data)
 {
 	struct net_device *dev;
 	struct net_device_stats *stats;
@@ -498,8 +634,16 @@ static void hi6138_irq_worker(struct work_struct *work)
 	__u16 hirq_status;
 	int err;
 
-	hi6138 = container_of((struct work_struct*)work,
-			      struct hi6138, worker);
+	hi6138 = data;
+
+	if (unlikely(irq != hi6138->irq)) {
+		pr_err("avionics-hi6138: Unexpected irq %d\n", irq);
+		return IRQ_HANDLED;
+	}
+
+	if (hi6138->bm) {
+		avionics_device_thread_update(hi6138->bm);
+	}
 
 	mutex_lock(&hi6138->lock);
 
@@ -522,24 +666,7 @@ done:
 	usleep_range(1, 10);
 	gpio_set_value(hi6138->ackirq_gpio, 0);
 
-	usleep_range(100000, 1000000); /* Added to aid in debugging, REMOVE */
-
 	mutex_unlock(&hi6138->lock);
-	enable_irq(hi6138->irq);
-}
-
-static irqreturn_t hi6138_irq(int irq, void *data)
-{
-	struct hi6138 *hi6138 = data;
-
-	if (unlikely(irq != hi6138->irq)) {
-		pr_err("avionics-hi6138: Unexpected irq %d\n", irq);
-		return IRQ_HANDLED;
-	}
-
-	disable_irq_nosync(hi6138->irq);
-
-	queue_work(hi6138->wq, &hi6138->worker);
 
 	return IRQ_HANDLED;
 }
@@ -547,6 +674,7 @@ static irqreturn_t hi6138_irq(int irq, void *data)
 static const struct net_device_ops hi6138_bm_netdev_ops = {
 	.ndo_open = hi6138_bm_open,
 	.ndo_stop = hi6138_bm_stop,
+	.ndo_get_stats64 = avionics_device_get_stats64,
 };
 
 static const struct of_device_id hi6138_of_device_id[] = {
@@ -609,9 +737,9 @@ static int hi6138_get_config(struct spi_device *spi)
 		return hi6138->irq;
 	}
 
-	err = request_irq(hi6138->irq, hi6138_irq,
-			  IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
-			  "hi6138", hi6138);
+	err = request_threaded_irq(hi6138->irq, NULL, hi6138_irq,
+				   IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
+				   "hi6138", hi6138);
 	if (err) {
 		pr_err("avionics-hi6138: Failed to register"
 		       " irq %d\n", hi6138->irq);
@@ -746,13 +874,6 @@ static int hi6138_create_netdevs(struct spi_device *spi)
 	struct hi6138_priv *priv;
 	int err;
 
-	hi6138->wq = alloc_workqueue("hi6138", WQ_HIGHPRI, 0);
-	if (!hi6138->wq) {
-		pr_err("avionics-hi6138: Failed to allocate work-queue\n");
-		return -ENOMEM;
-	}
-	INIT_WORK(&hi6138->worker, hi6138_irq_worker);
-
 	hi6138->bm = avionics_device_alloc(sizeof(*priv),
 					   &hi6138_mil553bm_ops);
 
@@ -763,6 +884,11 @@ static int hi6138_create_netdevs(struct spi_device *spi)
 	}
 
 	hi6138->bm->netdev_ops = &hi6138_bm_netdev_ops;
+
+	/* the receive pool holds buffers for a whole batch of the longest
+	 * messages, the MTU has nothing to do with them */
+	avionics_device_set_rx_size(hi6138->bm, HI6138_BM_BATCH
+			* AVIONICS_MIL1553BM_RECORD_SIZE(HI6138_MAX_DATA_WORDS));
 	priv = avionics_device_priv(hi6138->bm);
 
 	if (!priv) {
@@ -776,6 +902,16 @@ static int hi6138_create_netdevs(struct spi_device *spi)
 	priv->bm_enabled = &hi6138->bm_enabled;
 	skb_queue_head_init(&priv->skbq);
 
+	priv->cmd_burst = avionics_spi_burst_alloc(spi, 2,
+			3 + sizeof(hi6138_read_memptr));
+	priv->data_burst = avionics_spi_burst_alloc(spi, 2*HI6138_BM_BATCH,
+			HI6138_BM_BATCH*(3 + 1 + HI6138_MAX_DATA_WORDS*2));
+	if (!priv->cmd_burst || !priv->data_burst) {
+		pr_err("avionics-hi6138: Failed to allocate"
+		       " Bus Monitor bursts\n");
+		return -ENOMEM;
+	}
+
 	err = hi6138_set_mil1553bm(&avionics_mil1553bm_default,
 				    hi6138->bm);
 	if (err) {
@@ -791,6 +927,8 @@ static int hi6138_create_netdevs(struct spi_device *spi)
 		return -EINVAL;
 	}
 
+	avionics_device_set_irq(hi6138->bm, hi6138->irq);
+
 
 	return 0;
 }
@@ -802,34 +940,34 @@ static int hi6138_remove(struct spi_device *spi)
 
 	pr_info("avionics-hi6138: Removing Device\n");
 
+	/* the interrupt thread uses the bus monitor device */
+	if (hi6138->irq) {
+		if (hi6138->bm) {
+			avionics_device_set_irq(hi6138->bm, 0);
+		}
+		free_irq(hi6138->irq, hi6138);
+	}
+
 	if (hi6138->bm) {
 		priv = avionics_device_priv(hi6138->bm);
 		if (priv) {
 			skb_queue_purge(&priv->skbq);
 		}
 		avionics_device_unregister(hi6138->bm);
+		if (priv) {
+			avionics_spi_burst_free(priv->cmd_burst);
+			avionics_spi_burst_free(priv->data_burst);
+		}
 		avionics_device_free(hi6138->bm);
 		hi6138->bm = NULL;
 	}
 
-	if (hi6138->irq) {
-		free_irq(hi6138->irq, hi6138);
-	}
-
-	cancel_work_sync(&hi6138->worker);
-
 	if (hi6138->reset_gpio > 0) {
 		gpio_set_value(hi6138->reset_gpio, 1);
 		gpio_free(hi6138->reset_gpio);
 		hi6138->reset_gpio = 0;
 	}
 
-	if (hi6138->wq) {
-		flush_scheduled_work();
-		flush_workqueue(hi6138->wq);
-		destroy_workqueue(hi6138->wq);
-	}
-
 	return 0;
 }
 
@@ -21,6 +21,8 @@
 #include <net/sock.h>
 #include <net/rtnetlink.h>
 #include <linux/skbuff.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 #include <linux/init.h>
 
 #include "avionics.h"
@@ -31,31 +33,178 @@ MODULE_LICENSE("GPL v2");
 MODULE_AUTHOR("Charles Eidsness <charles@ccxtechnologies.com>");
 MODULE_VERSION("1.0.0");
 
-static void lb_rx(struct sk_buff *skb_xmit, struct net_device *dev)
+#define LB_FIFO_DEPTH_MAX	65536
+#define LB_WORD_BITS		36 /* ARINC-429, 32 bits and a 4 bit gap */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+#define LB_TIMER_MODE	HRTIMER_MODE_ABS
+#else
+#define LB_TIMER_MODE	HRTIMER_MODE_ABS_SOFT
+#endif
+
+struct lb_priv {
+	struct avionics_tx_schedule *tx_schedule;
+	spinlock_t lock;
+	struct avionics_lb_emulation emulation;
+	struct sk_buff_head wire;
+	struct hrtimer timer;
+	ktime_t wire_idle;
+};
+
+/* time each packet on the emulated bus is due to be received */
+#define LB_CB(skb)	((ktime_t *)((skb)->cb))
+
+static void lb_deliver(struct sk_buff *skb, struct net_device *dev)
 {
-	struct sk_buff *skb;
 	struct net_device_stats *stats = &dev->stats;
 
 	pr_debug("avionics-lb: RX Packet\n");
 
-	skb = avionics_device_alloc_skb(dev, skb_xmit->len);
-	if (!skb) {
-		pr_err("avionics-lb: Failed ot allocate RX buffer\n");
-		return;
-	}
+	skb_orphan(skb);
 
-	skb_copy_to_linear_data(skb, skb_xmit->data, skb_xmit->len);
+	skb->dev = dev;
+	skb->pkt_type = PACKET_HOST;
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_reset_transport_header(skb);
 
 	stats->rx_packets++;
 	stats->rx_bytes += skb->len;
 
-	netif_rx_ni(skb);
+	netif_rx(skb);
+}
+
+static enum hrtimer_restart lb_timer(struct hrtimer *timer)
+{
+	struct lb_priv *priv = container_of(timer, struct lb_priv, timer);
+	struct net_device *dev;
+	struct sk_buff_head due;
+	struct sk_buff *skb;
+	unsigned long flags;
+	ktime_t now;
+
+	__skb_queue_head_init(&due);
+
+	spin_lock_irqsave(&priv->lock, flags);
+
+	now = ktime_get();
+	while ((skb = skb_peek(&priv->wire))) {
+		if (ktime_after(*LB_CB(skb), now)) {
+			hrtimer_start(&priv->timer, *LB_CB(skb), LB_TIMER_MODE);
+			break;
+		}
+		__skb_unlink(skb, &priv->wire);
+		__skb_queue_tail(&due, skb);
+	}
+
+	spin_unlock_irqrestore(&priv->lock, flags);
+
+	while ((skb = __skb_dequeue(&due))) {
+		dev = skb->dev;
+		lb_deliver(skb, dev);
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+/* Puts a packet on the emulated bus. The words go out back to back
+ * once the bus is free and are received in bursts of coalesce words,
+ * each burst shares the original packet's data. */
+static void lb_emulate(struct lb_priv *priv, struct sk_buff *skb,
+		       struct net_device *dev)
+{
+	struct avionics_lb_emulation *emulation = &priv->emulation;
+	struct sk_buff *burst;
+	unsigned long flags;
+	ktime_t now, start;
+	u64 word_nsecs, backlog;
+	int i, count, num_samples;
+
+	num_samples = skb->len / sizeof(avionics_data);
+
+	spin_lock_irqsave(&priv->lock, flags);
+
+	/* emulation may have been switched off since it was checked */
+	if (!emulation->rate_hz) {
+		spin_unlock_irqrestore(&priv->lock, flags);
+		lb_deliver(skb, dev);
+		return;
+	}
+
+	word_nsecs = div_u64((u64)emulation->word_bits * NSEC_PER_SEC,
+			     emulation->rate_hz);
+	if (!word_nsecs) {
+		word_nsecs = 1;
+	}
+
+	now = ktime_get();
+	start = ktime_after(priv->wire_idle, now) ? priv->wire_idle : now;
+
+	backlog = div64_u64(ktime_to_ns(ktime_sub(start, now)), word_nsecs);
+	if ((backlog + num_samples) > emulation->fifo_depth) {
+		emulation->overflows++;
+		spin_unlock_irqrestore(&priv->lock, flags);
+
+		dev->stats.tx_fifo_errors++;
+		dev->stats.tx_dropped++;
+		avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+		kfree_skb(skb);
+		return;
+	}
+
+	for (i = 0; i < num_samples; i += count) {
+		count = min_t(int, emulation->coalesce, num_samples - i);
+
+		burst = skb_clone(skb, GFP_ATOMIC);
+		if (!burst) {
+			pr_err_ratelimited("avionics-lb: Failed to split"
+					   " packet\n");
+			dev->stats.rx_dropped++;
+			continue;
+		}
+
+		skb_pull(burst, i * sizeof(avionics_data));
+		skb_trim(burst, count * sizeof(avionics_data));
+		*LB_CB(burst) = ktime_add_ns(start, (i + count) * word_nsecs);
+
+		__skb_queue_tail(&priv->wire, burst);
+		if (skb_peek(&priv->wire) == burst) {
+			hrtimer_start(&priv->timer, *LB_CB(burst),
+				      LB_TIMER_MODE);
+		}
+	}
+
+	priv->wire_idle = ktime_add_ns(start, num_samples * word_nsecs);
+
+	spin_unlock_irqrestore(&priv->lock, flags);
+
+	consume_skb(skb);
+}
+
+/* Called by the transmit schedule once a packet's words are due, this
+ * may be from a timer so the packet is looped back as is rather than
+ * being copied into a new buffer. */
+static void lb_rx(struct sk_buff *skb, struct net_device *dev)
+{
+	struct lb_priv *priv = netdev_priv(dev);
+
+	/* this is as close to the wire as the loop back gets */
+	avionics_device_tx_tstamp(skb, ktime_get_real());
+
+	if (READ_ONCE(priv->emulation.rate_hz)) {
+		lb_emulate(priv, skb, dev);
+		return;
+	}
+
+	lb_deliver(skb, dev);
 }
 
 static netdev_tx_t lb_start_xmit(struct sk_buff *skb,
 				 struct net_device *dev)
 {
 	struct net_device_stats *stats = &dev->stats;
+	struct lb_priv *priv = netdev_priv(dev);
 
 	pr_debug("avionics-lb: TX Packet\n");
 
@@ -65,7 +214,7 @@ static netdev_tx_t lb_start_xmit(struct sk_buff *skb,
 		return NETDEV_TX_OK;
 	}
 
-	if (unlikely(skb->len % sizeof(__u32))) {
+	if (unlikely(skb->len % sizeof(avionics_data))) {
 		kfree_skb(skb);
 		dev->stats.tx_dropped++;
 		return NETDEV_TX_OK;
@@ -74,12 +223,41 @@ static netdev_tx_t lb_start_xmit(struct sk_buff *skb,
 	stats->tx_packets++;
 	stats->tx_bytes += skb->len;
 
-	lb_rx(skb, dev);
+	avionics_device_tx_schedule(priv->tx_schedule, skb);
 
-	consume_skb(skb);
 	return NETDEV_TX_OK;
 }
 
+static int lb_init_dev(struct net_device *dev)
+{
+	struct lb_priv *priv = netdev_priv(dev);
+
+	spin_lock_init(&priv->lock);
+	skb_queue_head_init(&priv->wire);
+	hrtimer_init(&priv->timer, CLOCK_MONOTONIC, LB_TIMER_MODE);
+	priv->timer.function = lb_timer;
+
+	priv->tx_schedule = avionics_device_tx_schedule_alloc(dev, lb_rx);
+	if (!priv->tx_schedule) {
+		pr_err("avionics-lb: Failed to allocate TX schedule\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void lb_uninit_dev(struct net_device *dev)
+{
+	struct lb_priv *priv = netdev_priv(dev);
+
+	/* the schedule can still put packets on the bus until it's gone */
+	avionics_device_tx_schedule_free(priv->tx_schedule);
+	priv->tx_schedule = NULL;
+
+	hrtimer_cancel(&priv->timer);
+	skb_queue_purge(&priv->wire);
+}
+
 static int lb_change_mtu(struct net_device *dev, int mtu)
 {
 	if (dev->flags & IFF_UP) {
@@ -94,6 +272,8 @@ static int lb_change_mtu(struct net_device *dev, int mtu)
 }
 
 static const struct net_device_ops lb_net_device_ops = {
+	.ndo_init = lb_init_dev,
+	.ndo_uninit = lb_uninit_dev,
 	.ndo_start_xmit = lb_start_xmit,
 	.ndo_change_mtu = lb_change_mtu,
 };
@@ -114,9 +294,95 @@ static void lb_rtnl_link_setup(struct net_device *dev)
 #endif
 }
 
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,13,0)
+static int lb_changelink(struct net_device *dev,
+			 struct nlattr *tb[], struct nlattr *data[])
+#else
+static int lb_changelink(struct net_device *dev,
+			 struct nlattr *tb[], struct nlattr *data[],
+			 struct netlink_ext_ack *extack)
+#endif
+{
+	struct lb_priv *priv = netdev_priv(dev);
+	struct avionics_lb_emulation emulation;
+	unsigned long flags;
+
+	if (!data || !data[IFLA_AVIONICS_LB_EMULATION]) {
+		return 0;
+	}
+
+	memcpy(&emulation, nla_data(data[IFLA_AVIONICS_LB_EMULATION]),
+	       sizeof(emulation));
+
+	if (emulation.rate_hz) {
+		if (!emulation.word_bits) {
+			emulation.word_bits = LB_WORD_BITS;
+		}
+
+		if (!emulation.fifo_depth
+		    || (emulation.fifo_depth > LB_FIFO_DEPTH_MAX)) {
+			pr_err("avionics-lb: FIFO depth must be between 1"
+			       " and %d words\n", LB_FIFO_DEPTH_MAX);
+			return -EINVAL;
+		}
+
+		if (!emulation.coalesce) {
+			emulation.coalesce = 1;
+		}
+
+		if (emulation.coalesce > emulation.fifo_depth) {
+			pr_err("avionics-lb: Can't coalesce more words than"
+			       " the FIFO holds\n");
+			return -EINVAL;
+		}
+	}
+
+	spin_lock_irqsave(&priv->lock, flags);
+	emulation.overflows = priv->emulation.overflows;
+	memcpy(&priv->emulation, &emulation, sizeof(emulation));
+	spin_unlock_irqrestore(&priv->lock, flags);
+
+	return 0;
+}
+
+static size_t lb_get_size(const struct net_device *dev)
+{
+	return nla_total_size(sizeof(struct avionics_lb_emulation));
+}
+
+static int lb_fill_info(struct sk_buff *skb, const struct net_device *dev)
+{
+	struct lb_priv *priv = netdev_priv(dev);
+	struct avionics_lb_emulation emulation;
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	memcpy(&emulation, &priv->emulation, sizeof(emulation));
+	spin_unlock_irqrestore(&priv->lock, flags);
+
+	if (nla_put(skb, IFLA_AVIONICS_LB_EMULATION, sizeof(emulation),
+		    &emulation)) {
+		return -EMSGSIZE;
+	}
+
+	return 0;
+}
+
+static const struct nla_policy lb_policy[IFLA_AVIONICS_MAX + 1] = {
+	[IFLA_AVIONICS_LB_EMULATION] = {
+		.len = sizeof(struct avionics_lb_emulation)
+	},
+};
+
 static struct rtnl_link_ops lb_rtnl_link_ops __read_mostly = {
-	.kind	= "avionics-lb",
-	.setup	= lb_rtnl_link_setup,
+	.kind		= "avionics-lb",
+	.priv_size	= sizeof(struct lb_priv),
+	.maxtype	= IFLA_AVIONICS_MAX,
+	.policy		= lb_policy,
+	.setup		= lb_rtnl_link_setup,
+	.changelink	= lb_changelink,
+	.get_size	= lb_get_size,
+	.fill_info	= lb_fill_info,
 };
 
 static __init int lb_init(void)
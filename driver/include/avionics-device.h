@@ -14,15 +14,31 @@
 #ifndef __AVIONICS_DEVICE_H__
 #define __AVIONICS_DEVICE_H__
 
+#include <linux/version.h>
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
+#include <linux/mm_types.h>
 
 #include "avionics.h"
 
-typedef struct avionics_proto_timestamp_data avionics_data;
+/* Words are passed between the drivers and the protocols in the record
+ * protocol's format, the ifindex is filled in as packets are handed to
+ * record sockets so drivers leave it alone. */
+typedef struct avionics_proto_record_data avionics_data;
+
+/* Devices with this flag get a kthread_worker of their own, see
+ * avionics_device_worker. */
+#define AVIONICS_OPS_WORKER	(1<<0)
+
+/* Devices with this flag pass up packets in a format of their own
+ * rather than avionics_data, like the MIL-1553 bus monitor's records.
+ * Their packets reach sockets byte for byte, whatever the protocol,
+ * and skip the label filters, receive rings and label tables. */
+#define AVIONICS_OPS_PACKETS	(1<<1)
 
 struct avionics_ops {
 	const char *name;
+	unsigned int flags;
 
 	int (*set_rate)(struct avionics_rate *rate,
 			const struct net_device *dev);
@@ -53,11 +69,108 @@ struct avionics_ops {
 			     const struct net_device *dev);
 	void (*get_mil1553bm)(struct avionics_mil1553bm *config,
 			      const struct net_device *dev);
+
+	int (*set_rx_burst)(struct avionics_rx_burst *config,
+			    const struct net_device *dev);
+	void (*get_rx_burst)(struct avionics_rx_burst *config,
+			     const struct net_device *dev);
+
+	/* Devices that can be polled empty their receiver from rx_poll,
+	 * returning the number of words read, and switch their receive
+	 * interrupt on and off with rx_irq. Both may sleep. */
+	int (*rx_poll)(struct net_device *dev);
+	void (*rx_irq)(struct net_device *dev, bool enable);
+
+	/* Devices with a transmit buffer user space can write to directly
+	 * map it from tx_mmap, see AVIONICS_TX_FRAME_OFFSET. */
+	int (*tx_mmap)(struct net_device *dev, struct vm_area_struct *vma);
 };
 
 struct sk_buff* avionics_device_alloc_skb(struct net_device *dev,
 					  unsigned int size);
 
+/* Sets the size of the receive buffers kept ready for
+ * avionics_device_alloc_skb, for drivers whose packets don't follow the
+ * MTU. Call it before the device is registered, bigger packets are
+ * always allocated as they're needed. */
+void avionics_device_set_rx_size(struct net_device *dev, unsigned int size);
+
+/* Reports time, when the first word in skb arrived, through the
+ * socket timestamping interface at full resolution. The timestamp
+ * protocol's word times are only milliseconds. */
+void avionics_device_rx_tstamp(struct sk_buff *skb, ktime_t time);
+
+/* Reports time, when the last word in skb was loaded into the
+ * transmitter, on the sending socket's error queue if it asked for
+ * transmit timestamps. Call it before the skb is freed. */
+void avionics_device_tx_tstamp(struct sk_buff *skb, ktime_t time);
+
+/* Restarts the device's transmit queue once a driver has room for more
+ * packets, and wakes any senders waiting for it. Drivers use this in
+ * place of netif_wake_queue. */
+void avionics_device_tx_wake(struct net_device *dev);
+
+/* Packet and byte counters are kept per CPU, drivers count packets
+ * with these from their threads and workers instead of updating
+ * dev->stats, which is left for the error counters. */
+void avionics_device_rx_stats(struct net_device *dev, unsigned int bytes);
+void avionics_device_tx_stats(struct net_device *dev, unsigned int packets,
+			      unsigned int bytes);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+struct rtnl_link_stats64 *avionics_device_get_stats64(struct net_device *dev,
+					struct rtnl_link_stats64 *stats);
+#else
+void avionics_device_get_stats64(struct net_device *dev,
+				 struct rtnl_link_stats64 *stats);
+#endif
+
+/* Latency histograms, shown per device in debugfs under avionics/ and
+ * also reported through the avionics_latency tracepoint. */
+enum avionics_device_latency {
+	AVIONICS_LATENCY_IRQ_THREAD,	/* interrupt to thread start */
+	AVIONICS_LATENCY_SPI_BURST,	/* one SPI burst from a FIFO */
+	AVIONICS_LATENCY_THREAD_RX,	/* thread start to netif_rx */
+	AVIONICS_LATENCY_RX_RECV,	/* socket enqueue to recvmsg */
+	AVIONICS_LATENCY_MAX
+};
+
+void avionics_device_latency(struct net_device *dev,
+			     enum avionics_device_latency point,
+			     ktime_t start, ktime_t end);
+
+/* Reports a bus health event, see AVIONICS_GENL_NAME, from any
+ * context. Events are coalesced and rate limited, and cost next to
+ * nothing when nobody is listening. */
+void avionics_device_event(struct net_device *dev,
+			   enum avionics_event event);
+
+/* Transmit schedules hold words with a transmit time in the future
+ * until they're due. Packets are passed to release, from either the
+ * caller's context or a timer, as soon as their words can be sent, so
+ * release must not sleep. The packets split off a sent packet stay
+ * owned by its socket, so they can be timestamped like any other. */
+struct avionics_tx_schedule;
+
+struct avionics_tx_schedule *avionics_device_tx_schedule_alloc(
+		struct net_device *dev,
+		void (*release)(struct sk_buff *skb, struct net_device *dev));
+void avionics_device_tx_schedule_free(struct avionics_tx_schedule *schedule);
+void avionics_device_tx_schedule(struct avionics_tx_schedule *schedule,
+				 struct sk_buff *skb);
+
+/* Each port is serviced by one thread, which can be given a real-time
+ * priority and a set of CPUs through IFLA_AVIONICS_THREAD. Ports with
+ * AVIONICS_OPS_WORKER get a kthread_worker, created when the device is
+ * registered and destroyed when it's freed, so all work has to be
+ * cancelled before then. Ports serviced from a threaded interrupt
+ * report it with avionics_device_set_irq, setting it back to 0 before
+ * freeing it, and call avionics_device_thread_update at the top of the
+ * interrupt thread. */
+struct kthread_worker *avionics_device_worker(struct net_device *dev);
+void avionics_device_set_irq(struct net_device *dev, int irq);
+void avionics_device_thread_update(struct net_device *dev);
+
 void * avionics_device_priv(const struct net_device *dev);
 
 int avionics_device_register(struct net_device *dev);
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_SPI_H__
+#define __AVIONICS_SPI_H__
+
+#include <linux/spi/spi.h>
+
+/* A burst is a single SPI message made up of many short transfers, the
+ * way the chips want their FIFOs read and written, with preallocated
+ * buffers that are safe for DMA.
+ *
+ * Transfers are added with avionics_spi_burst_add, which copies the
+ * bytes to send and returns where the bytes read back will be. The
+ * message is then run with avionics_spi_burst_sync, or started with
+ * avionics_spi_burst_submit and collected with avionics_spi_burst_wait.
+ * Drivers that keep two bursts can decode one while the next one is
+ * on the bus.
+ *
+ * A transfer that doesn't fit makes the whole burst fail, with -ENOSPC
+ * from avionics_spi_burst_sync or avionics_spi_burst_submit, until it's
+ * reset. avionics_spi_burst_rx returns NULL for transfers that weren't
+ * added, callers check the last one they expect before decoding. */
+
+struct avionics_spi_burst;
+
+struct avionics_spi_burst *avionics_spi_burst_alloc(struct spi_device *spi,
+						    unsigned int max_xfers,
+						    size_t max_bytes);
+void avionics_spi_burst_free(struct avionics_spi_burst *burst);
+
+void avionics_spi_burst_reset(struct avionics_spi_burst *burst);
+__u8 *avionics_spi_burst_add(struct avionics_spi_burst *burst,
+			     const void *tx, unsigned int len);
+__u8 *avionics_spi_burst_rx(struct avionics_spi_burst *burst,
+			    unsigned int xfer);
+
+int avionics_spi_burst_sync(struct avionics_spi_burst *burst);
+int avionics_spi_burst_submit(struct avionics_spi_burst *burst);
+int avionics_spi_burst_wait(struct avionics_spi_burst *burst);
+
+#endif /* __AVIONICS_SPI_H__ */
@@ -44,6 +44,11 @@
 #define ETH_P_AVIONICS	0x001D
 #endif
 
+/* should be in include/linux/socket.h */
+#ifndef SOL_AVIONICS
+#define SOL_AVIONICS	300
+#endif
+
 /************************************************************************/
 
 
@@ -51,6 +56,7 @@
 
 #define AVIONICS_PROTO_RAW		1
 #define AVIONICS_PROTO_TIMESTAMP	2
+#define AVIONICS_PROTO_RECORD		3
 
 struct __attribute__((__packed__)) avionics_proto_raw_data {
 	__u32 value;		/* data word, format depends on interface type */
@@ -61,6 +67,20 @@ struct __attribute__((__packed__)) avionics_proto_timestamp_data {
 	__u32 value;		/* data word, format depends on interface type */
 };
 
+/* Record protocol, naturally aligned so the records can be read with
+ * vector loads, and tagged with the interface each word was received
+ * on so data from many interfaces can be kept in a single stream. The
+ * ifindex is ignored on transmit. */
+
+#define AVIONICS_RECORD_PRIORITY	(1<<0)	/* priority label register */
+
+struct avionics_proto_record_data {
+	__s64 time_nsecs;	/* epoch time in nano-seconds */
+	__u32 value;		/* data word, format depends on interface type */
+	__u16 flags;		/* AVIONICS_RECORD_* */
+	__u16 ifindex;		/* low 16 bits of the receiving interface */
+};
+
 struct sockaddr_avionics {
 	__kernel_sa_family_t avionics_family;
 	int ifindex;
@@ -69,6 +89,157 @@ struct sockaddr_avionics {
 	} avionics_addr;
 };
 
+/* ====== Control Messages, level SOL_AVIONICS ====== */
+
+/* Transmit timestamps requested with SO_TIMESTAMPING are read from the
+ * error queue with MSG_ERRQUEUE, each comes with a struct
+ * sock_extended_err of this type. The hardware timestamp is when the
+ * packet's last word was loaded into the transmitter. */
+#define AVIONICS_TX_TIMESTAMP		1
+
+/* ====== Socket Options, level SOL_AVIONICS ====== */
+
+#define AVIONICS_RX_RING		1
+#define AVIONICS_RX_COALESCE		2
+#define AVIONICS_RX_FILTER		3
+#define AVIONICS_RX_LABEL_TABLE		4
+#define AVIONICS_RX_DROP_OLDEST		5
+#define AVIONICS_TX_PERIODIC		6
+
+/* Receive ring, the mapping starts with a struct avionics_ring_header
+ * followed by frame_nr struct avionics_proto_timestamp_data records at
+ * the header's offset. The kernel advances head, user space advances
+ * tail once it's done with the records between the two. */
+
+struct avionics_ring_req {
+	__u32 frame_nr;		/* number of records, must be a power of 2 */
+	__u32 threshold;	/* records in the ring before poll wakes */
+};
+
+struct avionics_ring_header {
+	__u32 head;		/* next record written by the kernel */
+	__u32 tail;		/* next record read by user space */
+	__u32 frame_nr;
+	__u32 offset;		/* offset of the first record in bytes */
+	__u32 dropped;		/* records dropped because the ring was full */
+	__u32 padding[3];
+};
+
+/* Receive coalescing, when enabled a single recv will return as many
+ * queued packets as will fit in the buffer. If min_bytes is set recv will
+ * wait for at least that much data, for up to timeout_usecs, or the socket
+ * receive timeout if timeout_usecs is 0. */
+
+struct avionics_rx_coalesce {
+	__u32 enable;
+	__u32 min_bytes;
+	__u32 timeout_usecs;
+};
+
+/* Receive filter, ARINC-429 words that don't match are not delivered to
+ * the socket. The label filters use the same layout as the label filters
+ * in struct avionics_arinc429rx. */
+
+#define AVIONICS_RX_FILTER_LABEL_ENABLE		(1<<0)
+#define AVIONICS_RX_FILTER_SDI_ENABLE		(1<<1)
+
+struct avionics_rx_filter {
+	__u8 flags;
+	__u8 sdi_mask;		/* one bit per SDI value, bit 0 is SDI 0 */
+	__u8 padding[2];
+	__u8 label_filters[32]; /* one bit per label, starting at 0xFF */
+};
+
+/* Drop oldest, an int holding the most packets the socket will queue.
+ * When set a full socket drops the oldest packet it's holding to make
+ * room for a new one, rather than dropping the new packet, so readers
+ * that fall behind see the newest data. Drops are counted per socket
+ * and reported by SO_RXQ_OVFL. 0 restores the default. */
+
+/* Latest value table, one entry per ARINC-429 label and SDI holding the
+ * newest word received on the interface. Setting AVIONICS_RX_LABEL_TABLE
+ * to 1 on a bound socket attaches it to the interface's table, which can
+ * then be read with getsockopt or mapped read only with mmap at
+ * AVIONICS_LABEL_TABLE_OFFSET. Entries are indexed by (sdi << 8) | label,
+ * an entry's sequence is odd while it's being written so readers retry
+ * if it's odd or changes while they copy the entry. */
+
+#define AVIONICS_LABEL_TABLE_ENTRIES	1024
+#define AVIONICS_LABEL_TABLE_OFFSET	0x10000000
+
+struct avionics_label_entry {
+	__u32 sequence;		/* odd while the entry is being updated */
+	__u32 count;		/* number of times the entry was updated */
+	__s64 time_msecs;	/* epoch time in milli-seconds */
+	__u32 value;		/* newest data word */
+	__u32 padding;
+};
+
+struct avionics_label_table {
+	struct avionics_label_entry entries[AVIONICS_LABEL_TABLE_ENTRIES];
+};
+
+/* ARINC-717 transmit frame buffer, mapped with mmap at
+ * AVIONICS_TX_FRAME_OFFSET on a socket bound to a running ARINC-717
+ * transmitter. The mapping starts with a struct avionics_tx_frame_header
+ * followed by two buffers at the header's offset, each holding a whole
+ * superframe with one 12 bit word per __u16. The driver sends from the
+ * active buffer and switches to the pending one when the next subframe
+ * starts. Words sent on the socket are written into both buffers. */
+
+#define AVIONICS_TX_FRAME_OFFSET	0x20000000
+
+struct avionics_tx_frame_header {
+	__u32 words;		/* words in each buffer, four subframes */
+	__u32 offset;		/* offset of the first buffer in bytes */
+	__u32 active;		/* buffer being sent, set by the driver */
+	__u32 pending;		/* buffer to send next, set by user space */
+	__u32 flips;		/* number of times the active buffer changed */
+	__u32 padding[3];
+};
+
+/* Periodic transmit schedule, set with AVIONICS_TX_PERIODIC on a socket
+ * bound to a transmitter as an array of up to AVIONICS_TX_PERIODIC_ENTRIES
+ * entries, replacing the interface's running schedule, an empty array
+ * stops it. Each entry sends the word in its slot every period_usecs,
+ * starting phase_usecs after the schedule is set. The slots are mapped
+ * with mmap at AVIONICS_TX_PERIODIC_OFFSET, one __u32 data word each, so
+ * values can be updated in place without a send. Slots are usually
+ * indexed by (sdi << 8) | label, the same as the label table. */
+
+#define AVIONICS_TX_PERIODIC_ENTRIES	256
+#define AVIONICS_TX_PERIODIC_SLOTS	1024
+#define AVIONICS_TX_PERIODIC_OFFSET	0x30000000
+
+struct avionics_tx_periodic_entry {
+	__u32 period_usecs;	/* 0 disables the entry */
+	__u32 phase_usecs;	/* delay before the first word */
+	__u32 slot;		/* word to send */
+	__u32 padding;
+};
+
+/* MIL-1553 bus monitor packets hold one or more of these records,
+ * each followed by its data words and padded out to a multiple of
+ * 8 bytes, AVIONICS_MIL1553BM_RECORD_SIZE gives the padded size.
+ * time_msecs is when the packet's batch of messages was read, so it's
+ * the same for every record in a packet, time_tag is the only per
+ * message time and counts in whatever resolution the chip's time tag
+ * counter was set up for. */
+
+struct avionics_mil1553bm_record {
+	__s64 time_msecs;	/* epoch time the batch was read */
+	__u16 time_tag[4];	/* chip time tag words, as stored */
+	__u16 block_status;	/* monitor block status word */
+	__u16 command;		/* received command word */
+	__u16 length;		/* number of data words that follow */
+	__u16 padding;
+	__u16 data[];
+};
+
+#define AVIONICS_MIL1553BM_RECORD_SIZE(length)				\
+	((sizeof(struct avionics_mil1553bm_record)			\
+	  + (length)*sizeof(__u16) + 7) & ~7)
+
 #define ARINC429_LABEL(value)		(value & 0x000000ff)
 #define ARINC429_SDI(value)		((value & 0x00000300) >> 8)
 #define ARINC429_DATA(value)		((value & 0x1ffffc00) >> 10)
@@ -81,6 +252,42 @@ struct sockaddr_avionics {
 
 /* ============= Defintions for Netlink (RNTL) Interface =============== */
 
+/* Bus health events are multicast on the "events" group of the
+ * "avionics" generic netlink family. They're coalesced per interface,
+ * each type is sent at most every 100 ms with the number of times it
+ * happened since it was last sent and the time of the first one. */
+
+#define AVIONICS_GENL_NAME		"avionics"
+#define AVIONICS_GENL_VERSION		1
+#define AVIONICS_GENL_MCGRP_EVENTS	"events"
+
+enum {
+	AVIONICS_CMD_UNSPEC,
+	AVIONICS_CMD_EVENT,
+	__AVIONICS_CMD_MAX
+};
+
+enum {
+	AVIONICS_EVENT_ATTR_UNSPEC,
+	AVIONICS_EVENT_ATTR_IFINDEX,	/* __u32 */
+	AVIONICS_EVENT_ATTR_TYPE,	/* __u32, an enum avionics_event */
+	AVIONICS_EVENT_ATTR_COUNT,	/* __u32, times it happened */
+	AVIONICS_EVENT_ATTR_TIME_MSECS,	/* __s64, epoch time of the first */
+	__AVIONICS_EVENT_ATTR_MAX
+};
+
+#define AVIONICS_EVENT_ATTR_MAX	(__AVIONICS_EVENT_ATTR_MAX - 1)
+
+enum avionics_event {
+	AVIONICS_EVENT_RX_OVERFLOW,	/* receive FIFO overflowed */
+	AVIONICS_EVENT_SYNC_LOST,	/* receiver lost frame sync */
+	AVIONICS_EVENT_SYNC_ACQUIRED,	/* receiver found frame sync */
+	AVIONICS_EVENT_PARITY,		/* word received with bad parity */
+	AVIONICS_EVENT_TX_UNDERRUN,	/* transmit FIFO ran empty */
+	AVIONICS_EVENT_DROPPED,		/* packet dropped on a full queue */
+	AVIONICS_EVENT_MAX
+};
+
 struct avionics_rate {
 	__u32 rate_hz;
 };
@@ -114,6 +321,8 @@ struct avionics_arinc429tx {
 #define AVIONICS_ARINC717RX_BPRZ		(1<<0)
 #define AVIONICS_ARINC717RX_NOSYNC		(1<<1)
 #define AVIONICS_ARINC717RX_SFTSYNC		(1<<2)
+#define AVIONICS_ARINC717RX_SUBFRAME		(1<<3) /* one packet per subframe */
+#define AVIONICS_ARINC717RX_SUPERFRAME		(1<<4) /* one packet per superframe */
 
 struct avionics_arinc717rx {
 	__u8 flags;
@@ -133,6 +342,67 @@ struct avionics_mil1553bm {
 	__u8 padding[3];
 };
 
+/* Receive buffers are taken from a pool of preallocated skbs, depth
+ * sets the pool size and empty counts the times the pool ran dry and
+ * a buffer had to be allocated on the receive path. */
+struct avionics_skb_pool {
+	__u32 depth;
+	__u32 empty;
+};
+
+/* Receive polling, with mode ON the receiver is polled every
+ * interval_usecs instead of interrupting. With mode ADAPTIVE it's
+ * polled while more than rate_high words per second are arriving and
+ * goes back to interrupts once it drops below rate_low. The poller is
+ * bound to cpu unless it's negative. */
+#define AVIONICS_RX_POLL_OFF		0
+#define AVIONICS_RX_POLL_ON		1
+#define AVIONICS_RX_POLL_ADAPTIVE	2
+
+struct avionics_rx_poll {
+	__u8 mode;
+	__u8 padding[3];
+	__s32 cpu;
+	__u32 interval_usecs;
+	__u32 rate_high;
+	__u32 rate_low;
+};
+
+/* Scheduling of the thread that services a port, its interrupt thread
+ * or its transmit worker. A priority from 1 to 99 runs it SCHED_FIFO at
+ * that priority, 0 gives it back its default. cpus is a mask of the
+ * CPUs it can run on, and the port's interrupt is steered to them, 0
+ * leaves it where it is. pid is only reported, it stays 0 until an
+ * interrupt thread first runs. */
+struct avionics_thread {
+	__u32 priority;
+	__s32 pid;
+	__u64 cpus;
+};
+
+/* Loop back bus emulation. With rate_hz set words are looped back as
+ * if sent over a bus of that rate, word_bits long including any gap.
+ * Up to fifo_depth words can be waiting to go out, more than that are
+ * dropped and counted in overflows. Received words are handed up in
+ * bursts of coalesce words, or fewer when the bus goes quiet. */
+struct avionics_lb_emulation {
+	__u32 rate_hz;
+	__u32 word_bits;
+	__u32 fifo_depth;
+	__u32 coalesce;
+	__u32 overflows;
+};
+
+/* Receive bursts, the number of words a receiver waits for before it
+ * empties its FIFO. Unless words is set the burst is picked from the
+ * data rate so words wait no longer than latency_usecs, larger bursts
+ * mean fewer wake ups per word. burst reports the burst in use. */
+struct avionics_rx_burst {
+	__u32 latency_usecs;
+	__u32 words;
+	__u32 burst;
+};
+
 enum {
 	IFLA_AVIONICS_UNSPEC,
 	IFLA_AVIONICS_RATE,
@@ -141,6 +411,11 @@ enum {
 	IFLA_AVIONICS_ARINC717RX,
 	IFLA_AVIONICS_ARINC717TX,
 	IFLA_AVIONICS_MIL1553BM,
+	IFLA_AVIONICS_SKB_POOL,
+	IFLA_AVIONICS_RX_POLL,
+	IFLA_AVIONICS_LB_EMULATION,
+	IFLA_AVIONICS_RX_BURST,
+	IFLA_AVIONICS_THREAD,
 	__IFLA_AVIONICS_MAX
 };
 
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM avionics
+
+#if !defined(__AVIONICS_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __AVIONICS_TRACE_H__
+
+#include <linux/tracepoint.h>
+#include <linux/netdevice.h>
+
+#include "avionics-device.h"
+
+TRACE_EVENT(avionics_latency,
+
+	TP_PROTO(const struct net_device *dev, int point, s64 nsecs),
+
+	TP_ARGS(dev, point, nsecs),
+
+	TP_STRUCT__entry(
+		__array(char, name, IFNAMSIZ)
+		__field(int, point)
+		__field(s64, nsecs)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->name, dev->name, IFNAMSIZ);
+		__entry->point = point;
+		__entry->nsecs = nsecs;
+	),
+
+	TP_printk("dev=%s point=%s nsecs=%lld", __entry->name,
+		  __print_symbolic(__entry->point,
+			{ AVIONICS_LATENCY_IRQ_THREAD, "irq_thread" },
+			{ AVIONICS_LATENCY_SPI_BURST, "spi_burst" },
+			{ AVIONICS_LATENCY_THREAD_RX, "thread_rx" },
+			{ AVIONICS_LATENCY_RX_RECV, "rx_recv" }),
+		  __entry->nsecs)
+);
+
+#endif /* __AVIONICS_TRACE_H__ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE avionics-trace
+#include <trace/define_trace.h>
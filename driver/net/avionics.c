@@ -25,6 +25,8 @@
 
 #include "protocol-raw.h"
 #include "protocol-timestamp.h"
+#include "protocol-record.h"
+#include "protocol.h"
 #include "socket-list.h"
 #include "avionics.h"
 #include "device.h"
@@ -39,6 +41,8 @@ MODULE_ALIAS_NETPROTO(PF_AVIONICS);
 static void avionics_sock_destruct(struct sock *sk)
 {
 	skb_queue_purge(&sk->sk_receive_queue);
+	skb_queue_purge(&sk->sk_error_queue);
+	protocol_destruct(sk);
 }
 
 static int avionics_sock_create(struct net *net, struct socket *sock,
@@ -67,6 +71,11 @@ static int avionics_sock_create(struct net *net, struct socket *sock,
 		p = protocol_timestamp_get();
 		break;
 
+	case AVIONICS_PROTO_RECORD:
+		popts = protocol_record_get_ops();
+		p = protocol_record_get();
+		break;
+
 	default:
 		pr_err("avionics: Invalid protocol %d\n", protocol);
 		return -EPROTONOSUPPORT;
@@ -81,6 +90,7 @@ static int avionics_sock_create(struct net *net, struct socket *sock,
 	}
 
 	sock_init_data(sock, sk);
+	sk->sk_protocol = protocol;
 	sk->sk_destruct = avionics_sock_destruct;
 
 	if (sk->sk_prot->init) {
@@ -121,6 +131,11 @@ static int avionics_netdev_notifier(struct notifier_block *nb,
 		socket_list_add(dev);
 		break;
 
+	case NETDEV_DOWN:
+		/* senders waiting for the queue give up */
+		device_tx_wake_all(dev);
+		break;
+
 	case NETDEV_UNREGISTER:
 		pr_info("avionics: Unregistering device %s.\n", dev->name);
 		socket_list_remove(dev);
@@ -19,18 +19,406 @@
 #include <linux/net.h>
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/interrupt.h>
+#include <linux/rtnetlink.h>
+#include <linux/wait.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+#include <linux/sched.h>
+#else
+#include <linux/sched/signal.h>
+#include <linux/sched/types.h>
+#endif
 #include <net/sock.h>
 
 #include "avionics.h"
 #include "protocol.h"
+#include "device.h"
+#include "rx-poll.h"
+#include "tx-periodic.h"
+#include "event.h"
 #include "avionics-device.h"
 
+#define CREATE_TRACE_POINTS
+#include "avionics-trace.h"
+
+#define DEVICE_POOL_DEPTH	8
+#define DEVICE_POOL_DEPTH_MAX	1024
+
+/* each type of event is sent at most this often per device */
+#define DEVICE_EVENT_INTERVAL_MSECS	100
+
+/* latencies are counted in power of two nanosecond buckets, the last
+ * one holds anything over a second */
+#define DEVICE_LATENCY_BUCKETS	31
+
+/* Receive skbs are taken from a per-device pool that's topped up from
+ * a work item, so the receive path normally never calls the
+ * allocator. The buffers are the MTU unless the driver set a size. */
+struct device_pool {
+	struct sk_buff_head skbs;
+	struct work_struct refill;
+	unsigned int depth;
+	unsigned int size;
+	atomic_t empty;
+};
+
+/* Events are counted as they happen and sent from a work item, so
+ * drivers can report them from any context. */
+struct device_events {
+	spinlock_t lock;
+	struct delayed_work work;
+	unsigned long sent[AVIONICS_EVENT_MAX];
+	__u32 pending[AVIONICS_EVENT_MAX];
+	__s64 first_msecs[AVIONICS_EVENT_MAX];
+};
+
+struct device_stats {
+	u64 rx_packets;
+	u64 rx_bytes;
+	u64 tx_packets;
+	u64 tx_bytes;
+	struct u64_stats_sync syncp;
+	u64 latency[AVIONICS_LATENCY_MAX][DEVICE_LATENCY_BUCKETS];
+};
+
 struct device_priv {
 	struct net_device *dev;
 	struct avionics_ops *ops;
+	struct device_pool pool;
+	struct device_events events;
+	struct device_stats __percpu *stats;
+	struct dentry *debugfs;
+	struct rx_poll *rx_poll;
+	struct avionics_rx_poll rx_poll_config;
+	struct tx_periodic *tx_periodic;
+	wait_queue_head_t tx_wait;
+	struct kthread_worker *worker;
+	struct avionics_thread thread;
+	struct cpumask thread_cpus;
+	atomic_t thread_gen;
+	int thread_applied;
+	int irq;
 	__u8 private[0];
 };
 
+static unsigned int device_pool_size(struct net_device *dev,
+				     struct device_pool *pool)
+{
+	unsigned int size = READ_ONCE(pool->size);
+
+	return size ? size : dev->mtu;
+}
+
+static void device_pool_fill(struct net_device *dev, struct device_pool *pool)
+{
+	struct sk_buff *skb;
+
+	while (skb_queue_len(&pool->skbs) < READ_ONCE(pool->depth)) {
+		skb = alloc_skb(device_pool_size(dev, pool), GFP_KERNEL);
+		if (!skb) {
+			pr_err("avionics-device: Unable to fill skbuff pool\n");
+			return;
+		}
+		skb_queue_tail(&pool->skbs, skb);
+	}
+}
+
+static void device_pool_refill(struct work_struct *work)
+{
+	struct device_pool *pool;
+	struct device_priv *priv;
+
+	pool = container_of(work, struct device_pool, refill);
+	priv = container_of(pool, struct device_priv, pool);
+
+	device_pool_fill(priv->dev, pool);
+}
+
+static void device_pool_trim(struct device_pool *pool)
+{
+	struct sk_buff *skb;
+
+	while (skb_queue_len(&pool->skbs) > READ_ONCE(pool->depth)) {
+		skb = skb_dequeue(&pool->skbs);
+		if (!skb) {
+			break;
+		}
+		kfree_skb(skb);
+	}
+}
+
+static struct sk_buff *device_pool_get(struct net_device *dev,
+				       struct device_pool *pool,
+				       unsigned int size)
+{
+	struct sk_buff *skb;
+
+	if (!READ_ONCE(pool->depth)) {
+		return NULL;
+	}
+
+	/* packets bigger than the pool's buffers, like whole ARINC-717
+	 * frames, are always allocated, there's no point throwing a
+	 * buffer away for them */
+	if (size > device_pool_size(dev, pool)) {
+		return NULL;
+	}
+
+	skb = skb_dequeue(&pool->skbs);
+
+	if (skb_queue_len(&pool->skbs) <= (pool->depth / 2)) {
+		schedule_work(&pool->refill);
+	}
+
+	/* buffers allocated before an MTU change may still be too small */
+	if (skb && (skb_tailroom(skb) < size)) {
+		kfree_skb(skb);
+		skb = NULL;
+	}
+
+	if (!skb) {
+		atomic_inc(&pool->empty);
+	}
+
+	return skb;
+}
+
+/* Sends every event that's waiting and due, and comes back for the
+ * ones that are still being held back. */
+static void device_events_send(struct work_struct *work)
+{
+	struct device_events *events;
+	struct device_priv *priv;
+	unsigned long interval, due, next = 0;
+	unsigned long flags;
+	__u32 count;
+	__s64 first_msecs;
+	int i;
+
+	events = container_of(to_delayed_work(work), struct device_events,
+			      work);
+	priv = container_of(events, struct device_priv, events);
+	interval = msecs_to_jiffies(DEVICE_EVENT_INTERVAL_MSECS);
+
+	for (i = 0; i < AVIONICS_EVENT_MAX; i++) {
+		spin_lock_irqsave(&events->lock, flags);
+
+		count = events->pending[i];
+		first_msecs = events->first_msecs[i];
+		due = events->sent[i] + interval;
+
+		if (count && time_before(jiffies, due)) {
+			if (!next || time_before(due, next)) {
+				next = due;
+			}
+			count = 0;
+		} else if (count) {
+			events->pending[i] = 0;
+			events->sent[i] = jiffies;
+		}
+
+		spin_unlock_irqrestore(&events->lock, flags);
+
+		if (count) {
+			event_send(priv->dev, i, count, first_msecs);
+		}
+	}
+
+	if (next) {
+		schedule_delayed_work(&events->work,
+				      time_after(next, jiffies) ?
+				      next - jiffies : 0);
+	}
+}
+
+static void device_events_init(struct device_events *events)
+{
+	unsigned long start;
+	int i;
+
+	spin_lock_init(&events->lock);
+	INIT_DELAYED_WORK(&events->work, device_events_send);
+
+	/* the first of each event goes out straight away */
+	start = jiffies - msecs_to_jiffies(DEVICE_EVENT_INTERVAL_MSECS);
+	for (i = 0; i < AVIONICS_EVENT_MAX; i++) {
+		events->sent[i] = start;
+	}
+}
+
+static struct dentry *device_debugfs;
+
+static const char * const device_latency_names[AVIONICS_LATENCY_MAX] = {
+	[AVIONICS_LATENCY_IRQ_THREAD] = "irq_thread",
+	[AVIONICS_LATENCY_SPI_BURST] = "spi_burst",
+	[AVIONICS_LATENCY_THREAD_RX] = "thread_rx",
+	[AVIONICS_LATENCY_RX_RECV] = "rx_recv",
+};
+
+static int device_latency_show(struct seq_file *m, void *v)
+{
+	struct device_priv *priv = m->private;
+	u64 counts[DEVICE_LATENCY_BUCKETS];
+	int cpu, i, j;
+
+	for (i = 0; i < AVIONICS_LATENCY_MAX; i++) {
+		memset(counts, 0, sizeof(counts));
+
+		for_each_possible_cpu(cpu) {
+			struct device_stats *stats;
+
+			stats = per_cpu_ptr(priv->stats, cpu);
+			for (j = 0; j < DEVICE_LATENCY_BUCKETS; j++) {
+				counts[j] += READ_ONCE(stats->latency[i][j]);
+			}
+		}
+
+		seq_printf(m, "%s:\n", device_latency_names[i]);
+
+		for (j = 0; j < DEVICE_LATENCY_BUCKETS; j++) {
+			if (!counts[j]) {
+				continue;
+			}
+
+			if (j == (DEVICE_LATENCY_BUCKETS - 1)) {
+				seq_printf(m, "  >= %llu ns: %llu\n",
+					   1ULL << j, counts[j]);
+			} else {
+				seq_printf(m, "  < %llu ns: %llu\n",
+					   1ULL << (j + 1), counts[j]);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int device_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, device_latency_show, inode->i_private);
+}
+
+static const struct file_operations device_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= device_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Sets the scheduling of one of the threads servicing a port, an
+ * interrupt thread goes back to the kernel's default for those rather
+ * than to SCHED_NORMAL. */
+static void device_thread_sched(struct task_struct *task, __u32 priority,
+				bool irq_thread)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+	struct sched_param param = { .sched_priority = priority };
+	int policy = SCHED_FIFO;
+	int err;
+
+	if (!priority) {
+		if (irq_thread) {
+			param.sched_priority = MAX_USER_RT_PRIO/2;
+		} else {
+			policy = SCHED_NORMAL;
+		}
+	}
+
+	err = sched_setscheduler_nocheck(task, policy, &param);
+#else
+	struct sched_attr attr = {
+		.size = sizeof(attr),
+		.sched_policy = SCHED_FIFO,
+		.sched_priority = priority,
+	};
+	int err;
+
+	if (!priority) {
+		if (irq_thread) {
+			sched_set_fifo(task);
+		} else {
+			sched_set_normal(task, 0);
+		}
+		return;
+	}
+
+	err = sched_setattr_nocheck(task, &attr);
+#endif
+	if (err) {
+		pr_warn("avionics-device: Failed to set thread priority %u:"
+			" %d\n", priority, err);
+	}
+}
+
+static int device_thread_check(const struct avionics_thread *thread)
+{
+	int cpu;
+
+	if (thread->priority >= MAX_RT_PRIO) {
+		pr_err("avionics-device: Thread priority %u must be less"
+		       " than %d\n", thread->priority, MAX_RT_PRIO);
+		return -EINVAL;
+	}
+
+	if (!thread->cpus) {
+		return 0;
+	}
+
+	for (cpu = 0; (cpu < BITS_PER_TYPE(thread->cpus))
+	     && (cpu < nr_cpu_ids); cpu++) {
+		if ((thread->cpus & (1ULL << cpu)) && cpu_online(cpu)) {
+			return 0;
+		}
+	}
+
+	pr_err("avionics-device: No CPUs online in mask 0x%llx\n",
+	       thread->cpus);
+	return -EINVAL;
+}
+
+/* Applies the thread settings to the worker and interrupt, an
+ * interrupt thread picks up its priority the next time it runs. */
+static void device_thread_apply(struct device_priv *priv)
+{
+	struct task_struct *task;
+	int cpu;
+
+	ASSERT_RTNL();
+
+	cpumask_clear(&priv->thread_cpus);
+	for (cpu = 0; (cpu < BITS_PER_TYPE(priv->thread.cpus))
+	     && (cpu < nr_cpu_ids); cpu++) {
+		if (priv->thread.cpus & (1ULL << cpu)) {
+			cpumask_set_cpu(cpu, &priv->thread_cpus);
+		}
+	}
+
+	if (priv->worker) {
+		task = priv->worker->task;
+
+		device_thread_sched(task, priv->thread.priority, false);
+		set_cpus_allowed_ptr(task, priv->thread.cpus ?
+				     &priv->thread_cpus : cpu_possible_mask);
+		WRITE_ONCE(priv->thread.pid, task_pid_nr(task));
+	}
+
+	/* the interrupt thread follows its interrupt's affinity */
+	if (priv->irq) {
+		irq_set_affinity_hint(priv->irq, priv->thread.cpus ?
+				      &priv->thread_cpus : NULL);
+	}
+
+	atomic_inc(&priv->thread_gen);
+}
+
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(4,13,0)
 static int device_changelink(struct net_device *dev,
 			     struct nlattr *tb[], struct nlattr *data[])
@@ -44,6 +432,88 @@ static int device_changelink(struct net_device *dev,
 
 	ASSERT_RTNL();
 
+	if (data[IFLA_AVIONICS_SKB_POOL]) {
+		struct avionics_skb_pool pool;
+
+		memcpy(&pool, nla_data(data[IFLA_AVIONICS_SKB_POOL]),
+		       sizeof(pool));
+
+		if (pool.depth > DEVICE_POOL_DEPTH_MAX) {
+			pr_err("avionics-device: Pool depth %u larger than %d\n",
+			       pool.depth, DEVICE_POOL_DEPTH_MAX);
+			return -EINVAL;
+		}
+
+		WRITE_ONCE(priv->pool.depth, pool.depth);
+		device_pool_trim(&priv->pool);
+		schedule_work(&priv->pool.refill);
+	}
+
+	if (data[IFLA_AVIONICS_RX_POLL]) {
+		struct avionics_rx_poll config;
+		struct rx_poll *poll;
+		int err;
+
+		if (!priv->ops || !priv->ops->rx_poll || !priv->ops->rx_irq) {
+			pr_err("avionics-device: Device can't be polled\n");
+			return -EOPNOTSUPP;
+		}
+
+		memcpy(&config, nla_data(data[IFLA_AVIONICS_RX_POLL]),
+		       sizeof(config));
+
+		err = rx_poll_check(&config);
+		if (err) {
+			return err;
+		}
+
+		/* the old poller has to give the interrupt back before a
+		 * new one can take it */
+		rx_poll_stop(priv->rx_poll);
+		priv->rx_poll = NULL;
+		priv->rx_poll_config.mode = AVIONICS_RX_POLL_OFF;
+
+		if (config.mode != AVIONICS_RX_POLL_OFF) {
+			poll = rx_poll_start(dev, priv->ops, &config);
+			if (IS_ERR(poll)) {
+				return PTR_ERR(poll);
+			}
+			priv->rx_poll = poll;
+		}
+
+		memcpy(&priv->rx_poll_config, &config, sizeof(config));
+	}
+
+	if (data[IFLA_AVIONICS_THREAD]) {
+		struct avionics_thread thread;
+		int err;
+
+		memcpy(&thread, nla_data(data[IFLA_AVIONICS_THREAD]),
+		       sizeof(thread));
+
+		err = device_thread_check(&thread);
+		if (err) {
+			return err;
+		}
+
+		priv->thread.priority = thread.priority;
+		priv->thread.cpus = thread.cpus;
+		device_thread_apply(priv);
+	}
+
+	if (data[IFLA_AVIONICS_RX_BURST] && priv->ops &&
+	    priv->ops->set_rx_burst) {
+		struct avionics_rx_burst rx_burst;
+		int err;
+
+		memcpy(&rx_burst, nla_data(data[IFLA_AVIONICS_RX_BURST]),
+		       sizeof(rx_burst));
+		err = priv->ops->set_rx_burst(&rx_burst, dev);
+		if (err) {
+			return err;
+		}
+	}
+
 	if (data[IFLA_AVIONICS_RATE] && priv->ops &&
 	    priv->ops->set_rate) {
 		struct avionics_rate rate;
@@ -105,6 +575,17 @@ static size_t device_get_size(const struct net_device *dev)
 	struct device_priv *priv = netdev_priv(dev);
 	size_t size = 0;
 
+	size += nla_total_size(sizeof(struct avionics_skb_pool));
+	size += nla_total_size(sizeof(struct avionics_thread));
+
+	if(priv->ops && priv->ops->rx_poll) {
+		size += nla_total_size(sizeof(struct avionics_rx_poll));
+	}
+
+	if(priv->ops && priv->ops->get_rx_burst) {
+		size += nla_total_size(sizeof(struct avionics_rx_burst));
+	}
+
 	if(priv->ops && priv->ops->set_rate) {
 		size += nla_total_size(sizeof(struct avionics_rate));
 	}
@@ -135,8 +616,47 @@ static size_t device_get_size(const struct net_device *dev)
 static int device_fill_info(struct sk_buff *skb, const struct net_device *dev)
 {
 	struct device_priv *priv = netdev_priv(dev);
+	struct avionics_skb_pool pool;
+	struct avionics_thread thread;
 	int err;
 
+	pool.depth = priv->pool.depth;
+	pool.empty = atomic_read(&priv->pool.empty);
+
+	err = nla_put(skb, IFLA_AVIONICS_SKB_POOL, sizeof(pool), &pool);
+	if (err) {
+		return -EMSGSIZE;
+	}
+
+	thread.priority = priv->thread.priority;
+	thread.pid = READ_ONCE(priv->thread.pid);
+	thread.cpus = priv->thread.cpus;
+
+	err = nla_put(skb, IFLA_AVIONICS_THREAD, sizeof(thread), &thread);
+	if (err) {
+		return -EMSGSIZE;
+	}
+
+	if (priv->ops && priv->ops->rx_poll) {
+		err = nla_put(skb, IFLA_AVIONICS_RX_POLL,
+			      sizeof(priv->rx_poll_config),
+			      &priv->rx_poll_config);
+		if (err) {
+			return -EMSGSIZE;
+		}
+	}
+
+	if (priv->ops && priv->ops->get_rx_burst) {
+		struct avionics_rx_burst rx_burst;
+		priv->ops->get_rx_burst(&rx_burst, dev);
+
+		err = nla_put(skb, IFLA_AVIONICS_RX_BURST,
+			      sizeof(rx_burst), &rx_burst);
+		if (err) {
+			return -EMSGSIZE;
+		}
+	}
+
 	if (priv->ops && priv->ops->get_rate) {
 		struct avionics_rate rate;
 		priv->ops->get_rate(&rate, dev);
@@ -239,6 +759,18 @@ static const struct nla_policy device_policy[IFLA_AVIONICS_MAX + 1] = {
 	[IFLA_AVIONICS_MIL1553BM] = {
 		.len = sizeof(struct avionics_mil1553bm)
 	},
+	[IFLA_AVIONICS_SKB_POOL] = {
+		.len = sizeof(struct avionics_skb_pool)
+	},
+	[IFLA_AVIONICS_RX_POLL] = {
+		.len = sizeof(struct avionics_rx_poll)
+	},
+	[IFLA_AVIONICS_RX_BURST] = {
+		.len = sizeof(struct avionics_rx_burst)
+	},
+	[IFLA_AVIONICS_THREAD] = {
+		.len = sizeof(struct avionics_thread)
+	},
 };
 
 static void device_setup(struct net_device *dev)
@@ -265,12 +797,241 @@ static struct rtnl_link_ops device_link_ops __read_mostly = {
 
 int device_netlink_register(void)
 {
-	return rtnl_link_register(&device_link_ops);
+	int err;
+
+	/* debugfs is only for debugging, carry on without it */
+	device_debugfs = debugfs_create_dir("avionics", NULL);
+
+	err = event_register();
+	if (err) {
+		pr_err("avionics-device: Failed to register events: %d\n",
+		       err);
+		debugfs_remove_recursive(device_debugfs);
+		return err;
+	}
+
+	err = rtnl_link_register(&device_link_ops);
+	if (err) {
+		event_unregister();
+		debugfs_remove_recursive(device_debugfs);
+		return err;
+	}
+
+	return 0;
 }
 
 void device_netlink_unregister(void)
 {
 	rtnl_link_unregister(&device_link_ops);
+	event_unregister();
+	debugfs_remove_recursive(device_debugfs);
+}
+
+__u64 device_rx_bytes(struct net_device *dev)
+{
+	struct device_priv *priv = netdev_priv(dev);
+	struct device_stats *stats;
+	unsigned int start;
+	__u64 rx_bytes, total = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(priv->stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&stats->syncp);
+			rx_bytes = stats->rx_bytes;
+		} while (u64_stats_fetch_retry(&stats->syncp, start));
+		total += rx_bytes;
+	}
+
+	return total;
+}
+
+int device_tx_mmap(struct net_device *dev, struct vm_area_struct *vma)
+{
+	struct device_priv *priv;
+
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return -ENODEV;
+	}
+
+	priv = netdev_priv(dev);
+	if (!priv->ops || !priv->ops->tx_mmap) {
+		pr_err("avionics-device: %s has no transmit buffer to map\n",
+		       dev->name);
+		return -ENODEV;
+	}
+
+	return priv->ops->tx_mmap(dev, vma);
+}
+
+/* Most devices never have a periodic schedule, so it's only allocated
+ * the first time one is used, and then kept until the device is freed
+ * since its slots may be mapped. */
+static struct tx_periodic *device_tx_periodic(struct net_device *dev)
+{
+	struct device_priv *priv;
+	struct tx_periodic *periodic;
+
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return ERR_PTR(-ENODEV);
+	}
+
+	if (!dev->netdev_ops->ndo_start_xmit) {
+		pr_err("avionics-device: %s isn't a transmitter\n", dev->name);
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	priv = netdev_priv(dev);
+
+	periodic = READ_ONCE(priv->tx_periodic);
+	if (periodic) {
+		return periodic;
+	}
+
+	periodic = tx_periodic_alloc(dev);
+	if (!periodic) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* lost the race with another socket, use its schedule */
+	if (cmpxchg(&priv->tx_periodic, NULL, periodic)) {
+		tx_periodic_free(periodic);
+	}
+
+	return priv->tx_periodic;
+}
+
+int device_tx_periodic_set(struct net_device *dev,
+			   const struct avionics_tx_periodic_entry *config,
+			   int count)
+{
+	struct tx_periodic *periodic;
+
+	periodic = device_tx_periodic(dev);
+	if (IS_ERR(periodic)) {
+		return PTR_ERR(periodic);
+	}
+
+	return tx_periodic_set(periodic, config, count);
+}
+
+int device_tx_periodic_get(struct net_device *dev,
+			   struct avionics_tx_periodic_entry *config, int max)
+{
+	struct device_priv *priv;
+	struct tx_periodic *periodic;
+
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return -ENODEV;
+	}
+
+	priv = netdev_priv(dev);
+
+	periodic = READ_ONCE(priv->tx_periodic);
+	if (!periodic) {
+		return 0;
+	}
+
+	return tx_periodic_get(periodic, config, max);
+}
+
+int device_tx_periodic_mmap(struct net_device *dev, struct vm_area_struct *vma)
+{
+	struct tx_periodic *periodic;
+
+	periodic = device_tx_periodic(dev);
+	if (IS_ERR(periodic)) {
+		return PTR_ERR(periodic);
+	}
+
+	return tx_periodic_mmap(periodic, vma);
+}
+
+int device_tx_wait(struct net_device *dev, long *timeo)
+{
+	struct device_priv *priv;
+	long left;
+
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return 0;
+	}
+
+	priv = netdev_priv(dev);
+
+	left = wait_event_interruptible_timeout(priv->tx_wait,
+			!netif_queue_stopped(dev) || !netif_running(dev),
+			*timeo);
+	if (left < 0) {
+		return sock_intr_errno(*timeo);
+	}
+
+	*timeo = left;
+
+	if (!left) {
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+void device_tx_wake_all(struct net_device *dev)
+{
+	struct device_priv *priv;
+
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return;
+	}
+
+	priv = netdev_priv(dev);
+	wake_up_interruptible_all(&priv->tx_wait);
+}
+
+bool device_rx_packets(const struct net_device *dev)
+{
+	struct device_priv *priv;
+
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return false;
+	}
+
+	priv = netdev_priv(dev);
+
+	return priv->ops && (priv->ops->flags & AVIONICS_OPS_PACKETS);
+}
+
+void device_rx_busy_poll(struct net_device *dev, struct sock *sk,
+			 unsigned int usecs)
+{
+	struct device_priv *priv;
+	ktime_t end;
+
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return;
+	}
+
+	priv = netdev_priv(dev);
+	if (!priv->ops || !priv->ops->rx_poll) {
+		return;
+	}
+
+	end = ktime_add_us(ktime_get(), usecs);
+
+	do {
+		if (priv->ops->rx_poll(dev) < 0) {
+			break;
+		}
+
+		if (!skb_queue_empty(&sk->sk_receive_queue)) {
+			break;
+		}
+
+		if (signal_pending(current) || need_resched()) {
+			break;
+		}
+
+		cpu_relax();
+	} while (ktime_before(ktime_get(), end));
 }
 
 /* ====================================================== */
@@ -278,21 +1039,238 @@ void device_netlink_unregister(void)
 struct sk_buff* avionics_device_alloc_skb(struct net_device *dev,
 					  unsigned int size)
 {
-	struct sk_buff *skb;
+	struct device_priv *priv;
+	struct sk_buff *skb = NULL;
+
+	if (dev->rtnl_link_ops == &device_link_ops) {
+		priv = netdev_priv(dev);
+		skb = device_pool_get(dev, &priv->pool, size);
+	}
 
-	skb = alloc_skb(size, GFP_KERNEL);
 	if (!skb) {
-		pr_err("avionics-device: Unable to allocate skbuff\n");
-		return NULL;
+		skb = alloc_skb(size, GFP_KERNEL);
+		if (!skb) {
+			pr_err("avionics-device: Unable to allocate skbuff\n");
+			return NULL;
+		}
 	}
 
 	protocol_init_skb(dev, skb);
-	skb->len = size;
+	skb_put(skb, size);
 
 	return skb;
 }
 EXPORT_SYMBOL_GPL(avionics_device_alloc_skb);
 
+void avionics_device_set_rx_size(struct net_device *dev, unsigned int size)
+{
+	struct device_priv *priv = netdev_priv(dev);
+
+	WRITE_ONCE(priv->pool.size, size);
+}
+EXPORT_SYMBOL_GPL(avionics_device_set_rx_size);
+
+void avionics_device_rx_tstamp(struct sk_buff *skb, ktime_t time)
+{
+	skb_hwtstamps(skb)->hwtstamp = time;
+	skb->tstamp = time;
+}
+EXPORT_SYMBOL_GPL(avionics_device_rx_tstamp);
+
+void avionics_device_tx_tstamp(struct sk_buff *skb, ktime_t time)
+{
+	struct skb_shared_hwtstamps hwtstamps;
+	__u8 flags = skb_shinfo(skb)->tx_flags;
+
+	if (flags & SKBTX_HW_TSTAMP) {
+		memset(&hwtstamps, 0, sizeof(hwtstamps));
+		hwtstamps.hwtstamp = time;
+		skb_tstamp_tx(skb, &hwtstamps);
+	}
+
+	if (flags & SKBTX_SW_TSTAMP) {
+		skb_tstamp_tx(skb, NULL);
+	}
+}
+EXPORT_SYMBOL_GPL(avionics_device_tx_tstamp);
+
+void avionics_device_tx_wake(struct net_device *dev)
+{
+	struct device_priv *priv = netdev_priv(dev);
+
+	netif_wake_queue(dev);
+	wake_up_interruptible_all(&priv->tx_wait);
+}
+EXPORT_SYMBOL_GPL(avionics_device_tx_wake);
+
+void avionics_device_rx_stats(struct net_device *dev, unsigned int bytes)
+{
+	struct device_priv *priv = netdev_priv(dev);
+	struct device_stats *stats;
+
+	stats = get_cpu_ptr(priv->stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->rx_packets++;
+	stats->rx_bytes += bytes;
+	u64_stats_update_end(&stats->syncp);
+	put_cpu_ptr(priv->stats);
+}
+EXPORT_SYMBOL_GPL(avionics_device_rx_stats);
+
+void avionics_device_tx_stats(struct net_device *dev, unsigned int packets,
+			      unsigned int bytes)
+{
+	struct device_priv *priv = netdev_priv(dev);
+	struct device_stats *stats;
+
+	stats = get_cpu_ptr(priv->stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->tx_packets += packets;
+	stats->tx_bytes += bytes;
+	u64_stats_update_end(&stats->syncp);
+	put_cpu_ptr(priv->stats);
+}
+EXPORT_SYMBOL_GPL(avionics_device_tx_stats);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+struct rtnl_link_stats64 *avionics_device_get_stats64(struct net_device *dev,
+					struct rtnl_link_stats64 *stats)
+#else
+void avionics_device_get_stats64(struct net_device *dev,
+				 struct rtnl_link_stats64 *stats)
+#endif
+{
+	struct device_priv *priv = netdev_priv(dev);
+	struct device_stats *cpu_stats;
+	u64 rx_packets, rx_bytes, tx_packets, tx_bytes;
+	unsigned int start;
+	int cpu;
+
+	netdev_stats_to_stats64(stats, &dev->stats);
+
+	for_each_possible_cpu(cpu) {
+		cpu_stats = per_cpu_ptr(priv->stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&cpu_stats->syncp);
+			rx_packets = cpu_stats->rx_packets;
+			rx_bytes = cpu_stats->rx_bytes;
+			tx_packets = cpu_stats->tx_packets;
+			tx_bytes = cpu_stats->tx_bytes;
+		} while (u64_stats_fetch_retry(&cpu_stats->syncp, start));
+
+		stats->rx_packets += rx_packets;
+		stats->rx_bytes += rx_bytes;
+		stats->tx_packets += tx_packets;
+		stats->tx_bytes += tx_bytes;
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+	return stats;
+#endif
+}
+EXPORT_SYMBOL_GPL(avionics_device_get_stats64);
+
+void avionics_device_latency(struct net_device *dev,
+			     enum avionics_device_latency point,
+			     ktime_t start, ktime_t end)
+{
+	struct device_priv *priv;
+	s64 nsecs;
+	int bucket;
+
+	/* the socket layer records latencies for any device */
+	if (dev->rtnl_link_ops != &device_link_ops) {
+		return;
+	}
+	priv = netdev_priv(dev);
+
+	nsecs = ktime_to_ns(ktime_sub(end, start));
+	if (nsecs <= 0) {
+		bucket = 0;
+	} else {
+		bucket = min_t(int, ilog2(nsecs), DEVICE_LATENCY_BUCKETS - 1);
+	}
+
+	this_cpu_inc(priv->stats->latency[point][bucket]);
+
+	trace_avionics_latency(dev, point, nsecs);
+}
+EXPORT_SYMBOL_GPL(avionics_device_latency);
+
+void avionics_device_event(struct net_device *dev,
+			   enum avionics_event event)
+{
+	struct device_priv *priv = netdev_priv(dev);
+	struct device_events *events = &priv->events;
+	unsigned long flags, due;
+
+	if ((event >= AVIONICS_EVENT_MAX) || !event_listening()) {
+		return;
+	}
+
+	spin_lock_irqsave(&events->lock, flags);
+
+	if (!events->pending[event]) {
+		events->first_msecs[event] = ktime_to_ms(ktime_get_real());
+	}
+	events->pending[event]++;
+
+	due = events->sent[event]
+	      + msecs_to_jiffies(DEVICE_EVENT_INTERVAL_MSECS);
+
+	spin_unlock_irqrestore(&events->lock, flags);
+
+	/* work that's already waiting comes back for anything it has to
+	 * hold, but an event that's due shouldn't wait behind it */
+	if (time_after(due, jiffies)) {
+		schedule_delayed_work(&events->work, due - jiffies);
+	} else {
+		mod_delayed_work(system_wq, &events->work, 0);
+	}
+}
+EXPORT_SYMBOL_GPL(avionics_device_event);
+
+struct kthread_worker *avionics_device_worker(struct net_device *dev)
+{
+	struct device_priv *priv = netdev_priv(dev);
+
+	return priv->worker;
+}
+EXPORT_SYMBOL_GPL(avionics_device_worker);
+
+void avionics_device_set_irq(struct net_device *dev, int irq)
+{
+	struct device_priv *priv = netdev_priv(dev);
+
+	rtnl_lock();
+
+	if (priv->irq) {
+		irq_set_affinity_hint(priv->irq, NULL);
+	}
+
+	priv->irq = irq;
+	device_thread_apply(priv);
+
+	rtnl_unlock();
+}
+EXPORT_SYMBOL_GPL(avionics_device_set_irq);
+
+void avionics_device_thread_update(struct net_device *dev)
+{
+	struct device_priv *priv = netdev_priv(dev);
+	int gen;
+
+	gen = atomic_read(&priv->thread_gen);
+	if (likely(gen == priv->thread_applied)) {
+		return;
+	}
+	priv->thread_applied = gen;
+
+	device_thread_sched(current, READ_ONCE(priv->thread.priority), true);
+	WRITE_ONCE(priv->thread.pid, task_pid_nr(current));
+}
+EXPORT_SYMBOL_GPL(avionics_device_thread_update);
+
 void * avionics_device_priv(const struct net_device *dev)
 {
 	struct device_priv *priv;
@@ -308,22 +1286,65 @@ EXPORT_SYMBOL_GPL(avionics_device_priv);
 
 int avionics_device_register(struct net_device *dev)
 {
+	struct device_priv *priv = netdev_priv(dev);
+	struct kthread_worker *worker;
 	int err;
-	err = register_netdev(dev);
+
+	/* the worker is named after the device, and has to be there
+	 * before anything can open it */
+	rtnl_lock();
+
+	err = register_netdevice(dev);
 	if (err) {
+		rtnl_unlock();
 		pr_err("avionics-device: Failed to register netdev\n");
 		return err;
 	}
 
+	if (priv->ops->flags & AVIONICS_OPS_WORKER) {
+		worker = kthread_create_worker(0, "avionics/%s",
+					       dev->name);
+		if (IS_ERR(worker)) {
+			unregister_netdevice(dev);
+			rtnl_unlock();
+			pr_err("avionics-device: Failed to create worker\n");
+			return PTR_ERR(worker);
+		}
+
+		priv->worker = worker;
+		device_thread_apply(priv);
+	}
+
 	dev->rtnl_link_ops = &device_link_ops;
+
+	rtnl_unlock();
+
+	device_pool_fill(dev, &priv->pool);
+
+	priv->debugfs = debugfs_create_dir(dev->name, device_debugfs);
+	debugfs_create_file("latency", 0444, priv->debugfs, priv,
+			    &device_latency_fops);
+
 	return 0;
 }
 EXPORT_SYMBOL_GPL(avionics_device_register);
 
 void avionics_device_unregister(struct net_device *dev)
 {
+	struct device_priv *priv = netdev_priv(dev);
+
 	if (dev->rtnl_link_ops == &device_link_ops) {
+		rtnl_lock();
+		rx_poll_stop(priv->rx_poll);
+		priv->rx_poll = NULL;
+		rtnl_unlock();
+
+		debugfs_remove_recursive(priv->debugfs);
+		priv->debugfs = NULL;
+
 		unregister_netdev(dev);
+		cancel_work_sync(&priv->pool.refill);
+		skb_queue_purge(&priv->pool.skbs);
 	} else {
 		pr_warn("avionics-device: Device not registered\n");
 	}
@@ -353,12 +1374,48 @@ struct net_device *avionics_device_alloc(int sizeof_priv,
 	priv->dev = dev;
 	priv->ops = ops;
 
+	priv->stats = netdev_alloc_pcpu_stats(struct device_stats);
+	if (!priv->stats) {
+		pr_err("avionics-device: Failed to allocate stats\n");
+		free_netdev(dev);
+		return NULL;
+	}
+
+	skb_queue_head_init(&priv->pool.skbs);
+	INIT_WORK(&priv->pool.refill, device_pool_refill);
+	priv->pool.depth = DEVICE_POOL_DEPTH;
+	priv->pool.size = 0;
+	atomic_set(&priv->pool.empty, 0);
+
+	device_events_init(&priv->events);
+	init_waitqueue_head(&priv->tx_wait);
+
+	priv->rx_poll_config.mode = AVIONICS_RX_POLL_OFF;
+	priv->rx_poll_config.cpu = -1;
+
+	/* the first time an interrupt thread runs it records its pid */
+	atomic_set(&priv->thread_gen, 1);
+
 	return dev;
 }
 EXPORT_SYMBOL_GPL(avionics_device_alloc);
 
 void avionics_device_free(struct net_device *dev)
 {
+	struct device_priv *priv = netdev_priv(dev);
+
+	if (priv->worker) {
+		kthread_destroy_worker(priv->worker);
+	}
+
+	/* the driver's threads are all stopped by now so nothing can
+	 * report another event */
+	cancel_delayed_work_sync(&priv->events.work);
+
+	tx_periodic_free(priv->tx_periodic);
+
+	skb_queue_purge(&priv->pool.skbs);
+	free_percpu(priv->stats);
 	free_netdev(dev);
 }
 EXPORT_SYMBOL_GPL(avionics_device_free);
@@ -11,10 +11,46 @@
  * GNU General Public License for more details.
  */
 
-#ifndef __AVIONICS_DEVICE_H__
-#define __AVIONICS_DEVICE_H__
+#ifndef __AVIONICS_NET_DEVICE_H__
+#define __AVIONICS_NET_DEVICE_H__
+
+#include <linux/netdevice.h>
+#include <net/sock.h>
+
+#include "avionics.h"
 
 int device_netlink_register(void);
 void device_netlink_unregister(void);
 
-#endif /* __AVIONICS_DEVICE_H__ */
+/* Polls the device's receiver for up to usecs, or until a packet is
+ * queued on sk, for sockets with SO_BUSY_POLL set. */
+void device_rx_busy_poll(struct net_device *dev, struct sock *sk,
+			 unsigned int usecs);
+
+/* Maps the device's transmit buffer, if it has one. */
+int device_tx_mmap(struct net_device *dev, struct vm_area_struct *vma);
+
+/* Waits for up to *timeo for the device's transmit queue to be woken,
+ * with avionics_device_tx_wake, or the device to go down. Waiters are
+ * also woken with device_tx_wake_all when the device goes down. */
+int device_tx_wait(struct net_device *dev, long *timeo);
+void device_tx_wake_all(struct net_device *dev);
+
+/* True if the device's packets aren't avionics_data records, see
+ * AVIONICS_OPS_PACKETS, so they have to be passed on as they are. */
+bool device_rx_packets(const struct net_device *dev);
+
+/* Sets, reads back and maps the device's periodic transmit schedule,
+ * see tx-periodic.h. */
+int device_tx_periodic_set(struct net_device *dev,
+			   const struct avionics_tx_periodic_entry *config,
+			   int count);
+int device_tx_periodic_get(struct net_device *dev,
+			   struct avionics_tx_periodic_entry *config, int max);
+int device_tx_periodic_mmap(struct net_device *dev,
+			    struct vm_area_struct *vma);
+
+/* Total bytes received by the device across all CPUs. */
+__u64 device_rx_bytes(struct net_device *dev);
+
+#endif /* __AVIONICS_NET_DEVICE_H__ */
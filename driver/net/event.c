@@ -0,0 +1,101 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <net/genetlink.h>
+
+#include "event.h"
+#include "avionics.h"
+
+static const struct genl_multicast_group event_mcgrps[] = {
+	{ .name = AVIONICS_GENL_MCGRP_EVENTS, },
+};
+
+static struct genl_family event_family = {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0)
+	.id		= GENL_ID_GENERATE,
+#else
+	.mcgrps		= event_mcgrps,
+	.n_mcgrps	= ARRAY_SIZE(event_mcgrps),
+#endif
+	.name		= AVIONICS_GENL_NAME,
+	.version	= AVIONICS_GENL_VERSION,
+	.maxattr	= AVIONICS_EVENT_ATTR_MAX,
+	.module		= THIS_MODULE,
+};
+
+bool event_listening(void)
+{
+	return genl_has_listeners(&event_family, &init_net, 0);
+}
+
+void event_send(struct net_device *dev, __u32 type, __u32 count,
+		__s64 time_msecs)
+{
+	struct sk_buff *skb;
+	void *hdr;
+	size_t size;
+
+	size = nla_total_size(sizeof(__u32))*3
+	       + nla_total_size(sizeof(__s64));
+
+	skb = genlmsg_new(size, GFP_KERNEL);
+	if (!skb) {
+		pr_err_ratelimited("avionics-event: Failed to allocate"
+				   " event\n");
+		return;
+	}
+
+	hdr = genlmsg_put(skb, 0, 0, &event_family, 0, AVIONICS_CMD_EVENT);
+	if (!hdr) {
+		goto fail;
+	}
+
+	if (nla_put_u32(skb, AVIONICS_EVENT_ATTR_IFINDEX, dev->ifindex)
+	    || nla_put_u32(skb, AVIONICS_EVENT_ATTR_TYPE, type)
+	    || nla_put_u32(skb, AVIONICS_EVENT_ATTR_COUNT, count)
+	    || nla_put(skb, AVIONICS_EVENT_ATTR_TIME_MSECS,
+		       sizeof(time_msecs), &time_msecs)) {
+		goto fail;
+	}
+
+	genlmsg_end(skb, hdr);
+
+	/* nobody listening isn't an error */
+	genlmsg_multicast(&event_family, skb, 0, 0, GFP_KERNEL);
+	return;
+
+fail:
+	pr_err_ratelimited("avionics-event: Failed to build event\n");
+	nlmsg_free(skb);
+}
+
+int event_register(void)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,10,0)
+	return genl_register_family_with_groups(&event_family, event_mcgrps);
+#else
+	return genl_register_family(&event_family);
+#endif
+}
+
+void event_unregister(void)
+{
+	genl_unregister_family(&event_family);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_NET_EVENT_H__
+#define __AVIONICS_NET_EVENT_H__
+
+#include <linux/netdevice.h>
+
+/* The generic netlink family bus health events are multicast on, the
+ * coalescing is done per device in device.c. */
+
+bool event_listening(void);
+void event_send(struct net_device *dev, __u32 type, __u32 count,
+		__s64 time_msecs);
+
+int event_register(void);
+void event_unregister(void);
+
+#endif /* __AVIONICS_NET_EVENT_H__ */
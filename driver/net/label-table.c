@@ -0,0 +1,192 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/version.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kref.h>
+#include <linux/skbuff.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
+
+#include "label-table.h"
+#include "avionics.h"
+#include "avionics-device.h"
+
+struct label_table {
+	struct kref ref;
+	spinlock_t lock;
+	struct avionics_label_table *table;
+	size_t size;
+};
+
+static int label_table_index(__u32 value)
+{
+	return (ARINC429_SDI(value) << 8) | ARINC429_LABEL(value);
+}
+
+void label_table_rx(struct label_table *table, struct sk_buff *skb)
+{
+	struct avionics_label_entry *entry;
+	avionics_data *data;
+	__u32 sequence;
+	int i, num_samples;
+
+	data = (avionics_data *)skb->data;
+	num_samples = skb->len / sizeof(avionics_data);
+
+	/* packets from the same interface can be received on more than
+	 * one CPU, the lock only keeps writers apart, readers rely on
+	 * the sequence counts */
+	spin_lock(&table->lock);
+
+	for (i = 0; i < num_samples; i++) {
+		entry = &table->table->entries[label_table_index(data[i].value)];
+
+		sequence = entry->sequence;
+		WRITE_ONCE(entry->sequence, sequence + 1);
+		smp_wmb();
+
+		WRITE_ONCE(entry->time_msecs,
+			   div_s64(data[i].time_nsecs, NSEC_PER_MSEC));
+		WRITE_ONCE(entry->value, data[i].value);
+		WRITE_ONCE(entry->count, entry->count + 1);
+
+		smp_wmb();
+		WRITE_ONCE(entry->sequence, sequence + 2);
+	}
+
+	spin_unlock(&table->lock);
+}
+
+static void label_table_read(const struct avionics_label_entry *entry,
+			     struct avionics_label_entry *copy)
+{
+	__u32 sequence;
+
+	do {
+		sequence = READ_ONCE(entry->sequence);
+		smp_rmb();
+
+		copy->count = READ_ONCE(entry->count);
+		copy->time_msecs = READ_ONCE(entry->time_msecs);
+		copy->value = READ_ONCE(entry->value);
+
+		smp_rmb();
+	} while ((sequence & 1) || (sequence != READ_ONCE(entry->sequence)));
+
+	copy->sequence = sequence;
+	copy->padding = 0;
+}
+
+int label_table_copy(struct label_table *table, char __user *optval,
+		     int len)
+{
+	struct avionics_label_entry copy;
+	int i, entries;
+
+	entries = min_t(int, len / sizeof(copy), AVIONICS_LABEL_TABLE_ENTRIES);
+
+	/* each entry is consistent on its own, the table as a whole is
+	 * as current as the moment each entry was copied */
+	for (i = 0; i < entries; i++) {
+		label_table_read(&table->table->entries[i], &copy);
+
+		if (copy_to_user(optval + i * sizeof(copy), &copy,
+				 sizeof(copy))) {
+			return -EFAULT;
+		}
+	}
+
+	return entries * sizeof(copy);
+}
+
+int label_table_mmap(struct label_table *table, struct vm_area_struct *vma)
+{
+	if ((vma->vm_end - vma->vm_start) > table->size) {
+		pr_err("avionics-label-table: Mapping must be at most %zu"
+		       " bytes not %lu.\n", table->size,
+		       vma->vm_end - vma->vm_start);
+		return -EINVAL;
+	}
+
+	/* the table is shared by every socket on the interface so no
+	 * one gets to write to it */
+	if (vma->vm_flags & VM_WRITE) {
+		pr_err("avionics-label-table: Mapping must be read only.\n");
+		return -EPERM;
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+	vma->vm_flags &= ~VM_MAYWRITE;
+#else
+	vm_flags_clear(vma, VM_MAYWRITE);
+#endif
+
+	return remap_vmalloc_range(vma, table->table, 0);
+}
+
+static void label_table_release(struct kref *ref)
+{
+	struct label_table *table;
+
+	table = container_of(ref, struct label_table, ref);
+
+	vfree(table->table);
+	kfree(table);
+}
+
+void label_table_get(struct label_table *table)
+{
+	kref_get(&table->ref);
+}
+
+void label_table_put(struct label_table *table)
+{
+	if (!table) {
+		return;
+	}
+
+	kref_put(&table->ref, label_table_release);
+}
+
+struct label_table *label_table_alloc(void)
+{
+	struct label_table *table;
+
+	table = kzalloc(sizeof(*table), GFP_KERNEL);
+	if (!table) {
+		pr_err("avionics-label-table: Failed to allocate table.\n");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	table->size = PAGE_ALIGN(sizeof(*table->table));
+
+	table->table = vmalloc_user(table->size);
+	if (!table->table) {
+		pr_err("avionics-label-table: Failed to allocate %zu byte"
+		       " table.\n", table->size);
+		kfree(table);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	kref_init(&table->ref);
+	spin_lock_init(&table->lock);
+
+	return table;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_LABEL_TABLE_H__
+#define __AVIONICS_LABEL_TABLE_H__
+
+#include <linux/mm.h>
+#include <linux/skbuff.h>
+
+#include "avionics.h"
+
+/* Label tables hold the newest word for every ARINC-429 label and SDI
+ * seen on an interface. There is at most one per interface, shared by
+ * every socket that asks for it, and it's updated once per received
+ * packet before the packet is handed to the sockets. */
+
+struct label_table;
+
+struct label_table *label_table_alloc(void);
+void label_table_get(struct label_table *table);
+void label_table_put(struct label_table *table);
+
+void label_table_rx(struct label_table *table, struct sk_buff *skb);
+int label_table_copy(struct label_table *table, char __user *optval,
+		     int len);
+int label_table_mmap(struct label_table *table, struct vm_area_struct *vma);
+
+#endif /* __AVIONICS_LABEL_TABLE_H__ */
@@ -27,112 +27,63 @@
 
 /* ====== Raw Protocol ===== */
 
-static int protocol_raw_sendmsg(struct socket *sock, struct msghdr *msg,
-				size_t size)
+static int protocol_raw_fill(avionics_data *data, struct msghdr *msg,
+			     int count)
 {
-	struct sock *sk = sock->sk;
-	struct protocol_raw_sock *psk = (struct protocol_raw_sock*)sk;
-	struct sk_buff *skb;
-	struct net_device *dev;
-	avionics_data *data;
-	int err = 0, buffer_size, num_samples, i;
-
-	err = protocol_get_dev_from_msg((struct protocol_sock*)psk,
-					msg, size, &dev);
-	if (err) {
-		pr_err("avionics-protocol-raw: Can't find device: %d.\n", err);
-		return err;
-	}
-
-	num_samples = size/sizeof(data->value);
-	buffer_size = num_samples * sizeof(data[0]);
-	skb = protocol_alloc_send_skb(dev, msg->msg_flags&MSG_DONTWAIT,
-				      sk, buffer_size);
-
-	if (!skb) {
-		pr_err("avionics-protocol-raw: Unable to allocate skbuff\n");
-		dev_put(dev);
-		return -ENOMEM;
-	}
-
-	err = memcpy_from_msg(skb_put(skb, buffer_size), msg, size);
-	if (err < 0) {
-		pr_err("avionics-protocol-raw: Can't memcpy from msg: %d.\n", err);
-		kfree_skb(skb);
-		dev_put(dev);
-		return err;
-	}
-
-	data = (avionics_data*)skb->data;
-	for (i = num_samples - 1; i >= 0; i--) {
-		memcpy(&(data[i].value),
-		       &(skb->data[i*sizeof(data->value)]),
-		       sizeof(data->value));
-		data[i].time_msecs = 0;
-	}
-
-	err = protocol_send_to_netdev(dev, skb);
-	if (err) {
-		pr_err("avionics-protocol-raw: Failed to send packet: %d.\n", err);
-		return err;
+	int err, i;
+
+	/* fill the records in place, straight from the user's buffer */
+	for (i = 0; i < count; i++) {
+		data[i].time_nsecs = 0;
+		data[i].flags = 0;
+		data[i].ifindex = 0;
+		err = memcpy_from_msg(&data[i].value, msg, sizeof(data->value));
+		if (err < 0) {
+			return err;
+		}
 	}
 
-	return size;
+	return 0;
 }
 
-static int protocol_raw_recvmsg(struct socket *sock,
-				struct msghdr *msg, size_t size, int flags)
+static int protocol_raw_copy(struct msghdr *msg, struct sk_buff *skb,
+			     size_t size)
 {
-	struct sock *sk = sock->sk;
-	struct sk_buff *skb;
-	struct avionics_proto_raw_data *buffer;
 	avionics_data *data;
-	int err = 0, noblock, i, num_samples, buffer_size;
-
-	noblock = flags & MSG_DONTWAIT;
-	flags &= ~MSG_DONTWAIT;
-
-	skb = skb_recv_datagram(sk, flags, noblock, &err);
-	if (!skb) {
-		pr_debug("avionics-protocol-raw: No data in receive message\n");
-		return err;
-	}
+	int err, i, num_samples;
 
-	if (size < skb->len) {
-		msg->msg_flags |= MSG_TRUNC;
-	} else {
-		size = skb->len;
-	}
-
-	num_samples = size / sizeof(avionics_data);
-	buffer_size = num_samples * sizeof(buffer[0]);
+	num_samples = size / sizeof(struct avionics_proto_raw_data);
 
+	/* copy each value straight out of its record into the user's
+	 * buffer, there's no need to pack them anywhere first */
 	data = (avionics_data *)skb->data;
-	buffer = kmalloc(buffer_size, GFP_KERNEL);
-	for(i = 0; i < num_samples; i++) {
-		memcpy(&buffer[i], &(data[i].value), sizeof(buffer[0]));
-	}
-
-	err = memcpy_to_msg(msg, buffer, buffer_size);
-	if (err < 0) {
-		pr_err("avionics-protocol-raw: Failed to copy message data.\n");
-		skb_free_datagram(sk, skb);
-		kfree(buffer);
-		return err;
+	for (i = 0; i < num_samples; i++) {
+		err = memcpy_to_msg(msg, &data[i].value, sizeof(data->value));
+		if (err < 0) {
+			pr_err("avionics-protocol-raw: Failed to copy message data.\n");
+			return err;
+		}
 	}
 
-	sock_recv_ts_and_drops(msg, sk, skb);
+	return num_samples * sizeof(struct avionics_proto_raw_data);
+}
 
-	if (msg->msg_name) {
-		__sockaddr_check_size(sizeof(struct sockaddr_avionics));
-		msg->msg_namelen = sizeof(struct sockaddr_avionics);
-		memcpy(msg->msg_name, skb->cb, msg->msg_namelen);
-	}
+static const struct protocol_format protocol_raw_format = {
+	.sample_size	= sizeof(struct avionics_proto_raw_data),
+	.copy		= protocol_raw_copy,
+	.fill		= protocol_raw_fill,
+};
 
-	skb_free_datagram(sk, skb);
-	kfree(buffer);
+static int protocol_raw_sendmsg(struct socket *sock, struct msghdr *msg,
+				size_t size)
+{
+	return protocol_sendmsg(sock, msg, size, &protocol_raw_format);
+}
 
-	return buffer_size;
+static int protocol_raw_recvmsg(struct socket *sock,
+				struct msghdr *msg, size_t size, int flags)
+{
+	return protocol_recvmsg(sock, msg, size, flags, &protocol_raw_format);
 }
 
 static const struct proto_ops protocol_raw_ops = {
@@ -144,14 +95,12 @@ static const struct proto_ops protocol_raw_ops = {
 	.accept		= sock_no_accept,
 	.listen		= sock_no_listen,
 	.shutdown	= sock_no_shutdown,
-#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
-	.setsockopt	= sock_no_setsockopt,
-	.getsockopt	= sock_no_getsockopt,
-#endif
-	.mmap		= sock_no_mmap,
+	.setsockopt	= protocol_setsockopt,
+	.getsockopt	= protocol_getsockopt,
+	.mmap		= protocol_mmap,
 	.sendpage	= sock_no_sendpage,
 
-	.poll		= datagram_poll,
+	.poll		= protocol_poll,
 
 	.sendmsg	= protocol_raw_sendmsg,
 	.recvmsg	= protocol_raw_recvmsg,
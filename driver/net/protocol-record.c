@@ -0,0 +1,114 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/net.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <net/sock.h>
+
+#include "protocol-record.h"
+#include "protocol.h"
+#include "avionics.h"
+#include "avionics-device.h"
+
+/* ====== Record Protocol ===== */
+
+static int protocol_record_fill(avionics_data *data, struct msghdr *msg,
+				int count)
+{
+	/* the records are already in the format the drivers use */
+	return memcpy_from_msg(data, msg, count * sizeof(data[0]));
+}
+
+static int protocol_record_copy(struct msghdr *msg, struct sk_buff *skb,
+				size_t size)
+{
+	int err;
+
+	/* the socket list has already tagged the records with their
+	 * interface, so they're copied out as they are */
+	size -= size % sizeof(avionics_data);
+
+	err = skb_copy_datagram_msg(skb, 0, msg, size);
+	if (err < 0) {
+		pr_err("avionics-protocol-record: Failed to copy message data.\n");
+		return err;
+	}
+
+	return size;
+}
+
+static const struct protocol_format protocol_record_format = {
+	.sample_size	= sizeof(struct avionics_proto_record_data),
+	.copy		= protocol_record_copy,
+	.fill		= protocol_record_fill,
+};
+
+static int protocol_record_sendmsg(struct socket *sock, struct msghdr *msg,
+				   size_t size)
+{
+	return protocol_sendmsg(sock, msg, size, &protocol_record_format);
+}
+
+static int protocol_record_recvmsg(struct socket *sock,
+				   struct msghdr *msg, size_t size, int flags)
+{
+	return protocol_recvmsg(sock, msg, size, flags,
+				&protocol_record_format);
+}
+
+static const struct proto_ops protocol_record_ops = {
+	.owner		= THIS_MODULE,
+	.family		= PF_AVIONICS,
+
+	.connect	= sock_no_connect,
+	.socketpair	= sock_no_socketpair,
+	.accept		= sock_no_accept,
+	.listen		= sock_no_listen,
+	.shutdown	= sock_no_shutdown,
+	.setsockopt	= protocol_setsockopt,
+	.getsockopt	= protocol_getsockopt,
+	.mmap		= protocol_mmap,
+	.sendpage	= sock_no_sendpage,
+
+	.poll		= protocol_poll,
+
+	.sendmsg	= protocol_record_sendmsg,
+	.recvmsg	= protocol_record_recvmsg,
+	.splice_read	= protocol_splice_read,
+
+	.bind		= protocol_bind,
+	.release	= protocol_release,
+	.getname	= protocol_getname,
+	.ioctl		= protocol_ioctl,
+};
+
+static struct proto protocol_record = {
+	.name		= "AVIONICS_RECORD",
+	.owner		= THIS_MODULE,
+	.obj_size	= sizeof(struct protocol_sock),
+};
+
+const struct proto_ops* protocol_record_get_ops(void)
+{
+	return &protocol_record_ops;
+}
+
+struct proto * protocol_record_get(void)
+{
+	return &protocol_record;
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (C) 2020, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_PROTOCOL_RECORD_H__
+#define __AVIONICS_PROTOCOL_RECORD_H__
+
+const struct proto_ops* protocol_record_get_ops(void);
+struct proto* protocol_record_get(void);
+
+#endif /* __AVIONICS_PROTOCOL_RECORD_H__ */
@@ -23,94 +23,72 @@
 #include "protocol-timestamp.h"
 #include "protocol.h"
 #include "avionics.h"
+#include "avionics-device.h"
 
 /* ====== Timestamp Protocol ===== */
 
-static int protocol_timestamp_sendmsg(struct socket *sock, struct msghdr *msg,
-				size_t size)
+static int protocol_timestamp_fill(avionics_data *data, struct msghdr *msg,
+				   int count)
 {
-	struct sock *sk = sock->sk;
-	struct protocol_raw_sock *psk = (struct protocol_raw_sock*)sk;
-	struct sk_buff *skb;
-	struct net_device *dev;
-	int err;
-
-	err = protocol_get_dev_from_msg((struct protocol_sock*)psk,
-					msg, size, &dev);
-	if (err) {
-		pr_err("avionics-protocol-raw: Can't find device: %d.\n", err);
-		return err;
+	struct avionics_proto_timestamp_data sample;
+	int err, i;
+
+	for (i = 0; i < count; i++) {
+		err = memcpy_from_msg(&sample, msg, sizeof(sample));
+		if (err < 0) {
+			return err;
+		}
+
+		data[i].time_nsecs = sample.time_msecs * NSEC_PER_MSEC;
+		data[i].value = sample.value;
+		data[i].flags = 0;
+		data[i].ifindex = 0;
 	}
 
-	skb = protocol_alloc_send_skb(dev, msg->msg_flags&MSG_DONTWAIT,
-				      sk, size);
+	return 0;
+}
 
-	if (!skb) {
-		pr_err("avionics-protocol-raw: Unable to allocate skbuff\n");
-		dev_put(dev);
-		return -ENOMEM;
+static int protocol_timestamp_copy(struct msghdr *msg, struct sk_buff *skb,
+				   size_t size)
+{
+	struct avionics_proto_timestamp_data sample;
+	avionics_data *data;
+	int err, i, num_samples;
+
+	num_samples = size / sizeof(sample);
+
+	data = (avionics_data *)skb->data;
+	for (i = 0; i < num_samples; i++) {
+		sample.time_msecs = div_s64(data[i].time_nsecs, NSEC_PER_MSEC);
+		sample.value = data[i].value;
+
+		err = memcpy_to_msg(msg, &sample, sizeof(sample));
+		if (err < 0) {
+			pr_err("avionics-protocol-timestamp: Failed to copy message data.\n");
+			return err;
+		}
 	}
 
-	err = memcpy_from_msg(skb_put(skb, size), msg, size);
-	if (err < 0) {
-		pr_err("avionics-protocol-raw: Can't memcpy from msg: %d.\n",
-		       err);
-		kfree_skb(skb);
-		dev_put(dev);
-		return err;
-	}
+	return num_samples * sizeof(sample);
+}
 
-	err = protocol_send_to_netdev(dev, skb);
-	if (err) {
-		pr_err("avionics-protocol-raw: Failed to send packet: %d.\n",
-		       err);
-		return err;
-	}
+static const struct protocol_format protocol_timestamp_format = {
+	.sample_size	= sizeof(struct avionics_proto_timestamp_data),
+	.copy		= protocol_timestamp_copy,
+	.fill		= protocol_timestamp_fill,
+};
 
-	return size;
+static int protocol_timestamp_sendmsg(struct socket *sock, struct msghdr *msg,
+				size_t size)
+{
+	return protocol_sendmsg(sock, msg, size, &protocol_timestamp_format);
 }
 
 static int protocol_timestamp_recvmsg(struct socket *sock,
 				struct msghdr *msg, size_t size, int flags)
 {
-	struct sock *sk = sock->sk;
-	struct sk_buff *skb;
-	int err = 0;
-	int noblock;
-
-	noblock = flags & MSG_DONTWAIT;
-	flags &= ~MSG_DONTWAIT;
-
-	skb = skb_recv_datagram(sk, flags, noblock, &err);
-	if (!skb) {
-		pr_debug("avionics-protocol-timestamp: No data in receive message\n");
-		return err;
-	}
-
-	if (size < skb->len) {
-		msg->msg_flags |= MSG_TRUNC;
-	} else {
-		size = skb->len;
-	}
-
-	err = memcpy_to_msg(msg, skb->data, size);
-	if (err < 0) {
-		pr_err("avionics-protocol-timestamp: Failed to copy message data.\n");
-		skb_free_datagram(sk, skb);
-		return err;
-	}
-
-	sock_recv_ts_and_drops(msg, sk, skb);
-
-	if (msg->msg_name) {
-		__sockaddr_check_size(sizeof(struct sockaddr_avionics));
-		msg->msg_namelen = sizeof(struct sockaddr_avionics);
-		memcpy(msg->msg_name, skb->cb, msg->msg_namelen);
-	}
-
-	skb_free_datagram(sk, skb);
-
-	return size;
+	return protocol_recvmsg(sock, msg, size, flags,
+				&protocol_timestamp_format);
 }
 
 static const struct proto_ops protocol_timestamp_ops = {
@@ -122,14 +100,12 @@ static const struct proto_ops protocol_timestamp_ops = {
 	.accept		= sock_no_accept,
 	.listen		= sock_no_listen,
 	.shutdown	= sock_no_shutdown,
-#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
-	.setsockopt	= sock_no_setsockopt,
-	.getsockopt	= sock_no_getsockopt,
-#endif
-	.mmap		= sock_no_mmap,
+	.setsockopt	= protocol_setsockopt,
+	.getsockopt	= protocol_getsockopt,
+	.mmap		= protocol_mmap,
 	.sendpage	= sock_no_sendpage,
 
-	.poll		= datagram_poll,
+	.poll		= protocol_poll,
 
 	.sendmsg	= protocol_timestamp_sendmsg,
 	.recvmsg	= protocol_timestamp_recvmsg,
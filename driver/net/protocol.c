@@ -19,13 +19,20 @@
 #include <linux/net.h>
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
+#include <linux/uaccess.h>
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/slab.h>
 #include <net/sock.h>
 
 #include "protocol.h"
+#include "device.h"
 #include "socket-list.h"
+#include "rx-ring.h"
+#include "rx-filter.h"
+#include "label-table.h"
 #include "avionics.h"
-
-static int queue_error_mask = 0;
+#include "avionics-device.h"
 
 void protocol_init_skb(struct net_device *dev, struct sk_buff *skb)
 {
@@ -39,17 +46,19 @@ void protocol_init_skb(struct net_device *dev, struct sk_buff *skb)
 	skb_reset_transport_header(skb);
 }
 
-struct sk_buff* protocol_alloc_send_skb(struct net_device *dev,
-					int flags, struct sock *sk,
-					size_t size)
+static struct sk_buff* protocol_alloc_send_skb(struct net_device *dev,
+					       int flags, struct sock *sk,
+					       size_t size, int *err)
 {
 	struct sk_buff *skb;
-	int err;
 
-	skb = sock_alloc_send_skb(sk, size, flags, &err);
+	/* blocks, or fails with -EAGAIN, while the send buffer is full */
+	skb = sock_alloc_send_skb(sk, size, flags, err);
 	if (!skb) {
-		pr_err("avionics-device: Unable to allocate send skbuff: %d.\n",
-		       err);
+		if (*err != -EAGAIN) {
+			pr_err("avionics-device: Unable to allocate send"
+			       " skbuff: %d.\n", *err);
+		}
 		return NULL;
 	}
 
@@ -64,9 +73,9 @@ struct sk_buff* protocol_alloc_send_skb(struct net_device *dev,
 }
 
 
-int protocol_get_dev_from_msg(struct protocol_sock *psk,
-			      struct msghdr *msg, size_t size,
-			      struct net_device **dev)
+static int protocol_get_dev_from_msg(struct protocol_sock *psk,
+				     struct msghdr *msg,
+				     struct net_device **dev)
 {
 	int ifindex;
 
@@ -93,6 +102,12 @@ int protocol_get_dev_from_msg(struct protocol_sock *psk,
 		ifindex = psk->ifindex;
 	}
 
+	/* sockets bound to every interface have to say where to send */
+	if (!ifindex) {
+		pr_err("avionics-protocol: Must specify ifindex to send.\n");
+		return -EDESTADDRREQ;
+	}
+
 	/* Make sure the device is valid */
 	*dev = dev_get_by_index(sock_net(&psk->sk), ifindex);
 	if (!*dev) {
@@ -113,27 +128,14 @@ int protocol_get_dev_from_msg(struct protocol_sock *psk,
 		return -ENETDOWN;
 	}
 
-	if (unlikely(size > (*dev)->mtu)) {
-		pr_err("avionics-protocol: %zu bytes too large for MTU of"
-		       " %d bytes.\n", size, (*dev)->mtu);
-		dev_put(*dev);
-		return -EMSGSIZE;
-	}
-
-
 	return 0;
 }
 
 
-int protocol_send_to_netdev(struct net_device *dev, struct sk_buff *skb)
+static int protocol_send_to_netdev(struct sk_buff *skb)
 {
 	int err;
 
-	if (!dev->netdev_ops->ndo_start_xmit) {
-		pr_err("avionics-protocol: device doesn't support transmit\n");
-		return -ENODEV;
-	}
-
 	/* send to netdevice */
 	err = dev_queue_xmit(skb);
 	if (err > 0) {
@@ -141,14 +143,446 @@ int protocol_send_to_netdev(struct net_device *dev, struct sk_buff *skb)
 	}
 
 	if (err) {
-		pr_err("avionics-protocol: Send to netdevice failed: %d\n",
-		       err);
+		pr_err_ratelimited("avionics-protocol: Send to netdevice"
+				   " failed: %d\n", err);
+	}
+
+	return err;
+}
+
+/* A stopped queue means the device is backed up, wait for the driver
+ * to wake it rather than overflowing the queueing discipline in front
+ * of it. */
+static int protocol_wait_for_dev(struct net_device *dev, long *timeo)
+{
+	if (!netif_queue_stopped(dev) || !netif_running(dev)) {
+		return 0;
+	}
+
+	if (!*timeo) {
+		return -EAGAIN;
+	}
+
+	return device_tx_wait(dev, timeo);
+}
+
+/* Sends are split into as many packets as the device's MTU needs, the
+ * MTU counts the drivers' records rather than the caller's bytes. Each
+ * packet waits for room in the send buffer, so a large send is paced
+ * by the device, and the packets are queued in order. If a packet
+ * fails after others were sent the bytes already sent are returned.
+ * Sends must hold a whole number of the caller's samples. */
+int protocol_sendmsg(struct socket *sock, struct msghdr *msg, size_t size,
+		     const struct protocol_format *format)
+{
+	struct sock *sk = sock->sk;
+	struct sk_buff *skb;
+	struct net_device *dev;
+	avionics_data *data;
+	size_t sent = 0;
+	long timeo;
+	int err, i, count, words, num_samples;
+
+	if (size % format->sample_size) {
+		pr_err_ratelimited("avionics-protocol: Send of %zu bytes isn't"
+				   " a whole number of %zu byte samples.\n",
+				   size, format->sample_size);
+		return -EINVAL;
+	}
+
+	err = protocol_get_dev_from_msg((struct protocol_sock*)sk, msg, &dev);
+	if (err) {
+		pr_err("avionics-protocol: Can't find device: %d.\n", err);
+		return err;
+	}
+
+	if (!dev->netdev_ops->ndo_start_xmit) {
+		pr_err("avionics-protocol: device doesn't support transmit\n");
 		dev_put(dev);
+		return -ENODEV;
+	}
+
+	words = max_t(int, dev->mtu / sizeof(avionics_data), 1);
+	num_samples = size / format->sample_size;
+	timeo = sock_sndtimeo(sk, msg->msg_flags&MSG_DONTWAIT);
+
+	for (i = 0; i < num_samples; i += count) {
+		count = min(words, num_samples - i);
+
+		err = protocol_wait_for_dev(dev, &timeo);
+		if (err) {
+			break;
+		}
+
+		skb = protocol_alloc_send_skb(dev, msg->msg_flags&MSG_DONTWAIT,
+					      sk, count * sizeof(*data), &err);
+		if (!skb) {
+			break;
+		}
+
+		data = (avionics_data *)skb_put(skb, count * sizeof(*data));
+		err = format->fill(data, msg, count);
+		if (err < 0) {
+			pr_err("avionics-protocol: Can't memcpy from msg:"
+			       " %d.\n", err);
+			kfree_skb(skb);
+			break;
+		}
+
+		err = protocol_send_to_netdev(skb);
+		if (err) {
+			break;
+		}
+
+		sent += count * format->sample_size;
+	}
+
+	dev_put(dev);
+
+	if (i >= num_samples) {
+		return size;
+	}
+
+	return sent ? sent : err;
+}
+
+static size_t protocol_skb_len(const struct protocol_format *format,
+			       struct sk_buff *skb)
+{
+	if (PROTOCOL_SKB_CB(skb)->packet) {
+		return skb->len;
+	}
+
+	return (skb->len / sizeof(avionics_data)) * format->sample_size;
+}
+
+/* Packets that aren't records are handed over as they are, whatever
+ * the socket's protocol. */
+static int protocol_skb_copy(const struct protocol_format *format,
+			     struct msghdr *msg, struct sk_buff *skb,
+			     size_t size)
+{
+	int err;
+
+	if (!PROTOCOL_SKB_CB(skb)->packet) {
+		return format->copy(msg, skb, size);
+	}
+
+	err = skb_copy_datagram_msg(skb, 0, msg, size);
+	if (err < 0) {
 		return err;
 	}
 
+	return size;
+}
+
+static struct sk_buff *protocol_dequeue_fit(struct sock *sk,
+					    const struct protocol_format *format,
+					    size_t space, int ifindex,
+					    int *full)
+{
+	struct sk_buff_head *queue = &sk->sk_receive_queue;
+	struct sockaddr_avionics *addr;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->lock, flags);
+
+	skb = skb_peek(queue);
+	if (skb) {
+		addr = &PROTOCOL_SKB_CB(skb)->addr;
+
+		if ((protocol_skb_len(format, skb) > space)
+		    || (addr->ifindex != ifindex)) {
+			*full = 1;
+			skb = NULL;
+		} else {
+			__skb_unlink(skb, queue);
+		}
+	}
+
+	spin_unlock_irqrestore(&queue->lock, flags);
+
+	return skb;
+}
+
+static int protocol_recv_coalesce(struct sock *sk, struct msghdr *msg,
+				  size_t size, size_t min_bytes, int noblock,
+				  int ifindex,
+				  const struct protocol_format *format)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct sk_buff *skb;
+	long timeo;
+	__u32 timeout_usecs;
+	int copied = 0, full = 0, err;
+
+	timeout_usecs = READ_ONCE(psk->rx_coalesce.timeout_usecs);
+
+	timeo = sock_rcvtimeo(sk, noblock);
+	if (timeout_usecs) {
+		timeo = min_t(long, timeo, usecs_to_jiffies(timeout_usecs));
+	}
+
+	while (copied < size) {
+		skb = protocol_dequeue_fit(sk, format, size - copied,
+					   ifindex, &full);
+		if (!skb) {
+			if (full || (copied >= min_bytes) || !timeo
+			    || signal_pending(current)) {
+				break;
+			}
+
+			lock_sock(sk);
+			sk_wait_data(sk, &timeo, NULL);
+			release_sock(sk);
+			continue;
+		}
+
+		err = protocol_skb_copy(format, msg, skb,
+					protocol_skb_len(format, skb));
+		skb_free_datagram(sk, skb);
+
+		if (err < 0) {
+			pr_err("avionics-protocol: Failed to copy message data.\n");
+			return copied ? copied : err;
+		}
+
+		copied += err;
+	}
+
+	return copied;
+}
+
+/* Sockets with SO_BUSY_POLL set poll the bound device's receiver
+ * themselves rather than waiting for it to interrupt. */
+static void protocol_busy_poll(struct sock *sk, int noblock)
+{
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct net_device *dev;
+	unsigned int usecs;
+
+	usecs = READ_ONCE(sk->sk_ll_usec);
+	if (!usecs || !psk->bound
+	    || !skb_queue_empty(&sk->sk_receive_queue)) {
+		return;
+	}
+
+	dev = dev_get_by_index(sock_net(sk), psk->ifindex);
+	if (!dev) {
+		return;
+	}
+
+	device_rx_busy_poll(dev, sk, noblock ? 0 : usecs);
+
 	dev_put(dev);
-	return 0;
+#endif
+}
+
+static void protocol_recv_latency(struct sock *sk, struct sk_buff *skb)
+{
+	struct protocol_skb_cb *cb = PROTOCOL_SKB_CB(skb);
+	struct net_device *dev;
+
+	rcu_read_lock();
+	dev = dev_get_by_index_rcu(sock_net(sk), cb->addr.ifindex);
+	if (dev) {
+		avionics_device_latency(dev, AVIONICS_LATENCY_RX_RECV,
+					cb->enqueued, ktime_get_real());
+	}
+	rcu_read_unlock();
+}
+
+int protocol_recvmsg(struct socket *sock, struct msghdr *msg, size_t size,
+		     int flags, const struct protocol_format *format)
+{
+	struct sock *sk = sock->sk;
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct sockaddr_avionics *addr;
+	struct sk_buff *skb;
+	size_t len, min_bytes;
+	int err = 0, noblock, copied;
+
+	if (flags & MSG_ERRQUEUE) {
+		return sock_recv_errqueue(sk, msg, size, SOL_AVIONICS,
+					  AVIONICS_TX_TIMESTAMP);
+	}
+
+	noblock = flags & MSG_DONTWAIT;
+	flags &= ~MSG_DONTWAIT;
+
+	protocol_busy_poll(sk, noblock);
+
+	skb = skb_recv_datagram(sk, flags, noblock, &err);
+	if (!skb) {
+		pr_debug("avionics-protocol: No data in receive message\n");
+		return err;
+	}
+
+	if (!(flags & MSG_PEEK)) {
+		protocol_recv_latency(sk, skb);
+	}
+
+	len = protocol_skb_len(format, skb);
+	if (size < len) {
+		msg->msg_flags |= MSG_TRUNC;
+		len = size;
+	}
+
+	copied = protocol_skb_copy(format, msg, skb, len);
+	if (copied < 0) {
+		pr_err("avionics-protocol: Failed to copy message data.\n");
+		skb_free_datagram(sk, skb);
+		return copied;
+	}
+
+	sock_recv_ts_and_drops(msg, sk, skb);
+
+	if (msg->msg_name) {
+		__sockaddr_check_size(sizeof(struct sockaddr_avionics));
+		msg->msg_namelen = sizeof(struct sockaddr_avionics);
+		memcpy(msg->msg_name, skb->cb, msg->msg_namelen);
+	}
+
+	addr = &PROTOCOL_SKB_CB(skb)->addr;
+
+	/* only packets from the same interface are coalesced so that the
+	 * returned address is valid for all of the data */
+	if (READ_ONCE(psk->rx_coalesce.enable) && !(flags & MSG_PEEK)
+	    && !(msg->msg_flags & MSG_TRUNC)) {
+		min_bytes = min_t(size_t, READ_ONCE(psk->rx_coalesce.min_bytes),
+				  size);
+		min_bytes = (min_bytes > copied) ? (min_bytes - copied) : 0;
+
+		err = protocol_recv_coalesce(sk, msg, size - copied, min_bytes,
+					     noblock, addr->ifindex, format);
+		if (err > 0) {
+			copied += err;
+		}
+	}
+
+	skb_free_datagram(sk, skb);
+
+	return copied;
+}
+
+static unsigned int protocol_pipe_space(struct pipe_inode_info *pipe)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,5,0)
+	return pipe->buffers - pipe->nrbufs;
+#else
+	return pipe->max_usage - pipe_occupancy(pipe->head, pipe->tail);
+#endif
+}
+
+/* Records are never split, packets that aren't records are spliced as
+ * a stream of bytes, the same as the ones they're read into. */
+static size_t protocol_splice_step(struct sk_buff *skb)
+{
+	return PROTOCOL_SKB_CB(skb)->packet ? 1 : sizeof(avionics_data);
+}
+
+/* skb_splice_bits stops wherever the pipe fills, which could be part way
+ * through a record. A packet's data goes into the pipe a page at a time,
+ * and each page can be split across two buffers as it's copied out of
+ * the packet, so only as much as is sure to fit is spliced, in whole
+ * records. The pipe is locked by the splice core while this runs. */
+static size_t protocol_splice_fit(struct sk_buff *skb,
+				  struct pipe_inode_info *pipe, size_t len)
+{
+	unsigned int pages;
+	size_t fit;
+
+	pages = min_t(unsigned int, protocol_pipe_space(pipe),
+		      MAX_SKB_FRAGS) / 2;
+	if (!pages) {
+		return 0;
+	}
+
+	fit = pages * PAGE_SIZE - offset_in_page(skb->data);
+	fit = min_t(size_t, fit, min_t(size_t, len, skb->len));
+
+	return fit - (fit % protocol_splice_step(skb));
+}
+
+/* Packets are taken off the queue while they're spliced, the same as
+ * recvmsg, and if only part of one fits the remaining whole records
+ * are put back at the head of the queue for the next call, so the pipe
+ * sees the same stream of records that recvmsg would return. */
+ssize_t protocol_splice_read(struct socket *sock, loff_t *ppos,
+			     struct pipe_inode_info *pipe, size_t len,
+			     unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+	struct sk_buff *skb;
+	ssize_t spliced = 0;
+	size_t chunk;
+	int err, noblock;
+
+	if (!len) {
+		return 0;
+	}
+
+	noblock = (flags & SPLICE_F_NONBLOCK)
+		|| (sock->file->f_flags & O_NONBLOCK);
+
+	skb = skb_recv_datagram(sk, 0, noblock, &err);
+	if (!skb) {
+		return err;
+	}
+
+	/* one splicer at a time, so a remainder is back on the queue before
+	 * another takes the next packet */
+	lock_sock(sk);
+
+	while (skb) {
+		/* the records were tagged with their interface before the
+		 * packet was shared, so its data is spliced as it is */
+		if (skb_linearize(skb)) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			err = -ENOMEM;
+			break;
+		}
+
+		chunk = protocol_splice_fit(skb, pipe, len - spliced);
+		if (!chunk) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			err = ((len - spliced) < protocol_splice_step(skb))
+			      ? -EINVAL : -EAGAIN;
+			break;
+		}
+
+		err = skb_splice_bits(skb, sk, 0, pipe, chunk, flags);
+		if (err <= 0) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			break;
+		}
+
+		/* only whole records are taken off the packet */
+		err -= err % protocol_splice_step(skb);
+		spliced += err;
+
+		if (err < skb->len) {
+			__skb_pull(skb, err);
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			err = err ? err : -EAGAIN;
+			break;
+		}
+
+		protocol_recv_latency(sk, skb);
+		skb_free_datagram(sk, skb);
+
+		if (spliced >= len) {
+			break;
+		}
+
+		skb = skb_dequeue(&sk->sk_receive_queue);
+	}
+
+	release_sock(sk);
+
+	return spliced ? spliced : err;
 }
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(4,17,0)
@@ -196,47 +630,132 @@ int protocol_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 	}
 }
 
+/* Makes room for one more packet on a socket that drops its oldest
+ * packets when it's full. The evicted packets are counted as socket
+ * drops, the same as the new packets would have been, so they're
+ * reported through SO_RXQ_OVFL. */
+static void protocol_rx_evict(struct sock *sk, struct net_device *dev,
+			      unsigned int depth)
+{
+	struct sk_buff_head *queue = &sk->sk_receive_queue;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	for (;;) {
+		spin_lock_irqsave(&queue->lock, flags);
+
+		if ((skb_queue_len(queue) < depth)
+		    && (atomic_read(&sk->sk_rmem_alloc)
+			< READ_ONCE(sk->sk_rcvbuf))) {
+			skb = NULL;
+		} else {
+			skb = __skb_dequeue(queue);
+		}
+
+		spin_unlock_irqrestore(&queue->lock, flags);
+
+		if (!skb) {
+			return;
+		}
+
+		atomic_inc(&sk->sk_drops);
+		atomic_long_inc(&dev->rx_dropped);
+		avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+		kfree_skb(skb);
+	}
+}
+
 static void protocol_rx(struct sk_buff *oskb, struct sock *sk)
 {
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
 	struct sk_buff *skb;
 	struct sockaddr_avionics *addr;
-	int err;
+	struct rx_ring *ring;
+	struct rx_filter *filter;
+	unsigned int depth;
+	int err, packet;
 
-	/* clone the given skb to be able to enqueue it into the rcv queue */
-	skb = skb_clone(oskb, GFP_ATOMIC);
-	if (!skb) {
-		pr_err("avionics-protocol: Failed to allocate skbuff clone.\n");
+	/* called from the socket list with the rcu read lock held */
+	filter = rcu_dereference(psk->rx_filter);
+	ring = smp_load_acquire(&psk->rx_ring);
+
+	/* packets that aren't records can't be filtered or put in a ring,
+	 * they're always queued whole */
+	packet = device_rx_packets(oskb->dev);
+	if (packet) {
+		filter = NULL;
+		ring = NULL;
+	}
+
+	/* with a ring the records are handed straight to user space */
+	if (ring) {
+		if (rx_ring_rx(ring, oskb, filter)) {
+			sk->sk_data_ready(sk);
+		}
 		return;
 	}
 
-	sock_skb_cb_check_size(sizeof(struct sockaddr_avionics));
-	addr = (struct sockaddr_avionics *)skb->cb;
+	if (filter) {
+		/* only the matching words, if any, are enqueued */
+		skb = rx_filter_skb(filter, oskb);
+		if (IS_ERR(skb)) {
+			pr_err("avionics-protocol: Failed to allocate filtered skbuff.\n");
+			return;
+		}
+
+		if (!skb) {
+			return;
+		}
+	} else {
+		/* clone the given skb to be able to enqueue it into the
+		 * rcv queue */
+		skb = skb_clone(oskb, GFP_ATOMIC);
+		if (!skb) {
+			pr_err("avionics-protocol: Failed to allocate skbuff clone.\n");
+			return;
+		}
+	}
+
+	sock_skb_cb_check_size(sizeof(struct protocol_skb_cb));
+	addr = &PROTOCOL_SKB_CB(skb)->addr;
 	memset(addr, 0, sizeof(*addr));
 	addr->avionics_family  = AF_AVIONICS;
 	addr->ifindex = skb->dev->ifindex;
+	PROTOCOL_SKB_CB(skb)->enqueued = ktime_get_real();
+	PROTOCOL_SKB_CB(skb)->packet = packet;
 
+	depth = READ_ONCE(psk->rx_drop_oldest);
+	if (depth) {
+		protocol_rx_evict(sk, skb->dev, depth);
+	}
+
+	/* the socket counts its own drops, they're also counted against
+	 * the device so they show up in its statistics */
 	err = sock_queue_rcv_skb(sk, skb);
 	if (err < 0) {
+		atomic_long_inc(&skb->dev->rx_dropped);
+		avionics_device_event(skb->dev, AVIONICS_EVENT_DROPPED);
 		if (err == -ENOMEM) {
-			if ((queue_error_mask % 500) == 0) {
-				pr_err("avionics-protocol: Receive Queue Full, Dropping Packet\n");
-			}
-			queue_error_mask++;
+			pr_warn_ratelimited("avionics-protocol: Receive Queue"
+					    " Full, Dropping Packet\n");
 		} else {
-			pr_err("avionics-protocol: Receive Queue Error: %d\n", err);
+			pr_err_ratelimited("avionics-protocol: Receive Queue"
+					   " Error: %d\n", err);
 		}
 		kfree_skb(skb);
 	}
 }
 
-int protocol_release(struct socket *sock)
+/* Takes the socket off the socket list it was bound to, sockets bound
+ * to ifindex 0 are on the wildcard list. */
+static void protocol_unbind(struct sock *sk)
 {
-	struct sock *sk = sock->sk;
 	struct protocol_sock *psk = (struct protocol_sock*)sk;
-	struct net_device *dev = NULL;
+	struct net_device *dev;
 
-	if (!sk) {
-		return 1;
+	if (!psk->ifindex) {
+		socket_list_remove_socket(NULL, protocol_rx, sk);
+		return;
 	}
 
 	dev = dev_get_by_index(sock_net(sk), psk->ifindex);
@@ -244,13 +763,27 @@ int protocol_release(struct socket *sock)
 		socket_list_remove_socket(dev, protocol_rx, sk);
 		dev_put(dev);
 	}
+}
 
-	lock_sock(sk);
-
-	psk->ifindex = 0;
-	psk->bound   = 0;
+int protocol_release(struct socket *sock)
+{
+	struct sock *sk = sock->sk;
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
 
-	sock_orphan(sk);
+	if (!sk) {
+		return 1;
+	}
+
+	if (psk->bound) {
+		protocol_unbind(sk);
+	}
+
+	lock_sock(sk);
+
+	psk->ifindex = 0;
+	psk->bound   = 0;
+
+	sock_orphan(sk);
 	sock->sk = NULL;
 
 
@@ -260,12 +793,29 @@ int protocol_release(struct socket *sock)
 	return 0;
 }
 
+/* Labels handed to the socket list so it only passes us packets that
+ * contain at least one label we want, the caller must hold the socket
+ * lock. */
+static const unsigned long *protocol_rx_labels(struct protocol_sock *psk)
+{
+	struct rx_filter *filter;
+
+	filter = rcu_dereference_protected(psk->rx_filter,
+					   lockdep_sock_is_held(&psk->sk));
+	if (!filter || !(filter->config.flags
+			 & AVIONICS_RX_FILTER_LABEL_ENABLE)) {
+		return NULL;
+	}
+
+	return filter->labels;
+}
+
 int protocol_bind(struct socket *sock, struct sockaddr *saddr, int len)
 {
 	DECLARE_SOCKADDR(struct sockaddr_avionics *, addr, saddr);
 	struct sock *sk = sock->sk;
 	struct protocol_sock *psk = (struct protocol_sock*)sk;
-	struct net_device *dev;
+	struct net_device *dev = NULL;
 	int err;
 
 	if (len != sizeof(*addr)) {
@@ -274,11 +824,6 @@ int protocol_bind(struct socket *sock, struct sockaddr *saddr, int len)
 		return -EINVAL;
 	}
 
-	if (!addr->ifindex) {
-		pr_err("avionics-protocol: Must specify ifindex in Address.\n");
-		return -EINVAL;
-	}
-
 	lock_sock(sk);
 
 	if (psk->bound && (addr->ifindex == psk->ifindex)) {
@@ -288,37 +833,52 @@ int protocol_bind(struct socket *sock, struct sockaddr *saddr, int len)
 		return 0;
 	}
 
-	dev = dev_get_by_index(sock_net(sk), addr->ifindex);
+	/* ifindex 0 receives from every avionics device, including
+	 * the ones that are registered after the bind */
+	if (addr->ifindex) {
+		dev = dev_get_by_index(sock_net(sk), addr->ifindex);
 
-	if (!dev) {
-		pr_err("avionics-protocol: Can't find device %d.\n",
-		       addr->ifindex);
-		release_sock(sk);
-		return -ENODEV;
-	}
+		if (!dev) {
+			pr_err("avionics-protocol: Can't find device %d.\n",
+			       addr->ifindex);
+			release_sock(sk);
+			return -ENODEV;
+		}
 
-	if (dev->type != ARPHRD_AVIONICS) {
-		pr_err("avionics-protocol: Device %d isn't type avionics.\n",
-		       addr->ifindex);
-		dev_put(dev);
-		release_sock(sk);
-		return -ENODEV;
+		if (dev->type != ARPHRD_AVIONICS) {
+			pr_err("avionics-protocol: Device %d isn't type"
+			       " avionics.\n", addr->ifindex);
+			dev_put(dev);
+			release_sock(sk);
+			return -ENODEV;
+		}
 	}
 
-	err = socket_list_add_socket(dev, protocol_rx, sk);
+	err = socket_list_add_socket(dev, protocol_rx, sk,
+				     protocol_rx_labels(psk));
 	if (err) {
 		pr_err("avionics-protocol: Failed to register socket with"
-		       " device %s: %d\n", dev->name, err);
-		dev_put(dev);
+		       " device %d: %d\n", addr->ifindex, err);
+		if (dev) {
+			dev_put(dev);
+		}
 		release_sock(sk);
 		return -ENODEV;
 	}
 
-	psk->ifindex = dev->ifindex;
+	if (psk->bound) {
+		protocol_unbind(sk);
+	}
+
+	psk->ifindex = addr->ifindex;
 	psk->bound = 1;
 
 	release_sock(sk);
 
+	if (!dev) {
+		return 0;
+	}
+
 	if (!(dev->flags & IFF_UP)) {
 		sk->sk_err = ENETDOWN;
 		if (!sock_flag(sk, SOCK_DEAD)) {
@@ -330,3 +890,562 @@ int protocol_bind(struct socket *sock, struct sockaddr *saddr, int len)
 
 	return 0;
 }
+
+static int protocol_set_rx_ring(struct sock *sk, protocol_optval_t optval,
+				unsigned int optlen)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct avionics_ring_req req;
+	struct rx_ring *ring;
+
+	if (optlen < sizeof(req)) {
+		return -EINVAL;
+	}
+
+	if (protocol_copy_optval(&req, optval, sizeof(req))) {
+		return -EFAULT;
+	}
+
+	lock_sock(sk);
+
+	/* the ring may already be mapped, so it can't be replaced */
+	if (psk->rx_ring) {
+		pr_err("avionics-protocol: Receive ring already allocated.\n");
+		release_sock(sk);
+		return -EBUSY;
+	}
+
+	ring = rx_ring_alloc(&req);
+	if (IS_ERR(ring)) {
+		pr_err("avionics-protocol: Failed to allocate receive ring.\n");
+		release_sock(sk);
+		return PTR_ERR(ring);
+	}
+
+	smp_store_release(&psk->rx_ring, ring);
+
+	release_sock(sk);
+
+	return 0;
+}
+
+static int protocol_set_rx_coalesce(struct sock *sk,
+				    protocol_optval_t optval,
+				    unsigned int optlen)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct avionics_rx_coalesce coalesce;
+
+	if (optlen < sizeof(coalesce)) {
+		return -EINVAL;
+	}
+
+	if (protocol_copy_optval(&coalesce, optval, sizeof(coalesce))) {
+		return -EFAULT;
+	}
+
+	lock_sock(sk);
+	psk->rx_coalesce = coalesce;
+	release_sock(sk);
+
+	return 0;
+}
+
+static int protocol_set_rx_drop_oldest(struct sock *sk,
+				       protocol_optval_t optval,
+				       unsigned int optlen)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	int depth;
+
+	if (optlen < sizeof(depth)) {
+		return -EINVAL;
+	}
+
+	if (protocol_copy_optval(&depth, optval, sizeof(depth))) {
+		return -EFAULT;
+	}
+
+	if (depth < 0) {
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(psk->rx_drop_oldest, depth);
+
+	return 0;
+}
+
+static int protocol_set_rx_filter(struct sock *sk, protocol_optval_t optval,
+				  unsigned int optlen)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct avionics_rx_filter config;
+	struct rx_filter *filter = NULL, *old;
+	struct net_device *dev;
+	int err = 0;
+
+	if (optlen < sizeof(config)) {
+		return -EINVAL;
+	}
+
+	if (protocol_copy_optval(&config, optval, sizeof(config))) {
+		return -EFAULT;
+	}
+
+	if (config.flags & (AVIONICS_RX_FILTER_LABEL_ENABLE
+			    | AVIONICS_RX_FILTER_SDI_ENABLE)) {
+		filter = rx_filter_alloc(&config);
+		if (!filter) {
+			return -ENOMEM;
+		}
+	}
+
+	lock_sock(sk);
+
+	old = rcu_dereference_protected(psk->rx_filter, lockdep_sock_is_held(sk));
+	rcu_assign_pointer(psk->rx_filter, filter);
+
+	if (psk->bound && !psk->ifindex) {
+		err = socket_list_update_socket(NULL, protocol_rx, sk,
+						protocol_rx_labels(psk));
+	} else if (psk->bound) {
+		dev = dev_get_by_index(sock_net(sk), psk->ifindex);
+		if (dev) {
+			err = socket_list_update_socket(dev, protocol_rx, sk,
+							protocol_rx_labels(psk));
+			dev_put(dev);
+		}
+	}
+
+	if (err) {
+		pr_err("avionics-protocol: Failed to update socket labels:"
+		       " %d\n", err);
+		rcu_assign_pointer(psk->rx_filter, old);
+		release_sock(sk);
+		rx_filter_free(filter);
+		return err;
+	}
+
+	release_sock(sk);
+
+	rx_filter_free(old);
+
+	return 0;
+}
+
+static int protocol_set_rx_label_table(struct sock *sk,
+				       protocol_optval_t optval,
+				       unsigned int optlen)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct label_table *table;
+	struct net_device *dev;
+	int enable;
+
+	if (optlen < sizeof(enable)) {
+		return -EINVAL;
+	}
+
+	if (protocol_copy_optval(&enable, optval, sizeof(enable))) {
+		return -EFAULT;
+	}
+
+	/* the table may already be mapped, so it stays attached until the
+	 * socket is closed */
+	if (!enable) {
+		return -EINVAL;
+	}
+
+	lock_sock(sk);
+
+	if (psk->label_table) {
+		pr_err("avionics-protocol: Label table already attached.\n");
+		release_sock(sk);
+		return -EBUSY;
+	}
+
+	if (!psk->bound || !psk->ifindex) {
+		pr_err("avionics-protocol: Socket must be bound to an"
+		       " interface to attach a label table.\n");
+		release_sock(sk);
+		return -EINVAL;
+	}
+
+	dev = dev_get_by_index(sock_net(sk), psk->ifindex);
+	if (!dev) {
+		release_sock(sk);
+		return -ENODEV;
+	}
+
+	if (device_rx_packets(dev)) {
+		pr_err("avionics-protocol: %s has no labels to keep a table"
+		       " of.\n", dev->name);
+		dev_put(dev);
+		release_sock(sk);
+		return -EOPNOTSUPP;
+	}
+
+	table = socket_list_get_label_table(dev);
+	dev_put(dev);
+
+	if (IS_ERR(table)) {
+		pr_err("avionics-protocol: Failed to attach label table.\n");
+		release_sock(sk);
+		return PTR_ERR(table);
+	}
+
+	psk->label_table = table;
+
+	release_sock(sk);
+
+	return 0;
+}
+
+static int protocol_get_rx_label_table(struct sock *sk, char __user *optval,
+				       int __user *optlen, int len)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct label_table *table;
+
+	lock_sock(sk);
+	table = psk->label_table;
+	if (table) {
+		label_table_get(table);
+	}
+	release_sock(sk);
+
+	if (!table) {
+		return -ENOENT;
+	}
+
+	len = label_table_copy(table, optval, len);
+	label_table_put(table);
+
+	if (len < 0) {
+		return len;
+	}
+
+	if (put_user(len, optlen)) {
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/* The schedule belongs to the interface rather than the socket, so it
+ * keeps running after the socket that set it is closed. */
+static struct net_device *protocol_get_tx_dev(struct sock *sk)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct net_device *dev;
+
+	lock_sock(sk);
+
+	if (!psk->bound || !psk->ifindex) {
+		pr_err("avionics-protocol: Socket must be bound to an"
+		       " interface to use a periodic schedule.\n");
+		release_sock(sk);
+		return ERR_PTR(-EINVAL);
+	}
+
+	dev = dev_get_by_index(sock_net(sk), psk->ifindex);
+
+	release_sock(sk);
+
+	return dev ? dev : ERR_PTR(-ENODEV);
+}
+
+static int protocol_set_tx_periodic(struct sock *sk,
+				    protocol_optval_t optval,
+				    unsigned int optlen)
+{
+	struct avionics_tx_periodic_entry *config;
+	struct net_device *dev;
+	int err;
+
+	if ((optlen % sizeof(*config))
+	    || (optlen > AVIONICS_TX_PERIODIC_ENTRIES * sizeof(*config))) {
+		return -EINVAL;
+	}
+
+	/* too big to bounce through the stack */
+	config = kmalloc(optlen, GFP_KERNEL);
+	if (!config) {
+		return -ENOMEM;
+	}
+
+	if (protocol_copy_optval(config, optval, optlen)) {
+		kfree(config);
+		return -EFAULT;
+	}
+
+	dev = protocol_get_tx_dev(sk);
+	if (IS_ERR(dev)) {
+		kfree(config);
+		return PTR_ERR(dev);
+	}
+
+	err = device_tx_periodic_set(dev, config, optlen / sizeof(*config));
+
+	dev_put(dev);
+	kfree(config);
+
+	return err;
+}
+
+static int protocol_get_tx_periodic(struct sock *sk, char __user *optval,
+				    int __user *optlen, int len)
+{
+	struct avionics_tx_periodic_entry *config;
+	struct net_device *dev;
+	int count;
+
+	dev = protocol_get_tx_dev(sk);
+	if (IS_ERR(dev)) {
+		return PTR_ERR(dev);
+	}
+
+	config = kmalloc_array(AVIONICS_TX_PERIODIC_ENTRIES, sizeof(*config),
+			       GFP_KERNEL);
+	if (!config) {
+		dev_put(dev);
+		return -ENOMEM;
+	}
+
+	count = device_tx_periodic_get(dev, config, len / sizeof(*config));
+	dev_put(dev);
+
+	if (count < 0) {
+		kfree(config);
+		return count;
+	}
+
+	len = count * sizeof(*config);
+
+	if (put_user(len, optlen) || copy_to_user(optval, config, len)) {
+		kfree(config);
+		return -EFAULT;
+	}
+
+	kfree(config);
+
+	return 0;
+}
+
+int protocol_setsockopt(struct socket *sock, int level, int optname,
+			protocol_optval_t optval, unsigned int optlen)
+{
+	struct sock *sk = sock->sk;
+
+	if (level != SOL_AVIONICS) {
+		return -ENOPROTOOPT;
+	}
+
+	switch (optname) {
+	case AVIONICS_RX_RING:
+		return protocol_set_rx_ring(sk, optval, optlen);
+
+	case AVIONICS_RX_COALESCE:
+		return protocol_set_rx_coalesce(sk, optval, optlen);
+
+	case AVIONICS_RX_FILTER:
+		return protocol_set_rx_filter(sk, optval, optlen);
+
+	case AVIONICS_RX_LABEL_TABLE:
+		return protocol_set_rx_label_table(sk, optval, optlen);
+
+	case AVIONICS_RX_DROP_OLDEST:
+		return protocol_set_rx_drop_oldest(sk, optval, optlen);
+
+	case AVIONICS_TX_PERIODIC:
+		return protocol_set_tx_periodic(sk, optval, optlen);
+
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+int protocol_getsockopt(struct socket *sock, int level, int optname,
+			char __user *optval, int __user *optlen)
+{
+	struct sock *sk = sock->sk;
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct avionics_ring_req req;
+	struct avionics_rx_coalesce coalesce;
+	struct avionics_rx_filter config;
+	struct rx_filter *filter;
+	void *val;
+	int len, depth;
+
+	if (level != SOL_AVIONICS) {
+		return -ENOPROTOOPT;
+	}
+
+	if (get_user(len, optlen)) {
+		return -EFAULT;
+	}
+
+	if (len < 0) {
+		return -EINVAL;
+	}
+
+	switch (optname) {
+	case AVIONICS_RX_RING:
+		memset(&req, 0, sizeof(req));
+		lock_sock(sk);
+		if (psk->rx_ring) {
+			rx_ring_get_req(psk->rx_ring, &req);
+		}
+		release_sock(sk);
+		val = &req;
+		len = min_t(unsigned int, len, sizeof(req));
+		break;
+
+	case AVIONICS_RX_COALESCE:
+		lock_sock(sk);
+		coalesce = psk->rx_coalesce;
+		release_sock(sk);
+		val = &coalesce;
+		len = min_t(unsigned int, len, sizeof(coalesce));
+		break;
+
+	case AVIONICS_RX_FILTER:
+		memset(&config, 0, sizeof(config));
+		lock_sock(sk);
+		filter = rcu_dereference_protected(psk->rx_filter,
+						   lockdep_sock_is_held(sk));
+		if (filter) {
+			config = filter->config;
+		}
+		release_sock(sk);
+		val = &config;
+		len = min_t(unsigned int, len, sizeof(config));
+		break;
+
+	case AVIONICS_RX_DROP_OLDEST:
+		depth = READ_ONCE(psk->rx_drop_oldest);
+		val = &depth;
+		len = min_t(unsigned int, len, sizeof(depth));
+		break;
+
+	case AVIONICS_RX_LABEL_TABLE:
+		/* too big to bounce through the stack */
+		return protocol_get_rx_label_table(sk, optval, optlen, len);
+
+	case AVIONICS_TX_PERIODIC:
+		/* too big to bounce through the stack */
+		return protocol_get_tx_periodic(sk, optval, optlen, len);
+
+	default:
+		return -ENOPROTOOPT;
+	}
+
+	if (put_user(len, optlen)) {
+		return -EFAULT;
+	}
+
+	if (copy_to_user(optval, val, len)) {
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+int protocol_mmap(struct file *file, struct socket *sock,
+		  struct vm_area_struct *vma)
+{
+	struct sock *sk = sock->sk;
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+	struct net_device *dev;
+	int err;
+
+	lock_sock(sk);
+
+	if (vma->vm_pgoff == (AVIONICS_TX_FRAME_OFFSET >> PAGE_SHIFT)) {
+		if (!psk->bound || !psk->ifindex) {
+			pr_err("avionics-protocol: Socket must be bound to an"
+			       " interface to map a transmit buffer.\n");
+			release_sock(sk);
+			return -EINVAL;
+		}
+
+		dev = dev_get_by_index(sock_net(sk), psk->ifindex);
+		if (!dev) {
+			release_sock(sk);
+			return -ENODEV;
+		}
+
+		err = device_tx_mmap(dev, vma);
+		dev_put(dev);
+		release_sock(sk);
+		return err;
+	}
+
+	if (vma->vm_pgoff == (AVIONICS_TX_PERIODIC_OFFSET >> PAGE_SHIFT)) {
+		release_sock(sk);
+
+		dev = protocol_get_tx_dev(sk);
+		if (IS_ERR(dev)) {
+			return PTR_ERR(dev);
+		}
+
+		err = device_tx_periodic_mmap(dev, vma);
+		dev_put(dev);
+		return err;
+	}
+
+	if (vma->vm_pgoff == (AVIONICS_LABEL_TABLE_OFFSET >> PAGE_SHIFT)) {
+		if (!psk->label_table) {
+			pr_err("avionics-protocol: No label table to map.\n");
+			release_sock(sk);
+			return -EINVAL;
+		}
+
+		err = label_table_mmap(psk->label_table, vma);
+		release_sock(sk);
+		return err;
+	}
+
+	if (!psk->rx_ring) {
+		pr_err("avionics-protocol: No receive ring to map.\n");
+		release_sock(sk);
+		return -EINVAL;
+	}
+
+	err = rx_ring_mmap(psk->rx_ring, vma);
+
+	release_sock(sk);
+
+	return err;
+}
+
+protocol_poll_t protocol_poll(struct file *file, struct socket *sock,
+			      poll_table *wait)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sock->sk;
+	struct rx_ring *ring;
+	protocol_poll_t mask;
+
+	mask = datagram_poll(file, sock, wait);
+
+	ring = smp_load_acquire(&psk->rx_ring);
+	if (ring && rx_ring_readable(ring)) {
+		mask |= PROTOCOL_POLLIN;
+	}
+
+	return mask;
+}
+
+void protocol_destruct(struct sock *sk)
+{
+	struct protocol_sock *psk = (struct protocol_sock*)sk;
+
+	rx_ring_free(psk->rx_ring);
+	psk->rx_ring = NULL;
+
+	rx_filter_free(rcu_dereference_protected(psk->rx_filter, 1));
+	RCU_INIT_POINTER(psk->rx_filter, NULL);
+
+	label_table_put(psk->label_table);
+	psk->label_table = NULL;
+}
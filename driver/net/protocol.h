@@ -16,22 +16,73 @@
 
 #include <net/sock.h>
 #include <linux/version.h>
+#include <linux/poll.h>
+
+#include "rx-ring.h"
+#include "rx-filter.h"
+#include "label-table.h"
+#include "avionics.h"
+#include "avionics-device.h"
 
 struct protocol_sock {
 	struct sock sk; /* must be first */
 	int ifindex;
 	int bound;
+	struct rx_ring *rx_ring;
+	struct rx_filter __rcu *rx_filter;
+	struct avionics_rx_coalesce rx_coalesce;
+	unsigned int rx_drop_oldest; /* queue depth in packets, 0 if off */
+	struct label_table *label_table;
+};
+
+/* Received packets carry the address they came from, the time they
+ * were queued on the socket, and whether they're a device's own format
+ * rather than records, see AVIONICS_OPS_PACKETS, in their control
+ * buffer. */
+struct protocol_skb_cb {
+	struct sockaddr_avionics addr;
+	ktime_t enqueued;
+	int packet;
 };
 
+#define PROTOCOL_SKB_CB(skb)	((struct protocol_skb_cb *)((skb)->cb))
+
+struct protocol_format {
+	size_t sample_size; /* bytes per word seen by user space */
+	int (*copy)(struct msghdr *msg, struct sk_buff *skb, size_t size);
+	int (*fill)(avionics_data *data, struct msghdr *msg, int count);
+};
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+typedef char __user * protocol_optval_t;
+#define protocol_copy_optval(dst, src, size) copy_from_user(dst, src, size)
+#else
+typedef sockptr_t protocol_optval_t;
+#define protocol_copy_optval(dst, src, size) copy_from_sockptr(dst, src, size)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+typedef unsigned int protocol_poll_t;
+#define PROTOCOL_POLLIN		(POLLIN | POLLRDNORM)
+#else
+typedef __poll_t protocol_poll_t;
+#define PROTOCOL_POLLIN		(EPOLLIN | EPOLLRDNORM)
+#endif
+
 void protocol_init_skb(struct net_device *dev, struct sk_buff *skb);
-struct sk_buff* protocol_alloc_send_skb(struct net_device *dev,
-					int flags, struct sock *sk,
-					size_t size);
 
-int protocol_get_dev_from_msg(struct protocol_sock *psk,
-			      struct msghdr *msg, size_t size,
-			      struct net_device **dev);
-int protocol_send_to_netdev(struct net_device *dev, struct sk_buff *skb);
+int protocol_sendmsg(struct socket *sock, struct msghdr *msg, size_t size,
+		     const struct protocol_format *format);
+int protocol_recvmsg(struct socket *sock, struct msghdr *msg, size_t size,
+		     int flags, const struct protocol_format *format);
+
+/* Splices received packets into a pipe without copying them through
+ * user space, so it's only used where the user format is the packet's
+ * own, the record protocol. The others fall back on the kernel's
+ * copying splice. */
+ssize_t protocol_splice_read(struct socket *sock, loff_t *ppos,
+			     struct pipe_inode_info *pipe, size_t len,
+			     unsigned int flags);
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(4,17,0)
 int protocol_getname(struct socket *sock, struct sockaddr *saddr,
@@ -44,4 +95,14 @@ int protocol_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg);
 int protocol_release(struct socket *sock);
 int protocol_bind(struct socket *sock, struct sockaddr *saddr, int len);
 
+int protocol_setsockopt(struct socket *sock, int level, int optname,
+			protocol_optval_t optval, unsigned int optlen);
+int protocol_getsockopt(struct socket *sock, int level, int optname,
+			char __user *optval, int __user *optlen);
+int protocol_mmap(struct file *file, struct socket *sock,
+		  struct vm_area_struct *vma);
+protocol_poll_t protocol_poll(struct file *file, struct socket *sock,
+			      poll_table *wait);
+void protocol_destruct(struct sock *sk);
+
 #endif /* __AVIONICS_PROTOCOL_H__ */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/bitmap.h>
+
+#include "rx-filter.h"
+#include "protocol.h"
+#include "avionics.h"
+#include "avionics-device.h"
+
+int rx_filter_match(const struct rx_filter *filter, __u32 value)
+{
+	if ((filter->config.flags & AVIONICS_RX_FILTER_LABEL_ENABLE)
+	    && !test_bit(ARINC429_LABEL(value), filter->labels)) {
+		return 0;
+	}
+
+	if ((filter->config.flags & AVIONICS_RX_FILTER_SDI_ENABLE)
+	    && !(filter->config.sdi_mask & (1 << ARINC429_SDI(value)))) {
+		return 0;
+	}
+
+	return 1;
+}
+
+struct sk_buff *rx_filter_skb(const struct rx_filter *filter,
+			      struct sk_buff *oskb)
+{
+	struct sk_buff *skb;
+	avionics_data *odata, *data;
+	int i, j, num_samples, matches = 0;
+
+	odata = (avionics_data *)oskb->data;
+	num_samples = oskb->len / sizeof(avionics_data);
+
+	for (i = 0; i < num_samples; i++) {
+		matches += rx_filter_match(filter, odata[i].value);
+	}
+
+	if (!matches) {
+		return NULL;
+	}
+
+	if (matches == num_samples) {
+		skb = skb_clone(oskb, GFP_ATOMIC);
+		if (!skb) {
+			return ERR_PTR(-ENOMEM);
+		}
+		return skb;
+	}
+
+	skb = alloc_skb(matches * sizeof(avionics_data), GFP_ATOMIC);
+	if (!skb) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* both timestamps, so SO_TIMESTAMPING still sees the hardware one */
+	protocol_init_skb(oskb->dev, skb);
+	skb->tstamp = oskb->tstamp;
+	*skb_hwtstamps(skb) = *skb_hwtstamps(oskb);
+
+	data = (avionics_data *)skb_put(skb, matches * sizeof(avionics_data));
+
+	for (i = 0, j = 0; i < num_samples; i++) {
+		if (rx_filter_match(filter, odata[i].value)) {
+			memcpy(&data[j++], &odata[i], sizeof(avionics_data));
+		}
+	}
+
+	return skb;
+}
+
+void rx_filter_free(struct rx_filter *filter)
+{
+	if (!filter) {
+		return;
+	}
+
+	kfree_rcu(filter, rcu);
+}
+
+struct rx_filter *rx_filter_alloc(const struct avionics_rx_filter *config)
+{
+	struct rx_filter *filter;
+	int label;
+
+	filter = kzalloc(sizeof(*filter), GFP_KERNEL);
+	if (!filter) {
+		pr_err("avionics-rx-filter: Failed to allocate filter.\n");
+		return NULL;
+	}
+
+	memcpy(&filter->config, config, sizeof(filter->config));
+
+	/* the first byte holds labels 0xFF to 0xF8 */
+	for (label = 0; label < RX_FILTER_LABELS; label++) {
+		if (config->label_filters[31 - (label >> 3)]
+		    & (1 << (label & 0x7))) {
+			set_bit(label, filter->labels);
+		}
+	}
+
+	return filter;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_RX_FILTER_H__
+#define __AVIONICS_RX_FILTER_H__
+
+#include <linux/skbuff.h>
+#include <linux/bitmap.h>
+#include <linux/rcupdate.h>
+
+#include "avionics.h"
+
+/* Receive filters select the ARINC-429 words delivered to a socket by
+ * label and SDI. */
+
+#define RX_FILTER_LABELS	256
+
+struct rx_filter {
+	struct rcu_head rcu;
+	struct avionics_rx_filter config;
+	DECLARE_BITMAP(labels, RX_FILTER_LABELS);
+};
+
+struct rx_filter *rx_filter_alloc(const struct avionics_rx_filter *config);
+void rx_filter_free(struct rx_filter *filter);
+
+int rx_filter_match(const struct rx_filter *filter, __u32 value);
+struct sk_buff *rx_filter_skb(const struct rx_filter *filter,
+			      struct sk_buff *skb);
+
+#endif /* __AVIONICS_RX_FILTER_H__ */
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/cpumask.h>
+
+#include "rx-poll.h"
+#include "device.h"
+#include "avionics.h"
+#include "avionics-device.h"
+
+#define RX_POLL_MAX_USECS	USEC_PER_SEC
+
+/* The word rate is measured over windows of this length when
+ * deciding whether to poll, it's also how often the thread wakes
+ * while the device is interrupting. */
+#define RX_POLL_WINDOW_MSECS	100
+
+struct rx_poll {
+	struct task_struct *thread;
+	struct net_device *dev;
+	struct avionics_ops *ops;
+	struct avionics_rx_poll config;
+	bool polling;
+};
+
+static void rx_poll_set(struct rx_poll *poll, bool polling)
+{
+	if (poll->polling == polling) {
+		return;
+	}
+
+	pr_debug("avionics-rx-poll: %s switching to %s\n", poll->dev->name,
+		 polling ? "polling" : "interrupts");
+
+	poll->ops->rx_irq(poll->dev, !polling);
+	poll->polling = polling;
+}
+
+static __u64 rx_poll_rate(struct rx_poll *poll, __u64 *bytes,
+			  ktime_t *start, ktime_t now)
+{
+	__u64 rx_bytes;
+	s64 elapsed;
+	__u64 words;
+
+	elapsed = ktime_us_delta(now, *start);
+	rx_bytes = device_rx_bytes(poll->dev);
+	words = div_u64(rx_bytes - *bytes, sizeof(avionics_data));
+
+	*bytes = rx_bytes;
+	*start = now;
+
+	if (elapsed <= 0) {
+		return 0;
+	}
+
+	return div64_u64(words * USEC_PER_SEC, elapsed);
+}
+
+static int rx_poll_thread(void *data)
+{
+	struct rx_poll *poll = data;
+	struct avionics_rx_poll *config = &poll->config;
+	__u64 bytes;
+	ktime_t start, now;
+	__u64 rate;
+	int err;
+
+	bytes = device_rx_bytes(poll->dev);
+	start = ktime_get();
+
+	if (config->mode == AVIONICS_RX_POLL_ON) {
+		rx_poll_set(poll, true);
+	}
+
+	while (!kthread_should_stop()) {
+		if (poll->polling) {
+			err = poll->ops->rx_poll(poll->dev);
+			if (err < 0) {
+				pr_err_ratelimited("avionics-rx-poll: Failed to"
+						   " poll %s: %d\n",
+						   poll->dev->name, err);
+			}
+
+			usleep_range(config->interval_usecs,
+				     config->interval_usecs
+				     + (config->interval_usecs / 4) + 1);
+		} else {
+			schedule_timeout_interruptible(
+					msecs_to_jiffies(RX_POLL_WINDOW_MSECS));
+		}
+
+		if (config->mode != AVIONICS_RX_POLL_ADAPTIVE) {
+			continue;
+		}
+
+		now = ktime_get();
+		if (ktime_ms_delta(now, start) < RX_POLL_WINDOW_MSECS) {
+			continue;
+		}
+
+		rate = rx_poll_rate(poll, &bytes, &start, now);
+
+		if (!poll->polling && (rate >= config->rate_high)) {
+			rx_poll_set(poll, true);
+		} else if (poll->polling && (rate < config->rate_low)) {
+			rx_poll_set(poll, false);
+		}
+	}
+
+	rx_poll_set(poll, false);
+
+	return 0;
+}
+
+int rx_poll_check(const struct avionics_rx_poll *config)
+{
+	if (config->mode > AVIONICS_RX_POLL_ADAPTIVE) {
+		pr_err("avionics-rx-poll: Unknown mode %u.\n", config->mode);
+		return -EINVAL;
+	}
+
+	if (config->mode == AVIONICS_RX_POLL_OFF) {
+		return 0;
+	}
+
+	if (!config->interval_usecs
+	    || (config->interval_usecs > RX_POLL_MAX_USECS)) {
+		pr_err("avionics-rx-poll: Interval %u must be between 1 and"
+		       " %lu usecs.\n", config->interval_usecs,
+		       RX_POLL_MAX_USECS);
+		return -EINVAL;
+	}
+
+	if ((config->mode == AVIONICS_RX_POLL_ADAPTIVE)
+	    && (config->rate_low > config->rate_high)) {
+		pr_err("avionics-rx-poll: Low rate %u above high rate %u.\n",
+		       config->rate_low, config->rate_high);
+		return -EINVAL;
+	}
+
+	if ((config->cpu >= 0) && ((config->cpu >= nr_cpu_ids)
+				   || !cpu_online(config->cpu))) {
+		pr_err("avionics-rx-poll: CPU %d isn't online.\n",
+		       config->cpu);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+void rx_poll_stop(struct rx_poll *poll)
+{
+	if (!poll) {
+		return;
+	}
+
+	kthread_stop(poll->thread);
+	kfree(poll);
+}
+
+struct rx_poll *rx_poll_start(struct net_device *dev,
+			      struct avionics_ops *ops,
+			      const struct avionics_rx_poll *config)
+{
+	struct rx_poll *poll;
+	int err;
+
+	if (!ops->rx_poll || !ops->rx_irq) {
+		pr_err("avionics-rx-poll: %s can't be polled.\n", dev->name);
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	err = rx_poll_check(config);
+	if (err) {
+		return ERR_PTR(err);
+	}
+
+	poll = kzalloc(sizeof(*poll), GFP_KERNEL);
+	if (!poll) {
+		pr_err("avionics-rx-poll: Failed to allocate poller.\n");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	poll->dev = dev;
+	poll->ops = ops;
+	memcpy(&poll->config, config, sizeof(poll->config));
+
+	poll->thread = kthread_create(rx_poll_thread, poll, "avionics/%s",
+				      dev->name);
+	if (IS_ERR(poll->thread)) {
+		pr_err("avionics-rx-poll: Failed to create poller for %s.\n",
+		       dev->name);
+		err = PTR_ERR(poll->thread);
+		kfree(poll);
+		return ERR_PTR(err);
+	}
+
+	if (config->cpu >= 0) {
+		kthread_bind(poll->thread, config->cpu);
+	}
+
+	wake_up_process(poll->thread);
+
+	return poll;
+}
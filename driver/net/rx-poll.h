@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_RX_POLL_H__
+#define __AVIONICS_RX_POLL_H__
+
+#include <linux/netdevice.h>
+
+#include "avionics.h"
+#include "avionics-device.h"
+
+/* Receive pollers are kernel threads that empty a device's receiver
+ * on a fixed cadence with its receive interrupt switched off, either
+ * all the time or only while the word rate is high enough that
+ * taking an interrupt for every burst costs more than polling. */
+
+struct rx_poll;
+
+int rx_poll_check(const struct avionics_rx_poll *config);
+struct rx_poll *rx_poll_start(struct net_device *dev,
+			      struct avionics_ops *ops,
+			      const struct avionics_rx_poll *config);
+void rx_poll_stop(struct rx_poll *poll);
+
+#endif /* __AVIONICS_RX_POLL_H__ */
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/skbuff.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+
+#include "rx-ring.h"
+#include "rx-filter.h"
+#include "avionics.h"
+#include "avionics-device.h"
+
+#define RX_RING_MAX_FRAMES	(1 << 20)
+
+struct rx_ring {
+	spinlock_t lock;
+	struct avionics_ring_header *header;
+	struct avionics_proto_timestamp_data *frames;
+	size_t size;
+	__u32 frame_nr;
+	__u32 threshold;
+	__u32 head;
+};
+
+static __u32 rx_ring_used(struct rx_ring *ring, __u32 head)
+{
+	__u32 used;
+
+	/* tail is written by user space so don't trust it further than
+	 * needed to keep from overwriting unread records */
+	used = head - smp_load_acquire(&ring->header->tail);
+	if (used > ring->frame_nr) {
+		return ring->frame_nr;
+	}
+
+	return used;
+}
+
+int rx_ring_rx(struct rx_ring *ring, struct sk_buff *skb,
+	       const struct rx_filter *filter)
+{
+	struct avionics_proto_timestamp_data *frame;
+	avionics_data *data;
+	__u32 used;
+	int i, num_samples;
+
+	data = (avionics_data *)skb->data;
+	num_samples = skb->len / sizeof(avionics_data);
+
+	spin_lock(&ring->lock);
+
+	used = rx_ring_used(ring, ring->head);
+
+	for (i = 0; i < num_samples; i++) {
+		if (filter && !rx_filter_match(filter, data[i].value)) {
+			continue;
+		}
+
+		if (used >= ring->frame_nr) {
+			ring->header->dropped++;
+			continue;
+		}
+
+		frame = &ring->frames[ring->head & (ring->frame_nr - 1)];
+		frame->time_msecs = div_s64(data[i].time_nsecs, NSEC_PER_MSEC);
+		frame->value = data[i].value;
+
+		ring->head++;
+		used++;
+	}
+
+	smp_store_release(&ring->header->head, ring->head);
+
+	spin_unlock(&ring->lock);
+
+	return used >= ring->threshold;
+}
+
+int rx_ring_readable(struct rx_ring *ring)
+{
+	return rx_ring_used(ring, READ_ONCE(ring->head)) >= ring->threshold;
+}
+
+int rx_ring_mmap(struct rx_ring *ring, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff) {
+		pr_err("avionics-rx-ring: Mapping must start at offset 0.\n");
+		return -EINVAL;
+	}
+
+	if ((vma->vm_end - vma->vm_start) != ring->size) {
+		pr_err("avionics-rx-ring: Mapping must be %zu bytes not %lu.\n",
+		       ring->size, vma->vm_end - vma->vm_start);
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, ring->header, 0);
+}
+
+void rx_ring_get_req(struct rx_ring *ring, struct avionics_ring_req *req)
+{
+	req->frame_nr = ring->frame_nr;
+	req->threshold = ring->threshold;
+}
+
+void rx_ring_free(struct rx_ring *ring)
+{
+	if (!ring) {
+		return;
+	}
+
+	vfree(ring->header);
+	kfree(ring);
+}
+
+struct rx_ring *rx_ring_alloc(const struct avionics_ring_req *req)
+{
+	struct rx_ring *ring;
+	size_t offset;
+
+	if (!req->frame_nr || !is_power_of_2(req->frame_nr)
+	    || (req->frame_nr > RX_RING_MAX_FRAMES)) {
+		pr_err("avionics-rx-ring: Frame count %u must be a power of 2"
+		       " no larger than %u.\n", req->frame_nr,
+		       RX_RING_MAX_FRAMES);
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (req->threshold > req->frame_nr) {
+		pr_err("avionics-rx-ring: Threshold %u larger than ring.\n",
+		       req->threshold);
+		return ERR_PTR(-EINVAL);
+	}
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring) {
+		pr_err("avionics-rx-ring: Failed to allocate ring.\n");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	offset = PAGE_ALIGN(sizeof(*ring->header));
+	ring->size = offset + PAGE_ALIGN(req->frame_nr
+					 * sizeof(ring->frames[0]));
+
+	ring->header = vmalloc_user(ring->size);
+	if (!ring->header) {
+		pr_err("avionics-rx-ring: Failed to allocate %zu byte ring.\n",
+		       ring->size);
+		kfree(ring);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	spin_lock_init(&ring->lock);
+	ring->frames = (void *)ring->header + offset;
+	ring->frame_nr = req->frame_nr;
+	ring->threshold = req->threshold ? req->threshold : 1;
+
+	ring->header->frame_nr = ring->frame_nr;
+	ring->header->offset = offset;
+
+	return ring;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_RX_RING_H__
+#define __AVIONICS_RX_RING_H__
+
+#include <linux/mm.h>
+#include <linux/skbuff.h>
+
+#include "rx-filter.h"
+#include "avionics.h"
+
+/* Receive rings are shared with user space through mmap, received
+ * records are written directly into the ring instead of being queued
+ * on the socket. */
+
+struct rx_ring;
+
+struct rx_ring *rx_ring_alloc(const struct avionics_ring_req *req);
+void rx_ring_free(struct rx_ring *ring);
+
+void rx_ring_get_req(struct rx_ring *ring, struct avionics_ring_req *req);
+int rx_ring_rx(struct rx_ring *ring, struct sk_buff *skb,
+	       const struct rx_filter *filter);
+int rx_ring_readable(struct rx_ring *ring);
+int rx_ring_mmap(struct rx_ring *ring, struct vm_area_struct *vma);
+
+#endif /* __AVIONICS_RX_RING_H__ */
@@ -18,30 +18,153 @@
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
 #include <linux/list.h>
+#include <linux/bitmap.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rtnetlink.h>
 #include <net/sock.h>
 
 #include "avionics.h"
+#include "avionics-device.h"
 #include "socket-list.h"
+#include "label-table.h"
+#include "device.h"
 
 struct socket_info {
 	struct hlist_node node;
+	struct rcu_head rcu;
 	struct sock *sk;
 	void (*rx_func)(struct sk_buff*, struct sock *);
+	int filtered;
+	DECLARE_BITMAP(labels, SOCKET_LIST_LABELS);
+};
+
+/* The dispatch table is rebuilt whenever a socket is added, removed or
+ * changes its labels, the receive path only ever reads it under RCU.
+ * For each label there is a bitmap of the sockets that want it, plus
+ * one for the sockets that want everything. */
+struct socket_table {
+	struct rcu_head rcu;
+	int count;
+	int filtered;
+	int records;
+	unsigned int longs;
+	unsigned long __percpu *scratch;
+	struct socket_info **sockets;
+	unsigned long *any;
+	unsigned long *labels;
 };
 
 struct socket_list {
+	struct mutex lock;
+	struct kref ref;
+	struct rcu_head rcu;
 	struct hlist_head head;
-	int remove_on_zero_entries;
+	struct socket_table __rcu *table;
+	struct label_table __rcu *labels;
+	unsigned long __percpu *scratch;
+	int scratch_bits;
 	int entries;
+	int dead;
 };
 
-static DEFINE_SPINLOCK(socket_list_lock);
 static struct kmem_cache *socket_list_cache __read_mostly;
 
+/* sockets bound to ifindex 0 receive from every device, they're kept
+ * on their own list which is reached by passing a NULL device */
+static struct socket_list *socket_list_any;
+
+static const char *socket_list_name(struct net_device *dev)
+{
+	return dev ? dev->name : "any";
+}
+
+static unsigned long *socket_table_label(struct socket_table *table,
+					 int label)
+{
+	return &table->labels[label * table->longs];
+}
+
+/* Packets that aren't records have no labels to dispatch on, so every
+ * socket gets them. */
+static void socket_table_rx(struct socket_table *table, struct sk_buff *skb,
+			    bool packets)
+{
+	DECLARE_BITMAP(seen, SOCKET_LIST_LABELS);
+	avionics_data *data;
+	unsigned long *mask;
+	int i, label, num_samples;
+
+	if (!table->filtered || packets) {
+		for (i = 0; i < table->count; i++) {
+			table->sockets[i]->rx_func(skb, table->sockets[i]->sk);
+		}
+		return;
+	}
+
+	/* receive runs in softirq context so the per-cpu scratch
+	 * bitmap can't be used by anything else while we have it */
+	mask = this_cpu_ptr(table->scratch);
+	bitmap_copy(mask, table->any, table->count);
+	bitmap_zero(seen, SOCKET_LIST_LABELS);
+
+	data = (avionics_data *)skb->data;
+	num_samples = skb->len / sizeof(avionics_data);
+
+	for (i = 0; i < num_samples; i++) {
+		label = ARINC429_LABEL(data[i].value);
+		if (!__test_and_set_bit(label, seen)) {
+			bitmap_or(mask, mask, socket_table_label(table, label),
+				  table->count);
+		}
+	}
+
+	for_each_set_bit(i, mask, table->count) {
+		table->sockets[i]->rx_func(skb, table->sockets[i]->sk);
+	}
+}
+
+/* Record sockets see the interface each word came from in its record,
+ * it's filled in here once for every socket rather than as each one
+ * copies the packet. The packet is only copied first if its data is
+ * shared with something else, otherwise it's tagged in place. */
+static struct sk_buff *socket_list_tag(struct net_device *dev,
+				       struct sk_buff *skb)
+{
+	struct sk_buff *nskb;
+	avionics_data *data;
+	int i, num_samples;
+
+	if (skb_shared(skb) || skb_cloned(skb) || skb_is_nonlinear(skb)) {
+		nskb = skb_copy(skb, GFP_ATOMIC);
+		if (!nskb) {
+			pr_err_ratelimited("socket-list: Failed to copy packet"
+					   " to tag it\n");
+			return NULL;
+		}
+
+		*skb_hwtstamps(nskb) = *skb_hwtstamps(skb);
+		skb = nskb;
+	}
+
+	data = (avionics_data *)skb->data;
+	num_samples = skb->len / sizeof(avionics_data);
+
+	for (i = 0; i < num_samples; i++) {
+		data[i].ifindex = dev->ifindex;
+	}
+
+	return skb;
+}
+
 int socket_list_rx_funcs(struct net_device *dev, struct sk_buff *skb)
 {
 	struct socket_list *sk_list;
-	struct socket_info *sk_info;
+	struct socket_table *table, *any;
+	struct label_table *labels;
+	struct sk_buff *tagged, *copy = NULL;
+	bool packets;
 
 	if (!dev) {
 		pr_err("socket-list: Not a valid device.\n");
@@ -53,161 +176,499 @@ int socket_list_rx_funcs(struct net_device *dev, struct sk_buff *skb)
 		return -ENODEV;
 	}
 
-	if (!dev->ml_priv) {
+	rcu_read_lock();
+
+	sk_list = (struct socket_list *)READ_ONCE(dev->ml_priv);
+	if (!sk_list) {
 		pr_err("socket-list: %s has no registerd socket list.\n",
 		       dev->name);
+		rcu_read_unlock();
 		return -ENODEV;
 	}
 
-	sk_list = (struct socket_list *)dev->ml_priv;
+	packets = device_rx_packets(dev);
+	table = rcu_dereference(sk_list->table);
+	any = rcu_dereference(socket_list_any->table);
 
-	rcu_read_lock();
-	hlist_for_each_entry_rcu(sk_info, &sk_list->head, node) {
-		sk_info->rx_func(skb, sk_info->sk);
+	if (!packets && ((table && table->records)
+			 || (any && any->records))) {
+		tagged = socket_list_tag(dev, skb);
+		if (tagged && (tagged != skb)) {
+			copy = tagged;
+			skb = copy;
+		}
 	}
+
+	labels = rcu_dereference(sk_list->labels);
+	if (labels && !packets) {
+		label_table_rx(labels, skb);
+	}
+
+	if (table) {
+		socket_table_rx(table, skb, packets);
+	}
+
+	if (any) {
+		socket_table_rx(any, skb, packets);
+	}
+
 	rcu_read_unlock();
 
+	/* the sockets have their own clones of a copy by now */
+	if (copy) {
+		consume_skb(copy);
+	}
+
 	return 0;
 }
 
-void socket_list_remove_socket(struct net_device *dev,
-			 void (*rx_func)(struct sk_buff *, struct sock *),
-			 struct sock *sk)
+static void socket_table_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct socket_table, rcu));
+}
+
+static void socket_info_free_rcu(struct rcu_head *head)
 {
-	struct socket_list *sk_list;
 	struct socket_info *sk_info;
 
-	pr_debug("socket-list: Unregistering socket with %s\n", dev->name);
+	sk_info = container_of(head, struct socket_info, rcu);
+
+	sock_put(sk_info->sk);
+	kmem_cache_free(socket_list_cache, sk_info);
+}
+
+static void socket_list_free_rcu(struct rcu_head *head)
+{
+	struct socket_list *sk_list;
+
+	sk_list = container_of(head, struct socket_list, rcu);
+
+	label_table_put(rcu_dereference_protected(sk_list->labels, 1));
+	free_percpu(sk_list->scratch);
+	kfree(sk_list);
+}
+
+static void socket_list_release(struct kref *ref)
+{
+	struct socket_list *sk_list;
+
+	sk_list = container_of(ref, struct socket_list, ref);
+	call_rcu(&sk_list->rcu, socket_list_free_rcu);
+}
+
+static struct socket_list *socket_list_get(struct net_device *dev)
+{
+	struct socket_list *sk_list;
 
 	if (!dev) {
-		pr_err("socket-list: Not a valid device.\n");
-		return;
+		kref_get(&socket_list_any->ref);
+		return socket_list_any;
 	}
 
 	if (dev->type != ARPHRD_AVIONICS) {
 		pr_err("socket-list: %s is not a valid device.\n", dev->name);
-		return;
+		return NULL;
 	}
 
-	if (!dev->ml_priv) {
-		pr_err("socket-list: %s has no registerd socket list.\n",
-		       dev->name);
-		return;
+	rcu_read_lock();
+	sk_list = (struct socket_list *)READ_ONCE(dev->ml_priv);
+	if (sk_list && !kref_get_unless_zero(&sk_list->ref)) {
+		sk_list = NULL;
 	}
+	rcu_read_unlock();
 
-	spin_lock(&socket_list_lock);
+	if (!sk_list) {
+		pr_debug("socket-list: %s has no registerd socket list.\n",
+			 dev->name);
+	}
 
-	sk_list = (struct socket_list *)dev->ml_priv;
+	return sk_list;
+}
 
-	rcu_read_lock();
-	hlist_for_each_entry_rcu(sk_info, &sk_list->head, node) {
-		if ((sk_info->rx_func == rx_func)
-		    && (sk_info->sk == sk)) {
-			break;
+static void socket_list_put(struct socket_list *sk_list)
+{
+	kref_put(&sk_list->ref, socket_list_release);
+}
+
+static struct socket_table *socket_table_build(struct socket_list *sk_list,
+					       gfp_t gfp)
+{
+	struct socket_table *table;
+	struct socket_info *sk_info;
+	unsigned int longs;
+	size_t size;
+	int i = 0, label;
+
+	if (!sk_list->entries) {
+		return NULL;
+	}
+
+	longs = BITS_TO_LONGS(sk_list->entries);
+	size = sizeof(*table)
+		+ sk_list->entries * sizeof(table->sockets[0])
+		+ (SOCKET_LIST_LABELS + 1) * longs * sizeof(unsigned long);
+
+	table = kzalloc(size, gfp);
+	if (!table) {
+		pr_err("socket-list: Failed to allocate dispatch table.\n");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	table->count = sk_list->entries;
+	table->longs = longs;
+	table->scratch = sk_list->scratch;
+	table->sockets = (struct socket_info **)(table + 1);
+	table->any = (unsigned long *)(table->sockets + table->count);
+	table->labels = table->any + longs;
+
+	hlist_for_each_entry(sk_info, &sk_list->head, node) {
+		table->sockets[i] = sk_info;
+
+		if (sk_info->sk->sk_protocol == AVIONICS_PROTO_RECORD) {
+			table->records++;
 		}
+
+		if (!sk_info->filtered) {
+			set_bit(i, table->any);
+		} else {
+			table->filtered = 1;
+			for_each_set_bit(label, sk_info->labels,
+					 SOCKET_LIST_LABELS) {
+				set_bit(i, socket_table_label(table, label));
+			}
+		}
+
+		i++;
 	}
-	rcu_read_unlock();
 
+	return table;
+}
+
+static void socket_list_publish(struct socket_list *sk_list,
+				struct socket_table *table)
+{
+	struct socket_table *old;
+
+	old = rcu_dereference_protected(sk_list->table,
+					lockdep_is_held(&sk_list->lock));
+	rcu_assign_pointer(sk_list->table, table);
+
+	if (old) {
+		call_rcu(&old->rcu, socket_table_free_rcu);
+	}
+}
+
+static struct socket_info *socket_list_find(struct socket_list *sk_list,
+			void (*rx_func)(struct sk_buff *, struct sock *),
+			struct sock *sk)
+{
+	struct socket_info *sk_info;
+
+	hlist_for_each_entry(sk_info, &sk_list->head, node) {
+		if ((sk_info->rx_func == rx_func) && (sk_info->sk == sk)) {
+			return sk_info;
+		}
+	}
+
+	return NULL;
+}
+
+static void socket_info_set_labels(struct socket_info *sk_info,
+				   const unsigned long *labels)
+{
+	if (labels) {
+		bitmap_copy(sk_info->labels, labels, SOCKET_LIST_LABELS);
+		sk_info->filtered = 1;
+	} else {
+		bitmap_zero(sk_info->labels, SOCKET_LIST_LABELS);
+		sk_info->filtered = 0;
+	}
+}
+
+void socket_list_remove_socket(struct net_device *dev,
+			 void (*rx_func)(struct sk_buff *, struct sock *),
+			 struct sock *sk)
+{
+	struct socket_list *sk_list;
+	struct socket_info *sk_info;
+	struct socket_table *table;
+
+	sk_list = socket_list_get(dev);
+	if (!sk_list) {
+		return;
+	}
+
+	pr_debug("socket-list: Unregistering socket with %s\n",
+		 socket_list_name(dev));
+
+	mutex_lock(&sk_list->lock);
+
+	sk_info = socket_list_find(sk_list, rx_func, sk);
 	if (!sk_info) {
 		pr_err("socket-list: failed to find socket in device %s.\n",
-		       dev->name);
-		spin_unlock(&socket_list_lock);
+		       socket_list_name(dev));
+		mutex_unlock(&sk_list->lock);
+		socket_list_put(sk_list);
 		return;
 	}
 
-	hlist_del_rcu(&sk_info->node);
+	hlist_del(&sk_info->node);
 	sk_list->entries--;
 
-	if (sk_list->remove_on_zero_entries && (sk_list->entries <= 0)) {
-		pr_debug("socket-list: Removing socket list from %s.\n",
-			 dev->name);
-		kfree(sk_list);
-		dev->ml_priv = NULL;
-	}
+	/* removing a socket can't be allowed to fail, the old table
+	 * still points at it */
+	table = socket_table_build(sk_list, GFP_KERNEL | __GFP_NOFAIL);
+	socket_list_publish(sk_list, table);
 
-	spin_unlock(&socket_list_lock);
+	mutex_unlock(&sk_list->lock);
 
-	kmem_cache_free(socket_list_cache, sk_info);
+	call_rcu(&sk_info->rcu, socket_info_free_rcu);
 
+	socket_list_put(sk_list);
 }
 
-int socket_list_add_socket(struct net_device *dev,
+int socket_list_update_socket(struct net_device *dev,
 			void (*rx_func)(struct sk_buff *, struct sock *),
-			struct sock *sk)
+			struct sock *sk, const unsigned long *labels)
 {
+	DECLARE_BITMAP(old_labels, SOCKET_LIST_LABELS);
 	struct socket_list *sk_list;
 	struct socket_info *sk_info;
+	struct socket_table *table;
+	int old_filtered;
 
-	pr_debug("socket-list: Registering socket with %s\n", dev->name);
-
-	if (!dev) {
-		pr_err("socket-list: Not a valid device.\n");
+	sk_list = socket_list_get(dev);
+	if (!sk_list) {
 		return -ENODEV;
 	}
 
-	if (dev->type != ARPHRD_AVIONICS) {
-		pr_err("socket-list: %s is not a valid device.\n", dev->name);
-		return -ENODEV;
+	mutex_lock(&sk_list->lock);
+
+	sk_info = socket_list_find(sk_list, rx_func, sk);
+	if (!sk_info) {
+		pr_err("socket-list: failed to find socket in device %s.\n",
+		       socket_list_name(dev));
+		mutex_unlock(&sk_list->lock);
+		socket_list_put(sk_list);
+		return -ENOENT;
 	}
 
-	if (!dev->ml_priv) {
-		pr_err("socket-list: %s has no registerd socket list.\n",
-		       dev->name);
-		return -ENODEV;
+	/* the table still refers to sk_info but only the labels in
+	 * the table are used by the receive path */
+	bitmap_copy(old_labels, sk_info->labels, SOCKET_LIST_LABELS);
+	old_filtered = sk_info->filtered;
+	socket_info_set_labels(sk_info, labels);
+
+	table = socket_table_build(sk_list, GFP_KERNEL);
+	if (IS_ERR(table)) {
+		bitmap_copy(sk_info->labels, old_labels, SOCKET_LIST_LABELS);
+		sk_info->filtered = old_filtered;
+		mutex_unlock(&sk_list->lock);
+		socket_list_put(sk_list);
+		return PTR_ERR(table);
 	}
-	spin_lock(&socket_list_lock);
 
-	sk_list = (struct socket_list *)dev->ml_priv;
+	socket_list_publish(sk_list, table);
 
-	rcu_read_lock();
-	hlist_for_each_entry_rcu(sk_info, &sk_list->head, node) {
-		if (sk_info->rx_func == rx_func
-		    && sk_info->sk == sk) {
-			pr_info("Socket already attached to %s\n", dev->name);
-			rcu_read_unlock();
-			spin_unlock(&socket_list_lock);
-			return 0;
-		}
+	mutex_unlock(&sk_list->lock);
+	socket_list_put(sk_list);
+
+	return 0;
+}
+
+int socket_list_add_socket(struct net_device *dev,
+			void (*rx_func)(struct sk_buff *, struct sock *),
+			struct sock *sk, const unsigned long *labels)
+{
+	struct socket_list *sk_list;
+	struct socket_info *sk_info;
+	struct socket_table *table;
+	unsigned long __percpu *scratch = NULL, *old_scratch;
+	int bits = 0, old_bits;
+
+	sk_list = socket_list_get(dev);
+	if (!sk_list) {
+		return -ENODEV;
 	}
-	rcu_read_unlock();
+
+	pr_debug("socket-list: Registering socket with %s\n",
+		 socket_list_name(dev));
 
 	sk_info = kmem_cache_alloc(socket_list_cache, GFP_KERNEL);
 	if (!sk_info) {
-		pr_info("Failed to allocate socket info\n");
+		pr_err("socket-list: Failed to allocate socket info\n");
+		socket_list_put(sk_list);
 		return -ENOMEM;
 	}
 
 	sk_info->sk = sk;
 	sk_info->rx_func = rx_func;
+	socket_info_set_labels(sk_info, labels);
 
-	hlist_add_head_rcu(&sk_info->node, &sk_list->head);
+	mutex_lock(&sk_list->lock);
+
+	if (sk_list->dead) {
+		mutex_unlock(&sk_list->lock);
+		kmem_cache_free(socket_list_cache, sk_info);
+		socket_list_put(sk_list);
+		return -ENODEV;
+	}
+
+	if (socket_list_find(sk_list, rx_func, sk)) {
+		pr_info("socket-list: Socket already attached to %s\n",
+			socket_list_name(dev));
+		mutex_unlock(&sk_list->lock);
+		kmem_cache_free(socket_list_cache, sk_info);
+		socket_list_put(sk_list);
+		return 0;
+	}
+
+	/* the scratch bitmap used by the receive path has to be able to
+	 * hold every socket, grow it with some room to spare */
+	if ((sk_list->entries + 1) > sk_list->scratch_bits) {
+		bits = round_up((sk_list->entries + 1) * 2, BITS_PER_LONG);
+		scratch = __alloc_percpu(BITS_TO_LONGS(bits)
+					 * sizeof(unsigned long),
+					 sizeof(unsigned long));
+		if (!scratch) {
+			pr_err("socket-list: Failed to allocate scratch bitmap.\n");
+			mutex_unlock(&sk_list->lock);
+			kmem_cache_free(socket_list_cache, sk_info);
+			socket_list_put(sk_list);
+			return -ENOMEM;
+		}
+	}
+
+	old_scratch = sk_list->scratch;
+	old_bits = sk_list->scratch_bits;
+	if (scratch) {
+		sk_list->scratch = scratch;
+		sk_list->scratch_bits = bits;
+	}
+
+	hlist_add_head(&sk_info->node, &sk_list->head);
 	sk_list->entries++;
 
-	spin_unlock(&socket_list_lock);
+	table = socket_table_build(sk_list, GFP_KERNEL);
+	if (IS_ERR(table)) {
+		hlist_del(&sk_info->node);
+		sk_list->entries--;
+		sk_list->scratch = old_scratch;
+		sk_list->scratch_bits = old_bits;
+		mutex_unlock(&sk_list->lock);
+		free_percpu(scratch);
+		kmem_cache_free(socket_list_cache, sk_info);
+		socket_list_put(sk_list);
+		return PTR_ERR(table);
+	}
+
+	sock_hold(sk);
+	socket_list_publish(sk_list, table);
+
+	mutex_unlock(&sk_list->lock);
+
+	/* once the new table is visible nothing can be using the old
+	 * scratch bitmap after a grace period */
+	if (scratch && old_scratch) {
+		synchronize_rcu();
+		free_percpu(old_scratch);
+	}
+
+	socket_list_put(sk_list);
 
 	return 0;
 }
 
+struct label_table *socket_list_get_label_table(struct net_device *dev)
+{
+	struct socket_list *sk_list;
+	struct label_table *labels;
+
+	sk_list = socket_list_get(dev);
+	if (!sk_list) {
+		return ERR_PTR(-ENODEV);
+	}
+
+	mutex_lock(&sk_list->lock);
+
+	if (sk_list->dead) {
+		mutex_unlock(&sk_list->lock);
+		socket_list_put(sk_list);
+		return ERR_PTR(-ENODEV);
+	}
+
+	/* the table is created by the first socket that wants it and
+	 * then kept until the device goes away */
+	labels = rcu_dereference_protected(sk_list->labels,
+					   lockdep_is_held(&sk_list->lock));
+	if (!labels) {
+		labels = label_table_alloc();
+		if (IS_ERR(labels)) {
+			mutex_unlock(&sk_list->lock);
+			socket_list_put(sk_list);
+			return labels;
+		}
+
+		rcu_assign_pointer(sk_list->labels, labels);
+	}
+
+	label_table_get(labels);
+
+	mutex_unlock(&sk_list->lock);
+	socket_list_put(sk_list);
+
+	return labels;
+}
+
 void socket_list_remove(struct net_device *dev)
 {
 	struct socket_list *sk_list;
+	struct socket_info *sk_info;
+	struct hlist_node *tmp;
 
 	pr_debug("socket-list: Removing socket list from %s\n",dev->name);
 
-	spin_lock(&socket_list_lock);
-
 	sk_list = (struct socket_list *)dev->ml_priv;
-	if (sk_list) {
-		sk_list->remove_on_zero_entries = 1;
-		if (!sk_list->entries)
-			kfree(sk_list);
-		dev->ml_priv = NULL;
-	} else {
+	if (!sk_list) {
 		pr_err("socket-list: receive list not found for device %s\n",
 		       dev->name);
+		return;
+	}
+
+	WRITE_ONCE(dev->ml_priv, NULL);
+
+	mutex_lock(&sk_list->lock);
+
+	sk_list->dead = 1;
+
+	hlist_for_each_entry_safe(sk_info, tmp, &sk_list->head, node) {
+		hlist_del(&sk_info->node);
+		call_rcu(&sk_info->rcu, socket_info_free_rcu);
+	}
+	sk_list->entries = 0;
+
+	socket_list_publish(sk_list, NULL);
+
+	mutex_unlock(&sk_list->lock);
+
+	socket_list_put(sk_list);
+}
+
+static struct socket_list *socket_list_alloc(void)
+{
+	struct socket_list *sk_list;
+
+	sk_list = kzalloc(sizeof(*sk_list), GFP_KERNEL);
+	if (!sk_list) {
+		pr_err("socket-list: Failed to allocate socket list.\n");
+		return NULL;
 	}
 
-	spin_unlock(&socket_list_lock);
+	mutex_init(&sk_list->lock);
+	kref_init(&sk_list->ref);
+	INIT_HLIST_HEAD(&sk_list->head);
+
+	return sk_list;
 }
 
 int socket_list_add(struct net_device *dev)
@@ -222,36 +683,34 @@ int socket_list_add(struct net_device *dev)
 		return -EINVAL;
 	}
 
-	sk_list = kzalloc(sizeof(*sk_list), GFP_KERNEL);
+	sk_list = socket_list_alloc();
 	if (!sk_list) {
-		pr_err("socket-list: Failed to allocate socket list.\n");
 		return -ENOMEM;
 	}
 
-	dev->ml_priv = sk_list;
+	WRITE_ONCE(dev->ml_priv, sk_list);
 
 	return 0;
 }
 
 void socket_list_exit(void)
 {
-	struct socket_list *sk_list;
 	struct net_device *dev;
 
-	/* remove created dev_rcv_lists from still registered devices */
-	rcu_read_lock();
-	for_each_netdev_rcu(&init_net, dev) {
+	/* remove created socket lists from still registered devices */
+	rtnl_lock();
+	for_each_netdev(&init_net, dev) {
 		if (dev->type == ARPHRD_AVIONICS && dev->ml_priv) {
-			sk_list = (struct socket_list *)dev->ml_priv;
-			if (sk_list->entries) {
-				pr_err("socket-list: %s had sockets attached\n",
-				       dev->name);
-			}
-			kfree(sk_list);
-			dev->ml_priv = NULL;
+			pr_err("socket-list: %s still has a socket list\n",
+			       dev->name);
+			socket_list_remove(dev);
 		}
 	}
-	rcu_read_unlock();
+	rtnl_unlock();
+
+	/* every socket is closed before the module can be unloaded, so
+	 * the wildcard list is empty by now */
+	socket_list_put(socket_list_any);
 	rcu_barrier();
 
 	kmem_cache_destroy(socket_list_cache);
@@ -267,5 +726,11 @@ int socket_list_init(void)
 		return -ENOMEM;
 	}
 
+	socket_list_any = socket_list_alloc();
+	if (!socket_list_any) {
+		kmem_cache_destroy(socket_list_cache);
+		return -ENOMEM;
+	}
+
 	return 0;
 }
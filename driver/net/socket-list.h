@@ -16,14 +16,36 @@
 
 /* Socket lists are used to track a list of sockets that are
  * attached to a specific device. This is used to determine
- * where to send any incoming packets. */
+ * where to send any incoming packets.
+ *
+ * Sockets can also register the set of ARINC-429 labels they're
+ * interested in, packets are then only passed to sockets that want
+ * at least one of the labels they contain.
+ *
+ * Each list can also keep a table of the newest value of every label,
+ * see label-table.h.
+ *
+ * Sockets added with a NULL device are on the wildcard list, and are
+ * passed packets from every device.
+ *
+ * While any record sockets are listening, the records in each packet
+ * are tagged with the device's ifindex before it's passed on. */
+
+#define SOCKET_LIST_LABELS	256
+
+struct label_table;
 
 void socket_list_remove_socket(struct net_device *dev,
 			 void (*rx_func)(struct sk_buff *, struct sock *),
 			 struct sock *sk);
 int socket_list_add_socket(struct net_device *dev,
 			void (*rx_func)(struct sk_buff *, struct sock *),
-			struct sock *sk);
+			struct sock *sk, const unsigned long *labels);
+int socket_list_update_socket(struct net_device *dev,
+			void (*rx_func)(struct sk_buff *, struct sock *),
+			struct sock *sk, const unsigned long *labels);
+
+struct label_table *socket_list_get_label_table(struct net_device *dev);
 
 void socket_list_remove(struct net_device *dev);
 int socket_list_add(struct net_device *dev);
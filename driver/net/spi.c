@@ -0,0 +1,209 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/completion.h>
+#include <linux/spi/spi.h>
+
+#include "avionics-spi.h"
+
+struct avionics_spi_burst {
+	struct spi_device *spi;
+	struct spi_message message;
+	struct completion done;
+	struct spi_transfer *xfers;
+	unsigned int max_xfers;
+	unsigned int num_xfers;
+	__u8 *tx;
+	__u8 *rx;
+	size_t max_bytes;
+	size_t used;
+	int err;
+	bool busy;
+};
+
+void avionics_spi_burst_reset(struct avionics_spi_burst *burst)
+{
+	WARN_ON(burst->busy);
+
+	spi_message_init(&burst->message);
+	burst->num_xfers = 0;
+	burst->used = 0;
+	burst->err = 0;
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_reset);
+
+__u8 *avionics_spi_burst_add(struct avionics_spi_burst *burst,
+			     const void *tx, unsigned int len)
+{
+	struct spi_transfer *xfer;
+
+	if ((burst->num_xfers >= burst->max_xfers)
+	    || ((burst->used + len) > burst->max_bytes)) {
+		pr_err_ratelimited("avionics-spi: Burst is full\n");
+		burst->err = -ENOSPC;
+		return NULL;
+	}
+
+	/* the chip select has to go up between transfers, the opcode
+	 * comes first in every one */
+	if (burst->num_xfers) {
+		burst->xfers[burst->num_xfers - 1].cs_change = 1;
+	}
+
+	xfer = &burst->xfers[burst->num_xfers++];
+	memset(xfer, 0, sizeof(*xfer));
+
+	if (tx) {
+		memcpy(&burst->tx[burst->used], tx, len);
+	} else {
+		memset(&burst->tx[burst->used], 0, len);
+	}
+
+	xfer->len = len;
+	xfer->tx_buf = &burst->tx[burst->used];
+	xfer->rx_buf = &burst->rx[burst->used];
+	spi_message_add_tail(xfer, &burst->message);
+
+	burst->used += len;
+
+	return xfer->rx_buf;
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_add);
+
+__u8 *avionics_spi_burst_rx(struct avionics_spi_burst *burst,
+			    unsigned int xfer)
+{
+	if (xfer >= burst->num_xfers) {
+		return NULL;
+	}
+
+	return burst->xfers[xfer].rx_buf;
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_rx);
+
+int avionics_spi_burst_sync(struct avionics_spi_burst *burst)
+{
+	if (burst->err) {
+		return burst->err;
+	}
+
+	if (!burst->num_xfers) {
+		return 0;
+	}
+
+	return spi_sync(burst->spi, &burst->message);
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_sync);
+
+static void avionics_spi_burst_complete(void *context)
+{
+	struct avionics_spi_burst *burst = context;
+
+	complete(&burst->done);
+}
+
+int avionics_spi_burst_submit(struct avionics_spi_burst *burst)
+{
+	int err;
+
+	if (burst->err) {
+		return burst->err;
+	}
+
+	if (!burst->num_xfers) {
+		return 0;
+	}
+
+	reinit_completion(&burst->done);
+	burst->message.complete = avionics_spi_burst_complete;
+	burst->message.context = burst;
+
+	err = spi_async(burst->spi, &burst->message);
+	if (err) {
+		pr_err("avionics-spi: Failed to start burst: %d\n", err);
+		return err;
+	}
+
+	burst->busy = true;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_submit);
+
+int avionics_spi_burst_wait(struct avionics_spi_burst *burst)
+{
+	if (!burst->busy) {
+		return 0;
+	}
+
+	wait_for_completion(&burst->done);
+	burst->busy = false;
+
+	return burst->message.status;
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_wait);
+
+void avionics_spi_burst_free(struct avionics_spi_burst *burst)
+{
+	if (!burst) {
+		return;
+	}
+
+	avionics_spi_burst_wait(burst);
+
+	kfree(burst->rx);
+	kfree(burst->tx);
+	kfree(burst->xfers);
+	kfree(burst);
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_free);
+
+struct avionics_spi_burst *avionics_spi_burst_alloc(struct spi_device *spi,
+						    unsigned int max_xfers,
+						    size_t max_bytes)
+{
+	struct avionics_spi_burst *burst;
+
+	burst = kzalloc(sizeof(*burst), GFP_KERNEL);
+	if (!burst) {
+		pr_err("avionics-spi: Failed to allocate burst\n");
+		return NULL;
+	}
+
+	/* kmalloc'd buffers are the ones SPI controllers can DMA from,
+	 * the transfers are kept apart so nothing else shares their
+	 * cache lines */
+	burst->xfers = kcalloc(max_xfers, sizeof(*burst->xfers), GFP_KERNEL);
+	burst->tx = kzalloc(max_bytes, GFP_KERNEL);
+	burst->rx = kzalloc(max_bytes, GFP_KERNEL);
+	if (!burst->xfers || !burst->tx || !burst->rx) {
+		pr_err("avionics-spi: Failed to allocate burst buffers\n");
+		avionics_spi_burst_free(burst);
+		return NULL;
+	}
+
+	burst->spi = spi;
+	burst->max_xfers = max_xfers;
+	burst->max_bytes = max_bytes;
+	init_completion(&burst->done);
+	avionics_spi_burst_reset(burst);
+
+	return burst;
+}
+EXPORT_SYMBOL_GPL(avionics_spi_burst_alloc);
@@ -0,0 +1,444 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/version.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/hrtimer.h>
+#include <linux/timerqueue.h>
+#include <linux/interrupt.h>
+#include <linux/math64.h>
+
+#include "tx-periodic.h"
+#include "protocol.h"
+#include "avionics.h"
+#include "avionics-device.h"
+
+/* Anything faster would be most of an ARINC-429 bus for one word. */
+#define TX_PERIODIC_MIN_USECS	1000
+#define TX_PERIODIC_MAX_USECS	60000000
+
+/* Words due this close together are sent in the same packet. */
+#define TX_PERIODIC_SLACK_NSECS	(100 * NSEC_PER_USEC)
+
+#define TX_PERIODIC_SIZE	PAGE_ALIGN(AVIONICS_TX_PERIODIC_SLOTS	\
+					   * sizeof(__u32))
+
+/* Before 4.16 hrtimers always expire in hard interrupt context, which
+ * can't queue packets, so the timer hands off to a tasklet. */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+#define TX_PERIODIC_MODE	HRTIMER_MODE_ABS
+#else
+#define TX_PERIODIC_MODE	HRTIMER_MODE_ABS_SOFT
+#endif
+
+struct tx_periodic_entry {
+	struct timerqueue_node node;
+	struct avionics_tx_periodic_entry config;
+};
+
+/* The value slots are shared with user space through mmap, so they
+ * live until the device is freed and the last mapping is gone. */
+struct tx_periodic {
+	struct kref ref;
+	spinlock_t lock;
+	struct timerqueue_head queue;
+	struct hrtimer timer;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+	struct tasklet_struct tasklet;
+#endif
+	struct net_device *dev;
+	struct tx_periodic_entry *entries;
+	int count;
+	__u32 *values;
+	__u32 words[AVIONICS_TX_PERIODIC_ENTRIES]; /* only used by the timer */
+};
+
+static void tx_periodic_release(struct kref *ref)
+{
+	struct tx_periodic *periodic;
+
+	periodic = container_of(ref, struct tx_periodic, ref);
+
+	vfree(periodic->values);
+	kfree(periodic);
+}
+
+static void tx_periodic_put(struct tx_periodic *periodic)
+{
+	kref_put(&periodic->ref, tx_periodic_release);
+}
+
+static void tx_periodic_send(struct tx_periodic *periodic, int count)
+{
+	struct net_device *dev = periodic->dev;
+	struct sk_buff *skb;
+	avionics_data *data;
+	int i, j, num_samples, max_samples;
+
+	if (!netif_running(dev)) {
+		return;
+	}
+
+	/* the transmitter is behind, adding to its queue only makes the
+	 * words that are already late later still */
+	if (netif_queue_stopped(dev)) {
+		dev->stats.tx_dropped += count;
+		avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+		return;
+	}
+
+	max_samples = max_t(int, dev->mtu / sizeof(avionics_data), 1);
+
+	for (i = 0; i < count; i += num_samples) {
+		num_samples = min(max_samples, count - i);
+
+		skb = alloc_skb(num_samples * sizeof(avionics_data),
+				GFP_ATOMIC);
+		if (!skb) {
+			pr_err_ratelimited("avionics-tx-periodic: Failed to"
+					   " allocate skb\n");
+			dev->stats.tx_dropped += count - i;
+			avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+			return;
+		}
+
+		protocol_init_skb(dev, skb);
+
+		data = skb_put(skb, num_samples * sizeof(avionics_data));
+		for (j = 0; j < num_samples; j++) {
+			data[j].time_nsecs = 0;
+			data[j].value = periodic->words[i + j];
+			data[j].flags = 0;
+			data[j].ifindex = 0;
+		}
+
+		dev_queue_xmit(skb);
+	}
+}
+
+static ktime_t tx_periodic_next(ktime_t expires, s64 period_nsecs,
+				ktime_t limit)
+{
+	s64 late_nsecs;
+
+	expires = ktime_add_ns(expires, period_nsecs);
+
+	/* skip the periods that were missed altogether, rather than
+	 * sending a burst of stale words to catch up, this also keeps an
+	 * entry from being sent twice in one run */
+	late_nsecs = ktime_to_ns(ktime_sub(limit, expires));
+	if (late_nsecs >= 0) {
+		expires = ktime_add_ns(expires,
+				       (div64_u64(late_nsecs, period_nsecs) + 1)
+				       * period_nsecs);
+	}
+
+	return expires;
+}
+
+static void tx_periodic_run(struct tx_periodic *periodic)
+{
+	struct tx_periodic_entry *entry;
+	struct timerqueue_node *node;
+	unsigned long flags;
+	ktime_t now, limit;
+	int count = 0;
+
+	spin_lock_irqsave(&periodic->lock, flags);
+
+	now = ktime_get();
+	limit = ktime_add_ns(now, TX_PERIODIC_SLACK_NSECS);
+
+	while ((node = timerqueue_getnext(&periodic->queue))) {
+		if (ktime_after(node->expires, limit)) {
+			break;
+		}
+
+		timerqueue_del(&periodic->queue, node);
+		entry = container_of(node, struct tx_periodic_entry, node);
+
+		/* user space may be writing the slot right now, any whole
+		 * word it's written is fine to send */
+		periodic->words[count++] =
+			READ_ONCE(periodic->values[entry->config.slot]);
+
+		node->expires = tx_periodic_next(node->expires,
+				(s64)entry->config.period_usecs * NSEC_PER_USEC,
+				limit);
+		timerqueue_add(&periodic->queue, node);
+	}
+
+	node = timerqueue_getnext(&periodic->queue);
+	if (node) {
+		hrtimer_start(&periodic->timer, node->expires,
+			      TX_PERIODIC_MODE);
+	}
+
+	spin_unlock_irqrestore(&periodic->lock, flags);
+
+	if (count) {
+		tx_periodic_send(periodic, count);
+	}
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+static void tx_periodic_tasklet(unsigned long data)
+{
+	tx_periodic_run((struct tx_periodic *)data);
+}
+
+static enum hrtimer_restart tx_periodic_timer(struct hrtimer *timer)
+{
+	struct tx_periodic *periodic;
+
+	periodic = container_of(timer, struct tx_periodic, timer);
+	tasklet_schedule(&periodic->tasklet);
+
+	return HRTIMER_NORESTART;
+}
+#else
+static enum hrtimer_restart tx_periodic_timer(struct hrtimer *timer)
+{
+	tx_periodic_run(container_of(timer, struct tx_periodic, timer));
+
+	return HRTIMER_NORESTART;
+}
+#endif
+
+static int tx_periodic_check(const struct avionics_tx_periodic_entry *config,
+			     int count)
+{
+	int i;
+
+	if ((count < 0) || (count > AVIONICS_TX_PERIODIC_ENTRIES)) {
+		pr_err("avionics-tx-periodic: Schedule can have at most %d"
+		       " entries\n", AVIONICS_TX_PERIODIC_ENTRIES);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (config[i].slot >= AVIONICS_TX_PERIODIC_SLOTS) {
+			pr_err("avionics-tx-periodic: Entry %d slot %u out of"
+			       " range\n", i, config[i].slot);
+			return -EINVAL;
+		}
+
+		if (!config[i].period_usecs) {
+			continue;
+		}
+
+		if ((config[i].period_usecs < TX_PERIODIC_MIN_USECS)
+		    || (config[i].period_usecs > TX_PERIODIC_MAX_USECS)) {
+			pr_err("avionics-tx-periodic: Entry %d period %u us"
+			       " must be from %u to %u us\n", i,
+			       config[i].period_usecs, TX_PERIODIC_MIN_USECS,
+			       TX_PERIODIC_MAX_USECS);
+			return -EINVAL;
+		}
+
+		if (config[i].phase_usecs > TX_PERIODIC_MAX_USECS) {
+			pr_err("avionics-tx-periodic: Entry %d phase %u us"
+			       " too large\n", i, config[i].phase_usecs);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+int tx_periodic_set(struct tx_periodic *periodic,
+		    const struct avionics_tx_periodic_entry *config,
+		    int count)
+{
+	struct tx_periodic_entry *entries = NULL, *old;
+	struct timerqueue_node *node;
+	unsigned long flags;
+	ktime_t start;
+	int i, err;
+
+	err = tx_periodic_check(config, count);
+	if (err) {
+		return err;
+	}
+
+	if (count) {
+		entries = kcalloc(count, sizeof(*entries), GFP_KERNEL);
+		if (!entries) {
+			pr_err("avionics-tx-periodic: Failed to allocate"
+			       " schedule\n");
+			return -ENOMEM;
+		}
+	}
+
+	spin_lock_irqsave(&periodic->lock, flags);
+
+	old = periodic->entries;
+	periodic->entries = entries;
+	periodic->count = count;
+
+	timerqueue_init_head(&periodic->queue);
+	start = ktime_get();
+
+	for (i = 0; i < count; i++) {
+		entries[i].config = config[i];
+		timerqueue_init(&entries[i].node);
+
+		if (!config[i].period_usecs) {
+			continue;
+		}
+
+		entries[i].node.expires = ktime_add_us(start,
+						       config[i].phase_usecs);
+		timerqueue_add(&periodic->queue, &entries[i].node);
+	}
+
+	/* the timer may be running on another CPU waiting for the lock,
+	 * it'll find the new schedule and re-arm from it, so only try */
+	node = timerqueue_getnext(&periodic->queue);
+	if (node) {
+		hrtimer_start(&periodic->timer, node->expires,
+			      TX_PERIODIC_MODE);
+	} else {
+		hrtimer_try_to_cancel(&periodic->timer);
+	}
+
+	spin_unlock_irqrestore(&periodic->lock, flags);
+
+	kfree(old);
+
+	return 0;
+}
+
+int tx_periodic_get(struct tx_periodic *periodic,
+		    struct avionics_tx_periodic_entry *config, int max)
+{
+	unsigned long flags;
+	int i, count;
+
+	spin_lock_irqsave(&periodic->lock, flags);
+
+	count = min(periodic->count, max);
+	for (i = 0; i < count; i++) {
+		config[i] = periodic->entries[i].config;
+	}
+
+	spin_unlock_irqrestore(&periodic->lock, flags);
+
+	return count;
+}
+
+static void tx_periodic_vm_open(struct vm_area_struct *vma)
+{
+	struct tx_periodic *periodic = vma->vm_private_data;
+
+	kref_get(&periodic->ref);
+}
+
+static void tx_periodic_vm_close(struct vm_area_struct *vma)
+{
+	tx_periodic_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct tx_periodic_vm_ops = {
+	.open = tx_periodic_vm_open,
+	.close = tx_periodic_vm_close,
+};
+
+int tx_periodic_mmap(struct tx_periodic *periodic,
+		     struct vm_area_struct *vma)
+{
+	int err;
+
+	if ((vma->vm_end - vma->vm_start) != TX_PERIODIC_SIZE) {
+		pr_err("avionics-tx-periodic: Mapping must be %lu bytes"
+		       " not %lu\n", TX_PERIODIC_SIZE,
+		       vma->vm_end - vma->vm_start);
+		return -EINVAL;
+	}
+
+	err = remap_vmalloc_range(vma, periodic->values, 0);
+	if (err) {
+		return err;
+	}
+
+	kref_get(&periodic->ref);
+	vma->vm_private_data = periodic;
+	vma->vm_ops = &tx_periodic_vm_ops;
+
+	return 0;
+}
+
+void tx_periodic_free(struct tx_periodic *periodic)
+{
+	unsigned long flags;
+
+	if (!periodic) {
+		return;
+	}
+
+	/* with nothing queued the timer can't re-arm itself */
+	spin_lock_irqsave(&periodic->lock, flags);
+	timerqueue_init_head(&periodic->queue);
+	spin_unlock_irqrestore(&periodic->lock, flags);
+
+	hrtimer_cancel(&periodic->timer);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+	tasklet_kill(&periodic->tasklet);
+#endif
+
+	kfree(periodic->entries);
+	periodic->entries = NULL;
+	periodic->count = 0;
+
+	tx_periodic_put(periodic);
+}
+
+struct tx_periodic *tx_periodic_alloc(struct net_device *dev)
+{
+	struct tx_periodic *periodic;
+
+	periodic = kzalloc(sizeof(*periodic), GFP_KERNEL);
+	if (!periodic) {
+		pr_err("avionics-tx-periodic: Failed to allocate schedule\n");
+		return NULL;
+	}
+
+	periodic->values = vmalloc_user(TX_PERIODIC_SIZE);
+	if (!periodic->values) {
+		pr_err("avionics-tx-periodic: Failed to allocate slots\n");
+		kfree(periodic);
+		return NULL;
+	}
+
+	kref_init(&periodic->ref);
+	spin_lock_init(&periodic->lock);
+	timerqueue_init_head(&periodic->queue);
+	hrtimer_init(&periodic->timer, CLOCK_MONOTONIC, TX_PERIODIC_MODE);
+	periodic->timer.function = tx_periodic_timer;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+	tasklet_init(&periodic->tasklet, tx_periodic_tasklet,
+		     (unsigned long)periodic);
+#endif
+	periodic->dev = dev;
+
+	return periodic;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2019, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __AVIONICS_TX_PERIODIC_H__
+#define __AVIONICS_TX_PERIODIC_H__
+
+#include <linux/netdevice.h>
+#include <linux/mm.h>
+
+#include "avionics.h"
+
+/* Periodic schedules send a table of words on a fixed cadence from a
+ * kernel timer, so refresh rates don't depend on user space being
+ * scheduled in time. The words are read from a page of value slots
+ * that user space maps and updates in place, and are handed to the
+ * device's normal transmit path as they fall due. */
+
+struct tx_periodic;
+
+int tx_periodic_set(struct tx_periodic *periodic,
+		    const struct avionics_tx_periodic_entry *config,
+		    int count);
+int tx_periodic_get(struct tx_periodic *periodic,
+		    struct avionics_tx_periodic_entry *config, int max);
+int tx_periodic_mmap(struct tx_periodic *periodic,
+		     struct vm_area_struct *vma);
+
+void tx_periodic_free(struct tx_periodic *periodic);
+struct tx_periodic *tx_periodic_alloc(struct net_device *dev);
+
+#endif /* __AVIONICS_TX_PERIODIC_H__ */
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C), 2019 CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <linux/version.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/timerqueue.h>
+#include <net/sock.h>
+
+#include "avionics.h"
+#include "avionics-device.h"
+
+/* Words with a transmit time further out than this are sent right
+ * away, the same as words with a time in the past. */
+#define TX_SCHEDULE_MAX_MSECS	360000
+
+/* Words past this many waiting for their time are dropped. Waiting
+ * words are also charged to the socket that sent them, the limit is
+ * for everything else, like periodic schedules. */
+#define TX_SCHEDULE_MAX_WORDS	4096
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,16,0)
+#define TX_SCHEDULE_MODE	HRTIMER_MODE_ABS
+#else
+#define TX_SCHEDULE_MODE	HRTIMER_MODE_ABS_SOFT
+#endif
+
+struct tx_schedule_cb {
+	struct timerqueue_node node;
+	struct sk_buff *skb;
+};
+
+#define TX_SCHEDULE_CB(skb)	((struct tx_schedule_cb *)((skb)->cb))
+
+struct avionics_tx_schedule {
+	spinlock_t lock;
+	struct timerqueue_head queue;
+	struct hrtimer timer;
+	struct net_device *dev;
+	int words;
+	void (*release)(struct sk_buff *skb, struct net_device *dev);
+};
+
+static ktime_t tx_schedule_deadline(const avionics_data *data, s64 now_nsecs)
+{
+	s64 offset_nsecs;
+
+	if (!data->time_nsecs || (data->time_nsecs <= now_nsecs)) {
+		return 0;
+	}
+
+	offset_nsecs = data->time_nsecs - now_nsecs;
+	if (offset_nsecs > ((s64)TX_SCHEDULE_MAX_MSECS * NSEC_PER_MSEC)) {
+		pr_warn_ratelimited("avionics-tx-schedule: Offset %lld ns"
+				    " too large, ignoring\n", offset_nsecs);
+		return 0;
+	}
+
+	return ns_to_ktime(data->time_nsecs);
+}
+
+static int tx_schedule_words(struct sk_buff *skb)
+{
+	return skb->len / sizeof(avionics_data);
+}
+
+static int tx_schedule_queue(struct avionics_tx_schedule *schedule,
+			     struct sk_buff *skb, ktime_t deadline)
+{
+	struct tx_schedule_cb *cb = TX_SCHEDULE_CB(skb);
+	unsigned long flags;
+	int words = tx_schedule_words(skb);
+
+	timerqueue_init(&cb->node);
+	cb->node.expires = deadline;
+	cb->skb = skb;
+
+	spin_lock_irqsave(&schedule->lock, flags);
+
+	if (schedule->words + words > TX_SCHEDULE_MAX_WORDS) {
+		spin_unlock_irqrestore(&schedule->lock, flags);
+		return -ENOBUFS;
+	}
+
+	schedule->words += words;
+
+	if (timerqueue_add(&schedule->queue, &cb->node)) {
+		hrtimer_start(&schedule->timer, deadline, TX_SCHEDULE_MODE);
+	}
+
+	spin_unlock_irqrestore(&schedule->lock, flags);
+
+	return 0;
+}
+
+static enum hrtimer_restart tx_schedule_timer(struct hrtimer *timer)
+{
+	struct avionics_tx_schedule *schedule;
+	struct timerqueue_node *node;
+	struct sk_buff_head due;
+	struct sk_buff *skb;
+	unsigned long flags;
+	ktime_t now;
+
+	schedule = container_of(timer, struct avionics_tx_schedule, timer);
+	__skb_queue_head_init(&due);
+
+	spin_lock_irqsave(&schedule->lock, flags);
+
+	now = ktime_get_real();
+	while ((node = timerqueue_getnext(&schedule->queue))) {
+		if (ktime_after(node->expires, now)) {
+			hrtimer_start(&schedule->timer, node->expires,
+				      TX_SCHEDULE_MODE);
+			break;
+		}
+
+		timerqueue_del(&schedule->queue, node);
+		skb = container_of(node, struct tx_schedule_cb, node)->skb;
+		schedule->words -= tx_schedule_words(skb);
+		__skb_queue_tail(&due, skb);
+	}
+
+	spin_unlock_irqrestore(&schedule->lock, flags);
+
+	while ((skb = __skb_dequeue(&due))) {
+		schedule->release(skb, schedule->dev);
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+void avionics_device_tx_schedule(struct avionics_tx_schedule *schedule,
+				 struct sk_buff *skb)
+{
+	struct net_device *dev = schedule->dev;
+	struct sk_buff *part;
+	avionics_data *data;
+	ktime_t deadline;
+	s64 now_nsecs;
+	int i, start, num_samples;
+
+	data = (avionics_data *)skb->data;
+	num_samples = skb->len / sizeof(avionics_data);
+	now_nsecs = ktime_to_ns(ktime_get_real());
+
+	for (i = 0; i < num_samples; i++) {
+		if (tx_schedule_deadline(&data[i], now_nsecs)) {
+			break;
+		}
+	}
+
+	/* nothing to wait for, which is by far the common case */
+	if (i == num_samples) {
+		schedule->release(skb, dev);
+		return;
+	}
+
+	/* split the packet into runs of words that are due at the same
+	 * time, each run shares the original packet's data but is charged
+	 * to the sender on its own, so the send buffer still covers words
+	 * that are waiting and the sender gets their transmit timestamps,
+	 * one for each run */
+	for (start = 0; start < num_samples; start = i) {
+		deadline = tx_schedule_deadline(&data[start], now_nsecs);
+
+		for (i = start + 1; i < num_samples; i++) {
+			if (tx_schedule_deadline(&data[i], now_nsecs)
+			    != deadline) {
+				break;
+			}
+		}
+
+		part = skb_clone(skb, GFP_ATOMIC);
+		if (!part) {
+			pr_err("avionics-tx-schedule: Failed to split packet\n");
+			dev->stats.tx_dropped++;
+			avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+			continue;
+		}
+
+		skb_pull(part, start * sizeof(avionics_data));
+		skb_trim(part, (i - start) * sizeof(avionics_data));
+
+		if (skb->sk) {
+			part->truesize = SKB_TRUESIZE(part->len);
+			skb_set_owner_w(part, skb->sk);
+		}
+
+		if (!deadline) {
+			schedule->release(part, dev);
+		} else if (tx_schedule_queue(schedule, part, deadline)) {
+			pr_warn_ratelimited("avionics-tx-schedule: Schedule"
+					    " full, dropping words\n");
+			dev->stats.tx_dropped++;
+			avionics_device_event(dev, AVIONICS_EVENT_DROPPED);
+			kfree_skb(part);
+		}
+	}
+
+	consume_skb(skb);
+}
+EXPORT_SYMBOL_GPL(avionics_device_tx_schedule);
+
+void avionics_device_tx_schedule_free(struct avionics_tx_schedule *schedule)
+{
+	struct timerqueue_node *node;
+	struct sk_buff *skb;
+
+	if (!schedule) {
+		return;
+	}
+
+	hrtimer_cancel(&schedule->timer);
+
+	while ((node = timerqueue_getnext(&schedule->queue))) {
+		timerqueue_del(&schedule->queue, node);
+		skb = container_of(node, struct tx_schedule_cb, node)->skb;
+		schedule->words -= tx_schedule_words(skb);
+		kfree_skb(skb);
+	}
+
+	kfree(schedule);
+}
+EXPORT_SYMBOL_GPL(avionics_device_tx_schedule_free);
+
+struct avionics_tx_schedule *avionics_device_tx_schedule_alloc(
+		struct net_device *dev,
+		void (*release)(struct sk_buff *skb, struct net_device *dev))
+{
+	struct avionics_tx_schedule *schedule;
+
+	BUILD_BUG_ON(sizeof(struct tx_schedule_cb)
+		     > sizeof(((struct sk_buff *)0)->cb));
+
+	schedule = kzalloc(sizeof(*schedule), GFP_KERNEL);
+	if (!schedule) {
+		pr_err("avionics-tx-schedule: Failed to allocate schedule\n");
+		return NULL;
+	}
+
+	spin_lock_init(&schedule->lock);
+	timerqueue_init_head(&schedule->queue);
+	hrtimer_init(&schedule->timer, CLOCK_REALTIME, TX_SCHEDULE_MODE);
+	schedule->timer.function = tx_schedule_timer;
+	schedule->dev = dev;
+	schedule->release = release;
+
+	return schedule;
+}
+EXPORT_SYMBOL_GPL(avionics_device_tx_schedule_alloc);
@@ -0,0 +1,87 @@
+#!/usr/bin/python
+# Copyright: 2019-2021, CCX Technologies
+
+import socket
+import ctypes
+import ctypes.util
+import struct
+import fcntl
+import sys
+import mmap
+import time
+import datetime
+
+AF_AVIONICS = 18
+PF_AVIONICS = 18
+AVIONICS_RAW = 1
+AVIONICS_TIMESTAMP = 2
+
+SOL_AVIONICS = 300
+AVIONICS_RX_LABEL_TABLE = 4
+
+AVIONICS_LABEL_TABLE_ENTRIES = 1024
+AVIONICS_LABEL_TABLE_OFFSET = 0x10000000
+
+SIOCGIFINDEX = 0x8933
+
+device = sys.argv[1]
+
+label_entry = struct.Struct("IIqI4x")
+
+
+def get_addr(sock, channel):
+    data = struct.pack("16si", channel.encode(), 0)
+    res = fcntl.ioctl(sock, SIOCGIFINDEX, data)
+    idx, = struct.unpack("16xi", res)
+    return struct.pack("Hi", AF_AVIONICS, idx)
+
+
+def read_entry(table, index):
+    while True:
+        sequence, count, ts, value = label_entry.unpack_from(
+                table, index * label_entry.size)
+        if sequence & 1:
+            continue
+        if struct.unpack_from("I", table, index * label_entry.size)[0] == sequence:
+            return count, ts, value
+
+
+libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+if __name__ == "__main__":
+    # == create socket ==
+    with socket.socket(PF_AVIONICS, socket.SOCK_RAW, AVIONICS_TIMESTAMP) as sock:
+
+        # == bind to interface ==
+        # Python doesn't know about PF_ARINC so directly use libc
+        addr = get_addr(sock, device)
+        err = libc.bind(sock.fileno(), addr, len(addr))
+
+        if err:
+            raise OSError(err, "Failed to bind to socket")
+
+        # == attach the label table and read it in one call ==
+        sock.setsockopt(SOL_AVIONICS, AVIONICS_RX_LABEL_TABLE,
+                        struct.pack("i", 1))
+
+        size = AVIONICS_LABEL_TABLE_ENTRIES * label_entry.size
+        snapshot = sock.getsockopt(SOL_AVIONICS, AVIONICS_RX_LABEL_TABLE, size)
+        print(f"Read {len(snapshot) // label_entry.size} entries")
+
+        # == sample the mapped table once a second ==
+        table = mmap.mmap(sock.fileno(), size, prot=mmap.PROT_READ,
+                          offset=AVIONICS_LABEL_TABLE_OFFSET)
+
+        print(f"Sampler started: {datetime.datetime.utcnow()}")
+
+        while True:
+            time.sleep(1)
+
+            for index in range(AVIONICS_LABEL_TABLE_ENTRIES):
+                count, ts, value = read_entry(table, index)
+                if not count:
+                    continue
+
+                timestamp = datetime.datetime.fromtimestamp(ts/1000)
+                print(f"label {index & 0xff:03o} sdi {index >> 8}: "
+                      f"{timestamp.isoformat()}: 0x{value:08X} ({count} updates)")
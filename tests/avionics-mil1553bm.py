@@ -0,0 +1,102 @@
+#!/usr/bin/python
+# Copyright: 2019-2021, CCX Technologies
+
+import socket
+import ctypes
+import ctypes.util
+import struct
+import fcntl
+import sys
+
+AF_AVIONICS = 18
+PF_AVIONICS = 18
+AVIONICS_RAW = 1
+AVIONICS_TIMESTAMP = 2
+AVIONICS_RECORD = 3
+
+SIOCGIFINDEX = 0x8933
+
+# Usage: avionics-mil1553bm.py <interface> [packets]
+device = sys.argv[1]
+count = int(sys.argv[2]) if (len(sys.argv) >= 3) else 10
+
+# struct avionics_mil1553bm_record, before its data words
+header = struct.Struct("q4HHHHH")
+max_data_words = 35
+
+
+def get_addr(sock, channel):
+    data = struct.pack("16si", channel.encode(), 0)
+    res = fcntl.ioctl(sock, SIOCGIFINDEX, data)
+    idx, = struct.unpack("16xi", res)
+    return struct.pack("Hi", AF_AVIONICS, idx)
+
+
+def record_size(length):
+    return (header.size + length*2 + 7) & ~7
+
+
+def check_packet(packet):
+    offset = 0
+    records = 0
+
+    while offset < len(packet):
+        if len(packet) - offset < header.size:
+            raise ValueError(f"Packet ends inside a record at {offset}")
+
+        (time_msecs, _, _, _, _, block_status, command, length,
+         padding) = header.unpack_from(packet, offset)
+
+        if length > max_data_words:
+            raise ValueError(f"Record at {offset} has {length} data words")
+
+        if padding:
+            raise ValueError(f"Record at {offset} has padding 0x{padding:04X}")
+
+        size = record_size(length)
+        if offset + size > len(packet):
+            raise ValueError(f"Record at {offset} runs past the packet")
+
+        print(f"{time_msecs}: 0x{command:04X} 0x{block_status:04X}"
+              f" {length} words")
+
+        offset += size
+        records += 1
+
+    return records
+
+
+libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+if __name__ == "__main__":
+    # == one socket of each protocol, they should all see the same bytes ==
+    socks = [socket.socket(PF_AVIONICS, socket.SOCK_RAW, proto)
+             for proto in (AVIONICS_RAW, AVIONICS_TIMESTAMP, AVIONICS_RECORD)]
+
+    try:
+        # == bind to interface ==
+        # Python doesn't know about PF_ARINC so directly use libc
+        for sock in socks:
+            addr = get_addr(sock, device)
+            err = libc.bind(sock.fileno(), addr, len(addr))
+
+            if err:
+                raise OSError(err, "Failed to bind to socket")
+
+        for i in range(count):
+            packets = []
+
+            for sock in socks:
+                packet, _, flags, _ = sock.recvmsg(65536)
+                if flags & socket.MSG_TRUNC:
+                    raise ValueError("Packet was truncated")
+                packets.append(packet)
+
+            if any(packet != packets[0] for packet in packets):
+                raise ValueError(f"Packet {i} differs between protocols")
+
+            print(f"Packet {i}: {check_packet(packets[0])} records intact")
+
+    finally:
+        for sock in socks:
+            sock.close()
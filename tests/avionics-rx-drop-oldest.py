@@ -0,0 +1,75 @@
+#!/usr/bin/python
+# Copyright: 2019-2021, CCX Technologies
+
+import socket
+import ctypes
+import ctypes.util
+import struct
+import fcntl
+import sys
+import time
+import datetime
+
+AF_AVIONICS = 18
+PF_AVIONICS = 18
+AVIONICS_RAW = 1
+AVIONICS_TIMESTAMP = 2
+
+SOL_AVIONICS = 300
+AVIONICS_RX_DROP_OLDEST = 5
+
+SO_RXQ_OVFL = 40
+
+SIOCGIFINDEX = 0x8933
+
+DEPTH = 4
+
+device = sys.argv[1]
+
+record = struct.Struct("<qI")
+
+
+def get_addr(sock, channel):
+    data = struct.pack("16si", channel.encode(), 0)
+    res = fcntl.ioctl(sock, SIOCGIFINDEX, data)
+    idx, = struct.unpack("16xi", res)
+    return struct.pack("Hi", AF_AVIONICS, idx)
+
+
+libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+if __name__ == "__main__":
+    # == create socket ==
+    with socket.socket(PF_AVIONICS, socket.SOCK_RAW, AVIONICS_TIMESTAMP) as sock:
+
+        # == bind to interface ==
+        # Python doesn't know about PF_ARINC so directly use libc
+        addr = get_addr(sock, device)
+        err = libc.bind(sock.fileno(), addr, len(addr))
+
+        if err:
+            raise OSError(err, "Failed to bind to socket")
+
+        # == only keep the newest packets, and report the drops ==
+        sock.setsockopt(SOL_AVIONICS, AVIONICS_RX_DROP_OLDEST, DEPTH)
+        sock.setsockopt(socket.SOL_SOCKET, SO_RXQ_OVFL, 1)
+
+        # == receive data example, reading slower than the data arrives ==
+        print(f"Receiver started: {datetime.datetime.utcnow()}")
+
+        dropped = 0
+        while True:
+            data, ancdata, _, _ = sock.recvmsg(8192, socket.CMSG_SPACE(4))
+
+            for level, kind, value in ancdata:
+                if (level == socket.SOL_SOCKET) and (kind == SO_RXQ_OVFL):
+                    count, = struct.unpack("I", value[:4])
+                    if count != dropped:
+                        print(f"Dropped: {count - dropped} packets")
+                        dropped = count
+
+            for ts, value in record.iter_unpack(data):
+                timestamp = datetime.datetime.fromtimestamp(ts/1000)
+                print(f"{timestamp.isoformat()}: 0x{value:08X}")
+
+            time.sleep(0.5)
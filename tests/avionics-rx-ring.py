@@ -0,0 +1,84 @@
+#!/usr/bin/python
+# Copyright: 2019-2021, CCX Technologies
+
+import socket
+import ctypes
+import ctypes.util
+import struct
+import fcntl
+import sys
+import mmap
+import select
+import datetime
+
+AF_AVIONICS = 18
+PF_AVIONICS = 18
+AVIONICS_RAW = 1
+AVIONICS_TIMESTAMP = 2
+
+SOL_AVIONICS = 300
+AVIONICS_RX_RING = 1
+
+SIOCGIFINDEX = 0x8933
+
+FRAME_NR = 1024
+THRESHOLD = 16
+
+device = sys.argv[1]
+
+ring_header = struct.Struct("IIIII12x")
+ring_record = struct.Struct("<qI")
+
+
+def get_addr(sock, channel):
+    data = struct.pack("16si", channel.encode(), 0)
+    res = fcntl.ioctl(sock, SIOCGIFINDEX, data)
+    idx, = struct.unpack("16xi", res)
+    return struct.pack("Hi", AF_AVIONICS, idx)
+
+
+def page_align(size):
+    return (size + mmap.PAGESIZE - 1) & ~(mmap.PAGESIZE - 1)
+
+
+libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+if __name__ == "__main__":
+    # == create socket ==
+    with socket.socket(PF_AVIONICS, socket.SOCK_RAW, AVIONICS_TIMESTAMP) as sock:
+
+        # == bind to interface ==
+        # Python doesn't know about PF_ARINC so directly use libc
+        addr = get_addr(sock, device)
+        err = libc.bind(sock.fileno(), addr, len(addr))
+
+        if err:
+            raise OSError(err, "Failed to bind to socket")
+
+        # == setup and map the receive ring ==
+        sock.setsockopt(SOL_AVIONICS, AVIONICS_RX_RING,
+                        struct.pack("II", FRAME_NR, THRESHOLD))
+
+        size = page_align(ring_header.size) + page_align(FRAME_NR * ring_record.size)
+        ring = mmap.mmap(sock.fileno(), size)
+
+        poller = select.poll()
+        poller.register(sock, select.POLLIN)
+
+        # == receive data example ==
+        print(f"Receiver started: {datetime.datetime.utcnow()}")
+
+        while True:
+            poller.poll()
+
+            head, tail, frame_nr, offset, dropped = ring_header.unpack_from(ring, 0)
+            print(f"Received: {head - tail} records, {dropped} dropped")
+
+            while tail != head:
+                ts, value = ring_record.unpack_from(
+                        ring, offset + (tail % frame_nr) * ring_record.size)
+                timestamp = datetime.datetime.fromtimestamp(ts/1000)
+                print(f"{timestamp.isoformat()}: 0x{value:08X}")
+                tail = (tail + 1) & 0xffffffff
+
+            struct.pack_into("I", ring, 4, tail)
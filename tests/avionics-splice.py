@@ -0,0 +1,79 @@
+#!/usr/bin/python
+# Copyright: 2019-2021, CCX Technologies
+
+import socket
+import ctypes
+import ctypes.util
+import struct
+import fcntl
+import sys
+import os
+
+AF_AVIONICS = 18
+PF_AVIONICS = 18
+AVIONICS_RECORD = 3
+
+SIOCGIFINDEX = 0x8933
+
+# Usage: avionics-splice.py record <interface> <file>
+#        avionics-splice.py replay <interface> <file>
+mode = sys.argv[1]
+device = sys.argv[2]
+filename = sys.argv[3]
+
+record = struct.Struct("qIHH")
+chunk = 4096
+
+
+def get_addr(sock, channel):
+    data = struct.pack("16si", channel.encode(), 0)
+    res = fcntl.ioctl(sock, SIOCGIFINDEX, data)
+    idx, = struct.unpack("16xi", res)
+    return struct.pack("Hi", AF_AVIONICS, idx)
+
+
+libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+if __name__ == "__main__":
+    # == create socket ==
+    with socket.socket(PF_AVIONICS, socket.SOCK_RAW, AVIONICS_RECORD) as sock:
+
+        # == bind to interface ==
+        # Python doesn't know about PF_ARINC so directly use libc
+        addr = get_addr(sock, device)
+        err = libc.bind(sock.fileno(), addr, len(addr))
+
+        if err:
+            raise OSError(err, "Failed to bind to socket")
+
+        if mode == "record":
+            # == socket to pipe to file, the records never leave the kernel ==
+            rd, wr = os.pipe()
+            total = 0
+
+            with open(filename, "wb") as out:
+                try:
+                    while True:
+                        size = os.splice(sock.fileno(), wr, chunk)
+                        total += size
+                        while size:
+                            size -= os.splice(rd, out.fileno(), size)
+                        print(f"Recorded {total // record.size} words")
+
+                except KeyboardInterrupt:
+                    pass
+
+        elif mode == "replay":
+            # == file to socket, each chunk is sent as one packet ==
+            with open(filename, "rb") as capture:
+                size = os.fstat(capture.fileno()).st_size
+                offset = 0
+
+                while offset < size:
+                    offset += os.sendfile(sock.fileno(), capture.fileno(),
+                                          offset, chunk)
+
+                print(f"Replayed {size // record.size} words")
+
+        else:
+            raise ValueError(f"Unknown mode {mode}")
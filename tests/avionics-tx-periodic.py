@@ -0,0 +1,95 @@
+#!/usr/bin/python
+# Copyright: 2019-2021, CCX Technologies
+
+import socket
+import ctypes
+import ctypes.util
+import struct
+import fcntl
+import sys
+import mmap
+import time
+
+AF_AVIONICS = 18
+PF_AVIONICS = 18
+AVIONICS_RAW = 1
+
+SOL_AVIONICS = 300
+AVIONICS_TX_PERIODIC = 6
+
+AVIONICS_TX_PERIODIC_ENTRIES = 256
+AVIONICS_TX_PERIODIC_SLOTS = 1024
+AVIONICS_TX_PERIODIC_OFFSET = 0x30000000
+
+SIOCGIFINDEX = 0x8933
+
+device = sys.argv[1]
+
+periodic_entry = struct.Struct("IIII")
+
+# label, sdi, period in ms, phase in ms
+schedule = [
+    (0o310, 0, 50, 0),
+    (0o311, 0, 50, 25),
+    (0o312, 0, 100, 10),
+]
+
+
+def get_addr(sock, channel):
+    data = struct.pack("16si", channel.encode(), 0)
+    res = fcntl.ioctl(sock, SIOCGIFINDEX, data)
+    idx, = struct.unpack("16xi", res)
+    return struct.pack("Hi", AF_AVIONICS, idx)
+
+
+libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+
+if __name__ == "__main__":
+    # == create socket ==
+    with socket.socket(PF_AVIONICS, socket.SOCK_RAW, AVIONICS_RAW) as sock:
+
+        # == bind to interface ==
+        # Python doesn't know about PF_ARINC so directly use libc
+        addr = get_addr(sock, device)
+        err = libc.bind(sock.fileno(), addr, len(addr))
+
+        if err:
+            raise OSError(err, "Failed to bind to socket")
+
+        # == map the value slots, and fill them before starting ==
+        slots = mmap.mmap(sock.fileno(), AVIONICS_TX_PERIODIC_SLOTS * 4,
+                          offset=AVIONICS_TX_PERIODIC_OFFSET)
+
+        for label, sdi, _, _ in schedule:
+            index = (sdi << 8) | label
+            struct.pack_into("I", slots, index * 4, (sdi << 8) | label)
+
+        # == start the schedule ==
+        config = b"".join(
+                periodic_entry.pack(period * 1000, phase * 1000,
+                                    (sdi << 8) | label, 0)
+                for label, sdi, period, phase in schedule)
+
+        sock.setsockopt(SOL_AVIONICS, AVIONICS_TX_PERIODIC, config)
+
+        size = AVIONICS_TX_PERIODIC_ENTRIES * periodic_entry.size
+        entries = sock.getsockopt(SOL_AVIONICS, AVIONICS_TX_PERIODIC, size)
+        print(f"Schedule has {len(entries) // periodic_entry.size} entries")
+
+        # == update the data bits once a second, the kernel keeps sending ==
+        try:
+            count = 0
+            while True:
+                time.sleep(1)
+                count += 1
+
+                for label, sdi, _, _ in schedule:
+                    index = (sdi << 8) | label
+                    value = ((count & 0x7ffff) << 10) | (sdi << 8) | label
+                    struct.pack_into("I", slots, index * 4, value)
+
+                print(f"Updated {len(schedule)} words: {count}")
+
+        finally:
+            # == an empty schedule stops sending ==
+            sock.setsockopt(SOL_AVIONICS, AVIONICS_TX_PERIODIC, b"")
@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2019-2021, CCX Technologies
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/* Throughput and latency benchmark for the avionics sockets, meant to
+ * be run against an avionics-lb device (see ../create_lb.sh). Words
+ * are sent at a fixed rate from one socket and received on one or more
+ * others, each word carries a sequence number so the receivers can
+ * work out how long it took to loop back. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "avionics.h"
+
+#define BENCH_MAX_SOCKETS	64
+#define BENCH_MAX_BATCH		1024
+#define BENCH_SEQ_BITS		20
+#define BENCH_SEQ_MASK		((1u << BENCH_SEQ_BITS) - 1)
+#define BENCH_RX_BUFFER		65536
+#define BENCH_MAX_SAMPLES	(1u << 22)
+
+struct bench_config {
+	const char *ifname;
+	int protocol;
+	unsigned long rate;
+	unsigned int batch;
+	unsigned int sockets;
+	unsigned int duration;
+};
+
+struct bench_rx {
+	pthread_t thread;
+	int sock;
+	uint64_t words;
+	uint64_t lost;
+	uint64_t *latency;
+	size_t latency_nr;
+	size_t latency_max;
+};
+
+static struct bench_config config = {
+	.ifname = "avionics-lb0",
+	.protocol = AVIONICS_PROTO_RAW,
+	.rate = 100000,
+	.batch = 16,
+	.sockets = 1,
+	.duration = 10,
+};
+
+/* send time of each sequence number, indexed by the low bits */
+static uint64_t send_nsecs[BENCH_SEQ_MASK + 1];
+static volatile int running = 1;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t bench_word_size(void)
+{
+	if (config.protocol == AVIONICS_PROTO_TIMESTAMP) {
+		return sizeof(struct avionics_proto_timestamp_data);
+	}
+
+	return sizeof(struct avionics_proto_raw_data);
+}
+
+static int bench_socket(void)
+{
+	struct sockaddr_avionics addr;
+	int sock;
+
+	sock = socket(PF_AVIONICS, SOCK_RAW, config.protocol);
+	if (sock < 0) {
+		perror("Failed to create socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.avionics_family = AF_AVIONICS;
+	addr.ifindex = if_nametoindex(config.ifname);
+	if (!addr.ifindex) {
+		fprintf(stderr, "Unknown interface %s\n", config.ifname);
+		close(sock);
+		return -1;
+	}
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("Failed to bind socket");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static uint32_t bench_get_value(const uint8_t *word)
+{
+	uint32_t value;
+
+	if (config.protocol == AVIONICS_PROTO_TIMESTAMP) {
+		memcpy(&value, word + offsetof(struct
+				avionics_proto_timestamp_data, value),
+		       sizeof(value));
+	} else {
+		memcpy(&value, word, sizeof(value));
+	}
+
+	return value;
+}
+
+static void bench_set_value(uint8_t *word, uint32_t value)
+{
+	struct avionics_proto_timestamp_data data;
+
+	if (config.protocol == AVIONICS_PROTO_TIMESTAMP) {
+		/* a zero time is sent right away */
+		data.time_msecs = 0;
+		data.value = value;
+		memcpy(word, &data, sizeof(data));
+	} else {
+		memcpy(word, &value, sizeof(value));
+	}
+}
+
+static void *bench_rx_thread(void *arg)
+{
+	struct bench_rx *rx = arg;
+	uint8_t *buffer, *word;
+	uint32_t seq, expected = 0;
+	uint64_t now, sent;
+	size_t word_size = bench_word_size();
+	ssize_t len, i;
+
+	buffer = malloc(BENCH_RX_BUFFER);
+	if (!buffer) {
+		perror("Failed to allocate receive buffer");
+		return NULL;
+	}
+
+	while (running) {
+		len = recv(rx->sock, buffer, BENCH_RX_BUFFER, 0);
+		if (len < 0) {
+			if ((errno == EAGAIN) || (errno == EINTR)) {
+				continue;
+			}
+			perror("Failed to receive");
+			break;
+		}
+
+		now = bench_now();
+
+		for (i = 0; i + (ssize_t)word_size <= len; i += word_size) {
+			word = buffer + i;
+			seq = bench_get_value(word);
+
+			if (seq != expected) {
+				rx->lost += (seq - expected) & BENCH_SEQ_MASK;
+			}
+			expected = (seq + 1) & BENCH_SEQ_MASK;
+
+			sent = __atomic_load_n(&send_nsecs[seq], __ATOMIC_ACQUIRE);
+			if (sent && (rx->latency_nr < rx->latency_max)) {
+				rx->latency[rx->latency_nr++] = now - sent;
+			}
+
+			rx->words++;
+		}
+	}
+
+	free(buffer);
+
+	return NULL;
+}
+
+static uint64_t bench_tx(int sock)
+{
+	uint8_t buffer[BENCH_MAX_BATCH * sizeof(struct
+			avionics_proto_timestamp_data)];
+	size_t word_size = bench_word_size();
+	struct timespec deadline;
+	uint64_t start, end, next, sent = 0, now;
+	uint32_t seq = 0;
+	unsigned int i;
+	ssize_t len;
+
+	start = bench_now();
+	end = start + (uint64_t)config.duration * 1000000000ull;
+
+	while ((now = bench_now()) < end) {
+		for (i = 0; i < config.batch; i++) {
+			bench_set_value(&buffer[i * word_size], seq);
+			__atomic_store_n(&send_nsecs[seq], now, __ATOMIC_RELEASE);
+			seq = (seq + 1) & BENCH_SEQ_MASK;
+		}
+
+		len = send(sock, buffer, config.batch * word_size, 0);
+		if (len < 0) {
+			perror("Failed to send");
+			break;
+		}
+		sent += config.batch;
+
+		if (!config.rate) {
+			continue;
+		}
+
+		/* pace to the requested rate from the start, rather than
+		 * from the last send, so errors don't accumulate */
+		next = start + (sent * 1000000000ull) / config.rate;
+		deadline.tv_sec = next / 1000000000ull;
+		deadline.tv_nsec = next % 1000000000ull;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	}
+
+	return sent;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t bench_percentile(const uint64_t *sorted, size_t nr,
+				 double percentile)
+{
+	size_t index;
+
+	if (!nr) {
+		return 0;
+	}
+
+	index = (size_t)(percentile / 100.0 * (nr - 1) + 0.5);
+
+	return sorted[index];
+}
+
+static double bench_cpu_secs(const struct rusage *usage)
+{
+	return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec
+		+ (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1e6;
+}
+
+static void bench_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  -i, --interface NAME  interface to use (%s)\n"
+		"  -p, --protocol PROTO  raw or timestamp (raw)\n"
+		"  -r, --rate WORDS      words per second, 0 for flat out (%lu)\n"
+		"  -b, --batch WORDS     words per send (%u)\n"
+		"  -s, --sockets COUNT   number of receiving sockets (%u)\n"
+		"  -d, --duration SECS   length of the run (%u)\n",
+		name, config.ifname, config.rate, config.batch,
+		config.sockets, config.duration);
+}
+
+static int bench_parse(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "interface", required_argument, NULL, 'i' },
+		{ "protocol", required_argument, NULL, 'p' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ "sockets", required_argument, NULL, 's' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "i:p:r:b:s:d:h", options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			config.ifname = optarg;
+			break;
+		case 'p':
+			if (!strcmp(optarg, "raw")) {
+				config.protocol = AVIONICS_PROTO_RAW;
+			} else if (!strcmp(optarg, "timestamp")) {
+				config.protocol = AVIONICS_PROTO_TIMESTAMP;
+			} else {
+				fprintf(stderr, "Unknown protocol %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'r':
+			config.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			config.batch = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			config.sockets = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			config.duration = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			bench_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (!config.batch || (config.batch > BENCH_MAX_BATCH)) {
+		fprintf(stderr, "Batch must be between 1 and %d words\n",
+			BENCH_MAX_BATCH);
+		return -1;
+	}
+
+	if (!config.sockets || (config.sockets > BENCH_MAX_SOCKETS)) {
+		fprintf(stderr, "Sockets must be between 1 and %d\n",
+			BENCH_MAX_SOCKETS);
+		return -1;
+	}
+
+	if (!config.duration) {
+		fprintf(stderr, "Duration must be at least 1 second\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_rx rx[BENCH_MAX_SOCKETS];
+	struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+	struct rusage usage_start, usage_end;
+	uint64_t start, elapsed, sent, words = 0, lost = 0;
+	uint64_t *latency;
+	size_t latency_nr = 0;
+	double secs, cpu;
+	unsigned int i;
+	int tx, err = 0;
+
+	if (bench_parse(argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	memset(rx, 0, sizeof(rx));
+
+	for (i = 0; i < config.sockets; i++) {
+		rx[i].sock = bench_socket();
+		if (rx[i].sock < 0) {
+			return EXIT_FAILURE;
+		}
+
+		setsockopt(rx[i].sock, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+			   sizeof(timeout));
+
+		/* keep up to two seconds worth of samples, with a cap on
+		 * the total so lots of sockets don't use too much memory */
+		rx[i].latency_max = (config.rate ? config.rate : 1000000) * 2;
+		if (rx[i].latency_max > (BENCH_MAX_SAMPLES / config.sockets)) {
+			rx[i].latency_max = BENCH_MAX_SAMPLES / config.sockets;
+		}
+		rx[i].latency = malloc(rx[i].latency_max * sizeof(uint64_t));
+		if (!rx[i].latency) {
+			perror("Failed to allocate latency samples");
+			return EXIT_FAILURE;
+		}
+	}
+
+	tx = bench_socket();
+	if (tx < 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < config.sockets; i++) {
+		err = pthread_create(&rx[i].thread, NULL, bench_rx_thread,
+				     &rx[i]);
+		if (err) {
+			fprintf(stderr, "Failed to start receiver: %s\n",
+				strerror(err));
+			return EXIT_FAILURE;
+		}
+	}
+
+	getrusage(RUSAGE_SELF, &usage_start);
+	start = bench_now();
+
+	sent = bench_tx(tx);
+
+	/* give the last words time to loop back */
+	usleep(200000);
+	running = 0;
+
+	for (i = 0; i < config.sockets; i++) {
+		pthread_join(rx[i].thread, NULL);
+		words += rx[i].words;
+		lost += rx[i].lost;
+		latency_nr += rx[i].latency_nr;
+	}
+
+	elapsed = bench_now() - start;
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	latency = malloc((latency_nr ? latency_nr : 1) * sizeof(uint64_t));
+	if (!latency) {
+		perror("Failed to allocate latency samples");
+		return EXIT_FAILURE;
+	}
+
+	latency_nr = 0;
+	for (i = 0; i < config.sockets; i++) {
+		memcpy(&latency[latency_nr], rx[i].latency,
+		       rx[i].latency_nr * sizeof(uint64_t));
+		latency_nr += rx[i].latency_nr;
+		free(rx[i].latency);
+		close(rx[i].sock);
+	}
+	close(tx);
+
+	qsort(latency, latency_nr, sizeof(latency[0]), bench_compare);
+
+	secs = elapsed / 1e9;
+	cpu = bench_cpu_secs(&usage_end) - bench_cpu_secs(&usage_start);
+
+	printf("interface:   %s\n", config.ifname);
+	printf("protocol:    %s\n", (config.protocol == AVIONICS_PROTO_RAW)
+	       ? "raw" : "timestamp");
+	printf("rate:        %lu words/sec\n", config.rate);
+	printf("batch:       %u words\n", config.batch);
+	printf("sockets:     %u\n", config.sockets);
+	printf("sent:        %llu words, %.0f words/sec\n",
+	       (unsigned long long)sent, sent / secs);
+	printf("received:    %llu words, %.0f words/sec\n",
+	       (unsigned long long)words, words / secs);
+	printf("lost:        %llu words\n", (unsigned long long)lost);
+	printf("cpu:         %.1f ns/word\n", words ? cpu * 1e9 / words : 0.0);
+	printf("latency p50:   %llu ns\n", (unsigned long long)
+	       bench_percentile(latency, latency_nr, 50.0));
+	printf("latency p99:   %llu ns\n", (unsigned long long)
+	       bench_percentile(latency, latency_nr, 99.0));
+	printf("latency p99.9: %llu ns\n", (unsigned long long)
+	       bench_percentile(latency, latency_nr, 99.9));
+
+	free(latency);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Copyright: 2019-2021, CCX Technologies
+#
+# Runs the benchmark over a range of protocols, batch sizes and socket
+# counts. Set DEVICE, RATE or DURATION to override the defaults.
+
+DEVICE=${DEVICE:-avionics-lb0}
+RATE=${RATE:-100000}
+DURATION=${DURATION:-5}
+
+BENCH=$(dirname "$0")/avionics-bench
+
+# large batches need a larger MTU than the loop back device's default
+ip link set dev "$DEVICE" down
+ip link set dev "$DEVICE" mtu 16384
+ip link set dev "$DEVICE" up
+
+for proto in raw timestamp; do
+	for batch in 1 16 256; do
+		for sockets in 1 4 16; do
+			echo "=== $proto, $batch words per send, $sockets sockets ==="
+			"$BENCH" -i "$DEVICE" -p $proto -r "$RATE" -b $batch \
+				-s $sockets -d "$DURATION" || exit 1
+			echo
+		done
+	done
+done